@@ -9,18 +9,85 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <algorithm>
+#include <limits>
+#include <sched.h>
+#include <vector>
 
 using namespace std;
 
 #define DEBUG false
 
+//Page 0 of the index file holds the metadata: the root pid, the tree
+//height, a magic number marking the format, the page size the index
+//was built with, the layout of its nodes, the size of its keys and
+//whether it keeps duplicate keys. Files written before the last five
+//fields existed have no magic number and always use 1KB pages; those
+//without a key size have int keys.
+static const int META_MAGIC = 0x42545245;
+static const int LEGACY_PAGE_SIZE = 1024;
+
+//The node layout: 1 interleaves keys with RecordIds or PageIds, 2 keeps
+//the keys of a node in an array of their own, and 3 also links every
+//leaf to the one before it. Files from before the layout was recorded
+//use layout 1. Only the current layout is read.
+static const int NODE_LAYOUT = 3;
+
+//Number of leaves read ahead of a range scan
+static const int LEAF_READ_AHEAD = 8;
+
+//Optimistic lock coupling. A writer makes a version odd before it changes
+//what the version guards, and even again when it is done. A reader notes
+//an even version before it reads and checks it is unchanged afterwards.
+static bool readBegin(const volatile unsigned& version, unsigned& v, bool wait)
+{
+    while ((v = version) & 1) {
+        if (!wait) return false;
+        sched_yield();
+    }
+    __sync_synchronize();
+    return true;
+}
+
+static bool readValid(const volatile unsigned& version, unsigned v)
+{
+    __sync_synchronize();
+    return version == v;
+}
+
+static void writeBegin(volatile unsigned& version)
+{
+    __sync_fetch_and_add(&version, 1);
+}
+
+static void writeEnd(volatile unsigned& version)
+{
+    __sync_fetch_and_add(&version, 1);
+}
+
 /*
  * BTreeIndex constructor
  */
-BTreeIndex::BTreeIndex()
+template <class Key>
+BasicBTreeIndex<Key>::BasicBTreeIndex()
 {
     rootPid = -1;
     treeHeight = -1;
+    duplicates = false;
+    mode = 0;
+    inner = NULL;
+    version = 0;
+    pthread_mutex_init(&writeMutex, NULL);
+}
+
+/*
+ * BTreeIndex destructor
+ */
+template <class Key>
+BasicBTreeIndex<Key>::~BasicBTreeIndex()
+{
+    dropInner(this->inner);
+    pthread_mutex_destroy(&writeMutex);
 }
 
 /*
@@ -28,12 +95,14 @@ BTreeIndex::BTreeIndex()
  * Under 'w' mode, the index file should be created if it does not exist.
  * @param indexname[IN] the name of the index file
  * @param mode[IN] 'r' for read, 'w' for write
+ * @param options[IN] PageFile::OPEN_* flags for the underlying PageFile
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+template <class Key>
+RC BasicBTreeIndex<Key>::open(const string& indexname, char mode, int options)
 {
     RC __ret = -1; //Used for return cord
-    char * buffer[PageFile::PAGE_SIZE]; //used for writing in and out the index metadata
+    char buffer[PageFile::PAGE_SIZE]; //used for writing in and out the index metadata
 
     if ( mode == 'r' ) {
         //Will open the file. Errors thrown if the file does not have metadata in page 0
@@ -42,7 +111,7 @@ RC BTreeIndex::open(const string& indexname, char mode)
 
         this->mode = mode;
 
-        if (this->pf.open(indexname, mode) != 0) {
+        if (this->pf.open(indexname, mode, options) != 0) {
             return RC_FILE_OPEN_FAILED;
         }
 
@@ -50,12 +119,13 @@ RC BTreeIndex::open(const string& indexname, char mode)
             return RC_FILE_OPEN_FAILED;
         }
 
-        this->pf.read(0, buffer);
-
-        memcpy((void *) &(this->rootPid), buffer, sizeof(int));
-        memcpy((void *) &(this->treeHeight), ((int *) buffer) + 1, sizeof(int));
+        //Lookups jump around the file, so read-ahead is wasted
+        this->pf.advise(PageFile::ACCESS_RANDOM);
 
-        __ret = 0;
+        __ret = this->readMeta();
+        if (__ret != 0) {
+            this->pf.close();
+        }
 
     } else if ( mode == 'w' ) {
         //Will open the file. Errors thrown if the file cannot be opened. If index metadata
@@ -64,30 +134,29 @@ RC BTreeIndex::open(const string& indexname, char mode)
 
         this->mode = mode;
 
-        if (this->pf.open(indexname, mode) != 0) {
+        if (this->pf.open(indexname, mode, options) != 0) {
             return RC_FILE_OPEN_FAILED;
         }
 
         if (this->pf.endPid() == 0) {
             //Initializing data for metadata page
-            *((int *) buffer) = 1;
-            *((int *) buffer + 1) = 1;
-            this->pf.write(0, buffer);
             this->treeHeight = 1;
             this->rootPid = 1;
+            this->duplicates = false;
+            this->writeMeta();
 
             //Setting up the root node
             memset(buffer, 0, PageFile::PAGE_SIZE);
             this->pf.write(1, buffer);
+            __ret = 0;
         } else {
             //Reading in data from metada page
-            this->pf.read(0, buffer);
-            memcpy((void *) &(this->rootPid), buffer, sizeof(int));
-            memcpy((void *) &(this->treeHeight), ((int *) buffer) + 1, sizeof(int));
+            __ret = this->readMeta();
+            if (__ret != 0) {
+                this->pf.close();
+            }
         }
 
-        __ret = 0;
-
     } else {
         //Invalid mode passed in
         __ret = RC_INVALID_FILE_MODE;
@@ -100,13 +169,16 @@ RC BTreeIndex::open(const string& indexname, char mode)
  * Close the index file.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::close()
+template <class Key>
+RC BasicBTreeIndex<Key>::close()
 {
     //Saving metadata
-    char buffer[PageFile::PAGE_SIZE];
-    *((int *) buffer) = this->rootPid;
-    *((int *) buffer + 1) = this->treeHeight;
-    this->pf.write(0, buffer);
+    if (this->mode == 'w') {
+        this->writeMeta();
+    }
+
+    dropInner(this->inner);
+    this->inner = NULL;
 
     if (this->pf.close() != 0) {
         return RC_FILE_CLOSE_FAILED;
@@ -118,35 +190,297 @@ RC BTreeIndex::close()
     return 0;
 }
 
+/*
+ * Read the root pid and tree height from the metadata page.
+ * @return error code. 0 if no error, RC_INVALID_FILE_FORMAT if the
+ *         index was built with a different page size, node layout or
+ *         key type
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::readMeta()
+{
+    char buffer[PageFile::PAGE_SIZE];
+    int meta[7];
+
+    if (this->pf.read(0, buffer) != 0) {
+        return RC_FILE_READ_FAILED;
+    }
+    memcpy(meta, buffer, sizeof(meta));
+
+    int pageSize = (meta[2] == META_MAGIC) ? meta[3] : LEGACY_PAGE_SIZE;
+    if (pageSize != PageFile::PAGE_SIZE) {
+        if (DEBUG) printf("INDEX BUILT WITH PAGE SIZE %d\n", pageSize);
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    //An index with the old node layout has to be rebuilt
+    int layout = (meta[2] == META_MAGIC && meta[4] != 0) ? meta[4] : 1;
+    if (layout != NODE_LAYOUT) {
+        if (DEBUG) printf("INDEX BUILT WITH NODE LAYOUT %d\n", layout);
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    //The nodes of an index with other keys are laid out differently
+    int keySize = (meta[5] != 0) ? meta[5] : (int) sizeof(int);
+    if (keySize != (int) sizeof(Key)) {
+        if (DEBUG) printf("INDEX BUILT WITH %d-BYTE KEYS\n", keySize);
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    this->rootPid = meta[0];
+    this->treeHeight = meta[1];
+    this->duplicates = (meta[6] != 0);
+    return 0;
+}
+
+/*
+ * Write the root pid, tree height, page size, node layout, key size and
+ * whether the index keeps duplicate keys to the metadata page.
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::writeMeta()
+{
+    char buffer[PageFile::PAGE_SIZE];
+    int meta[7];
+
+    meta[0] = this->rootPid;
+    meta[1] = this->treeHeight;
+    meta[2] = META_MAGIC;
+    meta[3] = PageFile::PAGE_SIZE;
+    meta[4] = NODE_LAYOUT;
+    meta[5] = sizeof(Key);
+    meta[6] = this->duplicates;
+
+    memset(buffer, 0, PageFile::PAGE_SIZE);
+    memcpy(buffer, meta, sizeof(meta));
+    return this->pf.write(0, buffer);
+}
+
 /*
  * Insert (key, RecordId) pair to the index.
  * @param key[IN] the key for the value inserted into the index
  * @param rid[IN] the RecordId for the record being inserted into the index
  * @return error code. 0 if no error
  */
-RC BTreeIndex::insert(int key, const RecordId& rid)
+template <class Key>
+RC BasicBTreeIndex<Key>::insert(Key key, const RecordId& rid)
 {
 
-    BTNonLeafNode node;
-    PageId rootPid = this->getRootPid();
+    NonLeafNode node;
+    LeafNode leafNode;
+    std::vector<InnerNode*> path;
+    PageId rootPid;
+    int eid;
+    RC ret;
+
+    //Inserts are made one at a time. Only they change the nodes in memory,
+    //so an insert reads them without looking at their versions. The root
+    //is read under the mutex, as the insert before may have split it
+    pthread_mutex_lock(&this->writeMutex);
+    rootPid = this->getRootPid();
+
+    if ((ret = loadInner()) != 0) {
+        pthread_mutex_unlock(&this->writeMutex);
+        return ret;
+    }
+
+    //The path to the leaf the key goes to
+    PageId leafPid = rootPid;
+    for (InnerNode* n = this->inner; n != NULL; ) {
+        int i = searchKeys(n->keys, n->keyCount, key, true);
+        path.push_back(n);
+        leafPid = n->pids[i];
+        n = n->aboveLeaves ? NULL : n->children[i];
+    }
+    if ((ret = leafNode.read(leafPid, this->pf)) != 0) {
+        pthread_mutex_unlock(&this->writeMutex);
+        return ret;
+    }
+
+    //A full leaf splits, and so does every full node above it, up to the
+    //node at top that only gets a key; top is -1 if the root splits. The
+    //nodes that change are locked before any page does, so that a lookup
+    //that went through them before starts over
+    bool splits = leafNode.isFull() &&
+                  (this->duplicates || leafNode.locate(key, eid) != 0);
+    int top = path.size() - 1;
+    if (splits) {
+        while (top >= 0 && path[top]->full) {
+            top--;
+        }
+        if (top < 0) writeBegin(this->version);
+        for (int l = (top < 0) ? 0 : top; l < (int)path.size(); l++) {
+            writeBegin(path[l]->version);
+        }
+    }
 
     PageId siblingPid = rootPid;
-    int siblingKey;
+    Key siblingKey;
 
-    RC ret = this->insertHelper(key, rid, 1, rootPid, siblingPid, siblingKey);
+    ret = this->insertHelper(key, rid, 1, rootPid, siblingPid, siblingKey);
 
     //Handles updating of rootPid
-    if (siblingPid != rootPid) {
+    if (ret == 0 && siblingPid != rootPid) {
         if (DEBUG) printf("Updating Root\n");
-        this->rootPid = this->pf.endPid();
-        this->treeHeight = this->treeHeight + 1;
+        PageId newRoot = this->pf.endPid();
         node.initializeRoot(rootPid, siblingKey, siblingPid);
-        node.write(this->rootPid, this->pf);
+        if ((ret = node.write(newRoot, this->pf)) == 0) {
+            this->rootPid = newRoot;
+            this->treeHeight = this->treeHeight + 1;
+        }
+    }
+
+    if (splits) {
+        if (ret == 0) {
+            ret = updateInner(path, top);
+        }
+        for (int l = (top < 0) ? 0 : top; l < (int)path.size(); l++) {
+            writeEnd(path[l]->version);
+        }
+        if (top < 0) writeEnd(this->version);
     }
 
+    pthread_mutex_unlock(&this->writeMutex);
     return ret;
 }
 
+/*
+ * Build the index bottom-up from (key, RecordId) pairs sorted by key.
+ * @param source[IN] the pairs, in non-decreasing key order
+ * @param fill[IN] the % of every node to fill, 1 to 100
+ * @param duplicates[IN] whether to keep every pair with the same key
+ * @return error code. 0 if no error, RC_NOT_SORTED if a key is
+ *         smaller than the one before it
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::bulkLoad(BasicEntrySource<Key>& source, int fill, bool duplicates)
+{
+    LeafNode root;
+    Key key;
+    RecordId rid;
+    RC ret;
+
+    if (this->mode != 'w') {
+        return RC_INVALID_FILE_MODE;
+    }
+    if (fill < 1 || fill > 100) {
+        fill = DEFAULT_FILL;
+    }
+
+    //An index with entries already takes the new ones one at a time.
+    //A key it holds is skipped as with bulk loading, unless the index
+    //keeps duplicate keys; any other error stops the load
+    if (this->getTreeHeight() > 1 ||
+        (root.read(this->getRootPid(), this->pf) == 0 && root.getKeyCount() > 0)) {
+        if (duplicates && !this->duplicates) {
+            return RC_INVALID_FILE_MODE;
+        }
+        while ((ret = source.next(key, rid)) == 0) {
+            ret = this->insert(key, rid);
+            if (ret != 0 && ret != RC_DUPLICATE_KEY) {
+                return ret;
+            }
+        }
+        return (ret == RC_END_OF_FILE) ? 0 : ret;
+    }
+
+    dropInner(this->inner);
+    this->inner = NULL;
+    this->duplicates = duplicates;
+
+    //The leaves go to consecutive pages, starting with the empty root
+    PageId pid = this->getRootPid();
+    if (pid != this->pf.endPid() - 1) {
+        pid = this->pf.endPid();
+    }
+
+    //The key in front of every node of the level built last, and its
+    //PageId. The key in front of a leaf parts it from the leaf before
+    std::vector<Key> keys;
+    std::vector<PageId> pids;
+
+    LeafNode leaf;
+    Key lastKey = Key();
+
+    while ((ret = source.next(key, rid)) == 0) {
+        if (!keys.empty() && key <= lastKey) {
+            if (key < lastKey) return RC_NOT_SORTED;
+            if (!duplicates) continue;
+        }
+
+        //A full leaf links to the leaf written right after it
+        if (leaf.isFull(fill)) {
+            leaf.setNextNodePtr(pid + 1);
+            if ((ret = leaf.write(pid++, this->pf)) != 0) return ret;
+            leaf.setKeyCount(0);
+            leaf.setPrevNodePtr(pid - 1);
+        }
+        if (leaf.getKeyCount() == 0) {
+            keys.push_back(keys.empty() ? key : separatorKey(lastKey, key));
+            pids.push_back(pid);
+        }
+        leaf.append(key, rid);
+        lastKey = key;
+    }
+    if (ret != RC_END_OF_FILE) {
+        return ret;
+    }
+    if (keys.empty()) {
+        return 0;
+    }
+
+    //The last leaf ends the chain with a pid of 0, as readForward() expects
+    leaf.setNextNodePtr(0);
+    if ((ret = leaf.write(pid++, this->pf)) != 0) return ret;
+
+    //Each level above takes the keys and PageIds of the one below.
+    //The children are spread evenly over the nodes, so that with at least
+    //4 children per node every node gets 2 or more, i.e., 1 or more keys
+    int perNode = (NonLeafNode::MAX_KEY_COUNT + 1) * fill / 100;
+    if (perNode < 4) perNode = 4;
+    int height = 1;
+
+    while (pids.size() > 1) {
+        std::vector<Key> upperKeys;
+        std::vector<PageId> upperPids;
+        int n = pids.size();
+        int count = (n + perNode - 1) / perNode;
+        int first = 0;
+
+        //Every node takes its share of the children left. A node whose
+        //keys fill it before that leaves more to the nodes after it, but
+        //never a single child, which would make a node without keys
+        while (first < n) {
+            int end = first + (n - first + count - 1) / count;
+            int j;
+            NonLeafNode node;
+
+            node.initializeRoot(pids[first], keys[first + 1], pids[first + 1]);
+            for (j = first + 2; j < end && !node.isFull(fill); j++) {
+                node.append(keys[j], pids[j]);
+            }
+            if (j < end && j == n - 1) {
+                node.setKeyCount(node.getKeyCount() - 1);
+                j--;
+            }
+            upperKeys.push_back(keys[first]);
+            upperPids.push_back(pid);
+            if ((ret = node.write(pid++, this->pf)) != 0) return ret;
+            first = j;
+            if (count > 1) count--;
+        }
+
+        keys.swap(upperKeys);
+        pids.swap(upperPids);
+        height++;
+    }
+
+    this->rootPid = pids[0];
+    this->treeHeight = height;
+    return this->writeMeta();
+}
+
 /**
  * Run the standard B+Tree key search algorithm and identify the
  * leaf node where searchKey may exist. If an index entry with
@@ -165,41 +499,300 @@ RC BTreeIndex::insert(int key, const RecordId& rid)
  *                    smaller than searchKey.
  * @return 0 if searchKey is found. Othewise an error code
  */
-RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
+template <class Key>
+RC BasicBTreeIndex<Key>::locate(Key searchKey, IndexCursor& cursor)
 {
-    BTNonLeafNode nonLeafNode;
-    BTLeafNode leafNode;
+    LeafNode leafNode;
+    PageId pid;
+    RC ret;
 
-    int currentLevel = 1;
-    PageId pid = this->getRootPid();
+    //The parent of the leaf is remembered for reading ahead
+    cursor.raLast = -1;
+    ret = locateLeaf(searchKey, pid, cursor.raParent, &leafNode, true);
+    if (ret != 0) {
+        if (DEBUG) { printf("INDEX LOCATE DESCENT FAILED"); }
+        return ret;
+    }
+
+    cursor.pid = pid;
+    ret = leafNode.locate(searchKey, cursor.eid);
+
+    return ret;
+}
+
+/*
+ * Find the leaf node where searchKey may exist. The non-leaf nodes in
+ * memory are read with optimistic lock coupling: if a node changed while
+ * it was read, the lookup starts over from the root.
+ * @param searchKey[IN] the key to find
+ * @param pid[OUT] the PageId of the leaf node
+ * @param parent[OUT] the PageId of its parent, -1 if the leaf is the root
+ * @param leaf[OUT] if not NULL, the leaf is pinned in it before the path
+ *                  to it is checked, so that it cannot have split since
+ * @param wait[IN] whether to wait for an insert changing the path. A
+ *                 caller holding a pinned page must not wait, as the
+ *                 insert may be waiting for the page
+ * @param first[IN] whether to find the first leaf that may hold
+ *                  searchKey, where a run of equal keys begins, rather
+ *                  than the one an insert of it goes to
+ * @return error code. 0 if no error, RC_NO_SUCH_RECORD if wait is false
+ *         and an insert is changing the path
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::locateLeaf(Key searchKey, PageId& pid, PageId& parent, LeafNode* leaf, bool wait,
+                                    bool first)
+{
+    unsigned treeVersion, nodeVersion, childVersion;
     RC ret;
 
-    //Traversing down to leaf node
-    while(currentLevel < this->getTreeHeight()) {
-        ret = nonLeafNode.read(pid, this->pf);
-        if (ret != 0) {
-            if (DEBUG) { printf("INDEX LOCATE DESCENT FAILED DURING NODE READ"); }
-            return ret;
+    if (leaf != NULL) {
+        leaf->release();
+    }
+
+    for (;;) {
+        if (!readBegin(this->version, treeVersion, wait)) {
+            return RC_NO_SUCH_RECORD;
         }
-        ret = nonLeafNode.locateChildPtr(searchKey, pid);
-        if (ret != 0) {
-            if (DEBUG) { printf("INDEX LOCATE DESCENT FAILED DURING NODE LOCATE"); }
+        InnerNode* node = this->inner;
+        int height = this->treeHeight;
+        pid = this->rootPid;
+        parent = -1;
+        if (!readValid(this->version, treeVersion)) {
+            continue;
+        }
+
+        //The non-leaf nodes are read into memory on the first lookup
+        if (node == NULL && height > 1) {
+            if (!wait) return RC_NO_SUCH_RECORD;
+            pthread_mutex_lock(&this->writeMutex);
+            ret = loadInner();
+            pthread_mutex_unlock(&this->writeMutex);
+            if (ret != 0) return ret;
+            continue;
+        }
+
+        //The root is a leaf
+        if (node == NULL) {
+            ret = (leaf != NULL) ? leaf->pin(pid, this->pf) : 0;
+            if (readValid(this->version, treeVersion)) {
+                return ret;
+            }
+            if (leaf != NULL) leaf->release();
+            continue;
+        }
+
+        if (!readBegin(node->version, nodeVersion, wait)) {
+            return RC_NO_SUCH_RECORD;
+        }
+        if (!readValid(this->version, treeVersion)) {
+            continue;
+        }
+
+        //Going down, the version of a node is checked once the version of
+        //its child is known. A node being changed may hold any key count
+        //or pointer, which is never used before the check
+        for (;;) {
+            int keyCount = node->keyCount;
+            if (keyCount < 0 || keyCount > NonLeafNode::MAX_KEY_COUNT) {
+                keyCount = 0;
+            }
+            //The smallest key leads to the first leaf, even where a run of
+            //equal keys spans leaves
+            bool upper = !first && searchKey != numeric_limits<Key>::min();
+            int i = searchKeys(node->keys, keyCount, searchKey, upper);
+
+            if (node->aboveLeaves) {
+                parent = node->pid;
+                pid = node->pids[i];
+                ret = (leaf != NULL) ? leaf->pin(pid, this->pf) : 0;
+                if (readValid(node->version, nodeVersion)) {
+                    return ret;
+                }
+                if (leaf != NULL) leaf->release();
+                break;
+            }
+
+            InnerNode* child = node->children[i];
+            if (child == NULL) {
+                break;
+            }
+            if (!readBegin(child->version, childVersion, wait)) {
+                return RC_NO_SUCH_RECORD;
+            }
+            if (!readValid(node->version, nodeVersion)) {
+                break;
+            }
+            node = child;
+            nodeVersion = childVersion;
+        }
+    }
+}
+
+//Orders the positions of the keys of a batch lookup by key
+template <class Key>
+struct ByKey {
+    const Key* keys;
+    ByKey(const Key* keys) : keys(keys) {}
+    bool operator()(int a, int b) const { return keys[a] < keys[b]; }
+};
+
+/*
+ * Look up a batch of keys at once, descending the tree once for all of
+ * them and pinning each leaf once for all of its keys.
+ * @param keys[IN] the keys to find, in any order
+ * @param n[IN] the number of keys
+ * @param cursors[OUT] for every key, the cursor locate() would set it
+ *                     to; may be NULL
+ * @param rids[OUT] for every key, the RecordId stored with it, or a pid
+ *                  of -1 if the index does not have it; may be NULL
+ * @return the number of keys found, or an error code
+ */
+template <class Key>
+int BasicBTreeIndex<Key>::locateBatch(const Key* keys, int n, IndexCursor* cursors, RecordId* rids)
+{
+    LeafNode leafNode;
+    std::vector<LeafKeys> leaves;
+    unsigned treeVersion;
+    int found = 0;
+    RC ret;
+
+    if (n <= 0) {
+        return 0;
+    }
+
+    //The keys are looked up in key order
+    std::vector<int> order(n);
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), ByKey<Key>(keys));
+
+    //and go down the non-leaf nodes in memory together, so that the keys
+    //sharing a path are split only where their paths part. If a node
+    //changes meanwhile, the keys are split again from the root
+    for (;;) {
+        leaves.clear();
+        readBegin(this->version, treeVersion, true);
+        InnerNode* node = this->inner;
+        int height = this->treeHeight;
+        PageId root = this->rootPid;
+        if (!readValid(this->version, treeVersion)) {
+            continue;
+        }
+
+        if (node == NULL && height > 1) {
+            pthread_mutex_lock(&this->writeMutex);
+            ret = loadInner();
+            pthread_mutex_unlock(&this->writeMutex);
+            if (ret != 0) return ret;
+            continue;
+        }
+
+        if (node == NULL) {
+            LeafKeys leaf = { root, n, &this->version, treeVersion };
+            leaves.push_back(leaf);
+            break;
+        }
+        if (groupByLeaf(node, keys, &order[0], 0, n, leaves) &&
+            readValid(this->version, treeVersion)) {
+            break;
+        }
+    }
+
+    //The leaves are requested all at once, consecutive pages together,
+    //before the first is waited for
+    if (leaves.size() > 1) {
+        for (unsigned i = 0, j; i < leaves.size(); i = j) {
+            for (j = i + 1; j < leaves.size() && leaves[j].pid == leaves[j - 1].pid + 1; j++);
+            this->pf.prefetch(leaves[i].pid, j - i);
+        }
+    }
+
+    for (unsigned i = 0, first = 0; i < leaves.size(); first = leaves[i++].end) {
+        ret = leafNode.pin(leaves[i].pid, this->pf);
+
+        //A leaf that split since it was found is found again for each key
+        bool moved = !readValid(*leaves[i].guard, leaves[i].version);
+        if (ret != 0 && !moved) {
             return ret;
         }
-        currentLevel++;
+
+        for (int j = first; j < leaves[i].end; j++) {
+            int k = order[j];
+            PageId pid = leaves[i].pid;
+            PageId parent;
+            int eid;
+            Key key;
+            RecordId rid;
+
+            if (moved) {
+                if ((ret = locateLeaf(keys[k], pid, parent, &leafNode, true)) != 0) {
+                    return ret;
+                }
+            }
+
+            rid.pid = -1;
+            rid.sid = -1;
+            if (leafNode.locate(keys[k], eid) == 0) {
+                leafNode.readEntry(eid, key, rid);
+                found++;
+            }
+            if (cursors != NULL) {
+                cursors[k].pid = pid;
+                cursors[k].eid = eid;
+                cursors[k].raParent = -1;
+                cursors[k].raLast = -1;
+            }
+            if (rids != NULL) {
+                rids[k] = rid;
+            }
+        }
     }
 
-    //Getting value
-    ret = leafNode.read(pid, this->pf);
-    if (ret != 0) {
-        if (DEBUG) { printf("INDEX LOCATE DESCENT FAILED DURING LEAF NODE READ"); }
-        return ret;
+    return found;
+}
+
+/*
+ * Split the sorted keys of a batch lookup among the leaves below a
+ * non-leaf node in memory, checking the versions of the nodes as a
+ * lookup does.
+ * @param node[IN] the node
+ * @param keys[IN] the keys of the batch
+ * @param order[IN] the positions of the keys in key order
+ * @param first[IN] the first of the positions that lead through node
+ * @param last[IN] the end of those positions
+ * @param leaves[OUT] the leaves found are appended, in key order
+ * @return false if a node changed while it was read
+ */
+template <class Key>
+bool BasicBTreeIndex<Key>::groupByLeaf(InnerNode* node, const Key* keys, const int* order, int first, int last,
+                                  vector<LeafKeys>& leaves)
+{
+    unsigned nodeVersion;
+    int i, j;
+
+    readBegin(node->version, nodeVersion, true);
+    int keyCount = node->keyCount;
+    if (keyCount < 0 || keyCount > NonLeafNode::MAX_KEY_COUNT) {
+        return false;
     }
 
-    cursor.pid = pid;
-    ret = leafNode.locate(searchKey, cursor.eid);
+    for (i = first; i < last; i = j) {
+        //The child of key i also takes the keys behind it that are
+        //smaller than the key following that child
+        int c = searchKeys(node->keys, keyCount, keys[order[i]], true);
+        for (j = i + 1; j < last && (c == keyCount || keys[order[j]] < node->keys[c]); j++);
+
+        if (node->aboveLeaves) {
+            LeafKeys leaf = { node->pids[c], j, &node->version, nodeVersion };
+            leaves.push_back(leaf);
+        } else if (node->children[c] == NULL ||
+                   !groupByLeaf(node->children[c], keys, order, i, j, leaves)) {
+            return false;
+        }
+    }
 
-    return ret;
+    return readValid(node->version, nodeVersion);
 }
 
 /*
@@ -213,9 +806,10 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
  *  RC_INVALID_CURSOR: either pid or eid is not valid
  *  RC_END_OF_TREE: returned last element of tree
  */
-RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+template <class Key>
+RC BasicBTreeIndex<Key>::readForward(IndexCursor& cursor, Key& key, RecordId& rid)
 {
-    BTLeafNode node;
+    LeafNode node;
     //I will signal a pid of 0 as the end of tree. This is because it's
     //the default nextNodePtr when constructing a new leaf node, and I 
     //am too lazy to change it
@@ -223,7 +817,7 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
         return RC_END_OF_TREE;
     }
 
-    if (node.read(cursor.pid, this->pf) != 0) {
+    if (node.pin(cursor.pid, this->pf) != 0) {
         return RC_INVALID_CURSOR;
     }
 
@@ -231,7 +825,13 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
         cursor.eid = 0;
         cursor.pid = node.getNextNodePtr();
 
-        return readForward(cursor, key, rid);
+        //The scan moved on to the next leaf, so it is a range scan;
+        //keep the following leaves coming in the background
+        RC ret = readForward(cursor, key, rid);
+        if (ret == 0 && cursor.eid == 1) {
+            prefetchLeaves(cursor.pid, key, false, cursor.raParent, cursor.raLast);
+        }
+        return ret;
     }
 
     //Setting next cursor
@@ -248,6 +848,317 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
     return 0;
 }
 
+/*
+ * Find the leaf node where searchKey may exist and set the cursor to the
+ * entry with the largest key not larger than searchKey.
+ * @param key[IN] the key to find
+ * @param cursor[OUT] the cursor pointing to the index entry with the
+ *                    largest key not larger than searchKey. eid is -1
+ *                    if that entry is in the leaf before.
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::locateLast(Key searchKey, IndexCursor& cursor)
+{
+    LeafNode leafNode;
+    PageId pid;
+    RC ret;
+
+    cursor.raLast = -1;
+    ret = locateLeaf(searchKey, pid, cursor.raParent, &leafNode, true);
+    if (ret != 0) {
+        return ret;
+    }
+
+    cursor.pid = pid;
+    return leafNode.locateLast(searchKey, cursor.eid);
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move back the cursor to the previous entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ * Error modes:
+ *  RC_INVALID_CURSOR: either pid or eid is not valid
+ *  RC_END_OF_TREE: returned first element of tree
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::readBackward(IndexCursor& cursor, Key& key, RecordId& rid)
+{
+    LeafNode node;
+    bool moved = false;
+
+    if (cursor.pid == 0) {
+        return RC_END_OF_TREE;
+    }
+
+    if (node.pin(cursor.pid, this->pf) != 0) {
+        return RC_INVALID_CURSOR;
+    }
+
+    //Before the first entry of a leaf comes the last entry of the leaf
+    //before it. The first leaf has a previous pid of 0, as the last leaf
+    //has a next pid of 0
+    if (cursor.eid < 0) {
+        cursor.pid = node.getPrevNodePtr();
+        if (cursor.pid == 0) {
+            return RC_END_OF_TREE;
+        }
+        if (node.pin(cursor.pid, this->pf) != 0) {
+            return RC_INVALID_CURSOR;
+        }
+        cursor.eid = node.getKeyCount() - 1;
+        moved = true;
+    }
+
+    if (node.readEntry(cursor.eid, key, rid) != 0) {
+        return RC_INVALID_CURSOR;
+    }
+    cursor.eid--;
+
+    //The scan moved back to this leaf, so it is a range scan
+    if (moved) {
+        prefetchLeaves(cursor.pid, key, true, cursor.raParent, cursor.raLast);
+    }
+
+    return 0;
+}
+
+/*
+ * Scanner of the entries of an index, in key order.
+ * @param index[IN] the open index to scan
+ */
+template <class Key>
+BasicBTreeIndex<Key>::Scanner::Scanner(BasicBTreeIndex& index)
+{
+    this->index = &index;
+    this->cursor.pid = 0;
+    this->cursor.eid = 0;
+    this->count = -1;
+    this->moved = false;
+    this->cursor.raParent = -1;
+    this->cursor.raLast = -1;
+}
+
+/*
+ * Start the scan at the first entry with a key not smaller than searchKey.
+ * The leaf found stays pinned for next().
+ * @param searchKey[IN] the key to start from
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::locate(Key searchKey)
+{
+    RC ret;
+
+    this->count = -1;
+    this->moved = false;
+    this->cursor.raLast = -1;
+    if ((ret = this->index->locateLeaf(searchKey, this->cursor.pid, this->cursor.raParent,
+                                       &this->leaf, true, this->index->duplicates)) != 0) {
+        this->cursor.pid = 0;
+        return ret;
+    }
+    this->count = this->leaf.getKeyCount();
+    this->leaf.locate(searchKey, this->cursor.eid);
+    return 0;
+}
+
+/*
+ * Start the scan at the first entry of the index.
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::first()
+{
+    //The smallest key leads to the first leaf
+    return locate(numeric_limits<Key>::min());
+}
+
+/*
+ * Start the scan right behind the last entry with a key not larger than
+ * searchKey. The leaf found stays pinned for prev().
+ * @param searchKey[IN] the key to start from
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::locateLast(Key searchKey)
+{
+    RC ret;
+
+    this->count = -1;
+    this->moved = false;
+    this->cursor.raLast = -1;
+    if ((ret = this->index->locateLeaf(searchKey, this->cursor.pid, this->cursor.raParent,
+                                       &this->leaf, true)) != 0) {
+        this->cursor.pid = 0;
+        return ret;
+    }
+    this->count = this->leaf.getKeyCount();
+    this->leaf.locateLast(searchKey, this->cursor.eid);
+    this->cursor.eid++;
+    return 0;
+}
+
+/*
+ * Start the scan behind the last entry of the index.
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::last()
+{
+    //The largest key leads to the last leaf
+    return locateLast(numeric_limits<Key>::max());
+}
+
+/*
+ * Pin the leaf of the cursor, unless it is pinned already. A cursor
+ * behind the last entry of the leaf is moved to its end.
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::pin()
+{
+    RC ret;
+
+    if (this->count >= 0) return 0;
+    if ((ret = this->leaf.pin(this->cursor.pid, this->index->pf)) != 0) {
+        return ret;
+    }
+    this->count = this->leaf.getKeyCount();
+    if (this->cursor.eid > this->count) this->cursor.eid = this->count;
+    return 0;
+}
+
+/*
+ * Return up to max of the next entries, all from the same leaf.
+ * @param keys[OUT] the keys of the entries
+ * @param rids[OUT] the RecordIds of the entries
+ * @param max[IN] the most entries to return
+ * @return the number of entries returned, 0 at the end of the index,
+ *         or an error code
+ */
+template <class Key>
+int BasicBTreeIndex<Key>::Scanner::next(Key* keys, RecordId* rids, int max)
+{
+    RC ret;
+    int n;
+
+    //A pid of 0 ends the chain of leaves, as in readForward()
+    while (this->cursor.pid != 0) {
+        if ((ret = pin()) != 0) {
+            return ret;
+        }
+
+        n = this->leaf.readEntries(this->cursor.eid, keys, rids, max);
+        if (n > 0) {
+            //The scan moved on to this leaf, so it is a range scan;
+            //keep the following leaves coming in the background
+            if (this->moved) {
+                this->index->prefetchLeaves(this->cursor.pid, keys[0], false,
+                                            this->cursor.raParent, this->cursor.raLast);
+                this->moved = false;
+            }
+            this->cursor.eid += n;
+            return n;
+        }
+
+        //The leaf is done; the next one replaces it in leaf
+        this->cursor.pid = this->leaf.getNextNodePtr();
+        this->cursor.eid = 0;
+        this->count = -1;
+        this->moved = true;
+    }
+
+    return 0;
+}
+
+/*
+ * Return the next entry.
+ * @param key[OUT] the key of the entry
+ * @param rid[OUT] the RecordId of the entry
+ * @return error code. RC_END_OF_TREE after the last entry
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::next(Key& key, RecordId& rid)
+{
+    int n = next(&key, &rid, 1);
+
+    if (n < 0) return n;
+    return (n == 0) ? RC_END_OF_TREE : 0;
+}
+
+/*
+ * Return up to max of the previous entries, all from the same leaf.
+ * @param keys[OUT] the keys of the entries, the largest first
+ * @param rids[OUT] the RecordIds of the entries
+ * @param max[IN] the most entries to return
+ * @return the number of entries returned, 0 at the start of the index,
+ *         or an error code
+ */
+template <class Key>
+int BasicBTreeIndex<Key>::Scanner::prev(Key* keys, RecordId* rids, int max)
+{
+    RC ret;
+    int n;
+
+    //A pid of 0 also ends the chain of leaves going back
+    while (this->cursor.pid != 0) {
+        if ((ret = pin()) != 0) {
+            return ret;
+        }
+
+        n = this->leaf.readEntriesBackward(this->cursor.eid, keys, rids, max);
+        if (n > 0) {
+            //Keep the leaves before this one coming in the background
+            if (this->moved) {
+                this->index->prefetchLeaves(this->cursor.pid, keys[0], true,
+                                            this->cursor.raParent, this->cursor.raLast);
+                this->moved = false;
+            }
+            this->cursor.eid -= n;
+            return n;
+        }
+
+        //The leaf is done; the one before replaces it, read from its end.
+        //If that leaf split after the back link was read, the leaves
+        //split off it come in between and are read first
+        PageId from = this->cursor.pid;
+        this->cursor.pid = this->leaf.getPrevNodePtr();
+        this->moved = true;
+        while (this->cursor.pid != 0) {
+            this->cursor.eid = LeafNode::MAX_KEY_COUNT;
+            this->count = -1;
+            if ((ret = pin()) != 0) {
+                return ret;
+            }
+            PageId next = this->leaf.getNextNodePtr();
+            if (next == from || next == 0) break;
+            this->cursor.pid = next;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Return the previous entry.
+ * @param key[OUT] the key of the entry
+ * @param rid[OUT] the RecordId of the entry
+ * @return error code. RC_END_OF_TREE before the first entry
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::Scanner::prev(Key& key, RecordId& rid)
+{
+    int n = prev(&key, &rid, 1);
+
+    if (n < 0) return n;
+    return (n == 0) ? RC_END_OF_TREE : 0;
+}
+
 
 //key: search key
 //rid: record ID to insert
@@ -256,14 +1167,15 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 //retPid: return pid, pid != ret iff we insert and split
 //retKey: changed iff insert and split
 //This function is SOOO GNARLY. I'll try to fix it, but it's probably not gonna happen
-RC BTreeIndex::insertHelper(int key, const RecordId& rid, int treeLevel, PageId pid, PageId& retPid, int& retKey) {
-    BTLeafNode leafNode;
-    BTLeafNode siblingLeaf;
-    BTNonLeafNode nonLeafNode;
-    BTNonLeafNode siblingNonLeaf;
+template <class Key>
+RC BasicBTreeIndex<Key>::insertHelper(Key key, const RecordId& rid, int treeLevel, PageId pid, PageId& retPid, Key& retKey) {
+    LeafNode leafNode;
+    LeafNode siblingLeaf;
+    NonLeafNode nonLeafNode;
+    NonLeafNode siblingNonLeaf;
 
     RC ret;
-    int childSiblingKey;
+    Key childSiblingKey;
     PageId childSiblingPid;
     PageId childPid; //this is pid of the node below this one, if this is a nonleaf
         //and we're trying to find the leaf
@@ -272,18 +1184,28 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, int treeLevel, PageId
         //Inserting into leaf node
 
 
-        leafNode.read(pid, this->pf);
+        if ((ret = leafNode.read(pid, this->pf)) != 0) {
+            return ret;
+        }
         if (DEBUG) printf("INDEX INSERT: LEAF NEXT PID OF %d\n", leafNode.getNextNodePtr());
-        ret = leafNode.insert(key, rid);
+        ret = leafNode.insert(key, rid, this->duplicates);
         if (ret == RC_NODE_FULL) {
             //Handling a full leaf node, use insertAndSplit
             if (DEBUG) printf("INDEX INSERT: LEAF NEXT PID OF %d\n", leafNode.getNextNodePtr());
-            ret = leafNode.insertAndSplit(key, rid, siblingLeaf, retKey);
+            ret = leafNode.insertAndSplit(key, rid, siblingLeaf, retKey, this->duplicates);
+            if (ret != 0) {
+                //The key is in the leaf already; nothing is split
+                return ret;
+            }
             if (DEBUG) printf("INDEX INSERT: LEAF NEXT PID OF %d\n", leafNode.getNextNodePtr());
-            retPid = this->pf.endPid();
+            PageId newPid = this->pf.endPid();
             if (DEBUG) printf("INDEX INSERT: LEAF NEXT PID OF %d\n", leafNode.getNextNodePtr());
-            leafNode.setNextNodePtr(retPid);
-            siblingLeaf.write(retPid, this->pf);
+            leafNode.setNextNodePtr(newPid);
+            siblingLeaf.setPrevNodePtr(pid);
+            if ((ret = siblingLeaf.write(newPid, this->pf)) != 0) {
+                return ret;
+            }
+            retPid = newPid;
             if (DEBUG) printf("INDEX INSERT: SPLIT AT LEAF, ORIGINAL NEXT PID OF %d\n", leafNode.getNextNodePtr());
             if (DEBUG) printf("INDEX INSERT: SPLIT AT LEAF, SIBLING NEXT PID OF %d\n", siblingLeaf.getNextNodePtr());
         }
@@ -297,28 +1219,61 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, int treeLevel, PageId
             if (DEBUG) { printf("ERROR IN INSERT HELPER DURING WRITING\n"); }
             return ret;
         }
+
+        //The leaf after the sibling now comes after it. Scans running
+        //meanwhile stay right because the sibling is written before the
+        //leaf that links to it, and the leaf before this back link
+        PageId nextPid = (retPid != pid) ? siblingLeaf.getNextNodePtr() : 0;
+        if (nextPid != 0) {
+            LeafNode nextLeaf;
+            if ((ret = nextLeaf.read(nextPid, this->pf)) != 0) {
+                return ret;
+            }
+            nextLeaf.setPrevNodePtr(retPid);
+            if ((ret = nextLeaf.write(nextPid, this->pf)) != 0) {
+                return ret;
+            }
+        }
     } else {
         //Traverse down tree
-        nonLeafNode.read(pid, this->pf);
+        if ((ret = nonLeafNode.read(pid, this->pf)) != 0) {
+            return ret;
+        }
         nonLeafNode.locateChildPtr(key, childPid);
         childSiblingPid = childPid;
         ret = insertHelper(key, rid, treeLevel + 1, childPid, childSiblingPid, childSiblingKey);
+        if (ret != 0) {
+            return ret;
+        }
 
-        //Handling an insertAndSplit lower in the tree
+        //Handling an insertAndSplit lower in the tree. The new child goes
+        //right behind the one that split, which a key search cannot tell
+        //among children with equal keys
         if (childPid != childSiblingPid) {
             //Insert!!!
-            ret = nonLeafNode.insert(childSiblingKey, childSiblingPid);
+            ret = nonLeafNode.insert(childSiblingKey, childSiblingPid, childPid);
             if (DEBUG) printf("SPLIT AT %d\n", treeLevel);
 
             if (ret == RC_NODE_FULL) {
                 if (DEBUG) printf("MEGA SPLIT at %d!\n", treeLevel);
                 //Split!!!
-                nonLeafNode.insertAndSplit(childSiblingKey, childSiblingPid, siblingNonLeaf, retKey);
-                retPid = this->pf.endPid();
-                siblingNonLeaf.write(retPid, this->pf);
+                ret = nonLeafNode.insertAndSplit(childSiblingKey, childSiblingPid, siblingNonLeaf, retKey,
+                                                 childPid);
+                if (ret != 0) {
+                    return ret;
+                }
+                PageId newPid = this->pf.endPid();
+                if ((ret = siblingNonLeaf.write(newPid, this->pf)) != 0) {
+                    return ret;
+                }
+                retPid = newPid;
+            } else if (ret != 0) {
+                return ret;
             }
 
-            nonLeafNode.write(pid, this->pf);
+            if ((ret = nonLeafNode.write(pid, this->pf)) != 0) {
+                return ret;
+            }
         }
     }
 
@@ -326,37 +1281,337 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, int treeLevel, PageId
     return 0;
 }
 
-RC BTreeIndex::getFirstElement(IndexCursor& cursor) {
-    BTNonLeafNode nonLeafNode;
-    PageId pid = this->getRootPid();
-    int currentLevel = 1;
+template <class Key>
+RC BasicBTreeIndex<Key>::getFirstElement(IndexCursor& cursor) {
+    //The smallest key leads to the first leaf
+    cursor.raLast = -1;
+    cursor.eid = 0;
+    return locateLeaf(numeric_limits<Key>::min(), cursor.pid, cursor.raParent, NULL, true);
+}
 
-    while(currentLevel < this->getTreeHeight()) {
-        nonLeafNode.read(pid, this->pf);
-        currentLevel++;
-        if (nonLeafNode.getFirstPage(pid) != 0) {
-            if (DEBUG) { printf("ERROR IN DEBUGPRINTOUT WHERE EMPTY NONLEAF NODE REACHED\n"); }
-            return -1;
+/*
+ * Read the non-leaf nodes into memory, unless they are already. The caller
+ * holds writeMutex.
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::loadInner()
+{
+    InnerNode* node;
+    RC ret;
+
+    if (this->inner != NULL || this->getTreeHeight() < 2) {
+        return 0;
+    }
+    if ((ret = readInner(this->getRootPid(), 1, node)) != 0) {
+        return ret;
+    }
+
+    //The nodes are complete before a lookup can find them
+    __sync_synchronize();
+    this->inner = node;
+    return 0;
+}
+
+/*
+ * Read a non-leaf node and the non-leaf nodes below it into memory.
+ * @param pid[IN] the PageId of the node
+ * @param level[IN] the level of the node; the root is at level 1
+ * @param node[OUT] the node read, NULL if there is an error
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::readInner(PageId pid, int level, InnerNode*& node)
+{
+    RC ret;
+
+    node = new InnerNode;
+    node->pid = pid;
+    node->version = 0;
+
+    //The children of the level above the leaves are leaves
+    node->aboveLeaves = (level + 1 >= this->getTreeHeight());
+    if ((ret = fillInner(node, NULL, 0)) != 0) {
+        delete node;
+        node = NULL;
+        return ret;
+    }
+
+    if (!node->aboveLeaves) {
+        for (int i = 0; i <= node->keyCount; i++) {
+            if ((ret = readInner(node->pids[i], level + 1, node->children[i])) != 0) {
+                dropInner(node);
+                node = NULL;
+                return ret;
+            }
         }
     }
 
+    return 0;
+}
 
-    cursor.pid = pid;
-    cursor.eid = 0;
+/*
+ * Read the keys and the child-node pointers of a non-leaf node in memory
+ * from its page. Its children in memory are found by PageId among the
+ * nodes given; those that are not there are left NULL.
+ * @param node[IN] the node, with its pid and aboveLeaves set
+ * @param from[IN] the nodes that may be children of node
+ * @param count[IN] the number of nodes in from
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::fillInner(InnerNode* node, InnerNode** from, int count)
+{
+    NonLeafNode nonLeafNode;
+    RC ret;
+
+    if ((ret = nonLeafNode.pin(node->pid, this->pf)) != 0) {
+        return ret;
+    }
+
+    int keyCount = nonLeafNode.getKeyCount();
+    if (keyCount < 1 || keyCount > NonLeafNode::MAX_KEY_COUNT) {
+        return RC_INVALID_FILE_FORMAT;
+    }
+
+    node->keyCount = keyCount;
+    node->full = nonLeafNode.isFull();
+    nonLeafNode.getEntries(node->keys, node->pids);
+    for (int i = 0; i <= keyCount; i++) {
+        node->children[i] = NULL;
+        for (int j = 0; j < count && !node->aboveLeaves; j++) {
+            if (from[j] != NULL && from[j]->pid == node->pids[i]) {
+                node->children[i] = from[j];
+                break;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Bring the non-leaf nodes in memory up to date with their pages after an
+ * insert split the leaf below path. Every node of path from top on got a
+ * key, and all of them but the one at top split; top is -1 if the root
+ * split as well. The caller holds writeMutex and has locked the nodes.
+ * @param path[IN] the non-leaf nodes from the root to the leaf
+ * @param top[IN] the highest node that changed, -1 for a new root
+ * @return error code. 0 if no error
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::updateInner(std::vector<InnerNode*>& path, int top)
+{
+    NonLeafNode above;
+    InnerNode* split = NULL;  //the node split off the one below
+    std::vector<InnerNode*> from;
+    std::vector<PageId> siblings(path.size(), 0);
+    RC ret;
+
+    //The pages split off the nodes, from the top down. A split node is
+    //followed by the new one in the node above, which is the new root if
+    //the node was the root. When the node above split too, the node may
+    //have gone to the one split off it, or stayed last and left the new
+    //node first there
+    PageId parent = (top < 0) ? this->getRootPid() : path[top]->pid;
+    PageId parentSibling = 0;
+    for (int l = top + 1; l < (int)path.size(); l++) {
+        PageId next;
+        int count = 1;
+        if ((ret = above.pin(parent, this->pf)) != 0) {
+            return ret;
+        }
+        ret = above.getNextChildPtrs(path[l]->pid, &next, count);
+        if (ret == 0 && count == 0 && parentSibling != 0) {
+            std::vector<Key> keys(NonLeafNode::MAX_KEY_COUNT);
+            std::vector<PageId> pids(NonLeafNode::MAX_KEY_COUNT + 1);
+            if ((ret = above.pin(parentSibling, this->pf)) != 0) {
+                return ret;
+            }
+            above.getEntries(&keys[0], &pids[0]);
+            next = pids[0];
+            count = 1;
+        } else if (ret != 0 && parentSibling != 0) {
+            count = 1;
+            if ((ret = above.pin(parentSibling, this->pf)) != 0) {
+                return ret;
+            }
+            ret = above.getNextChildPtrs(path[l]->pid, &next, count);
+        }
+        if (ret != 0 || count != 1) {
+            return RC_INVALID_FILE_FORMAT;
+        }
+        siblings[l] = next;
+        parent = path[l]->pid;
+        parentSibling = next;
+    }
+
+    for (int l = path.size() - 1; l >= 0 && l >= top; l--) {
+        InnerNode* node = path[l];
+
+        //The children of the node and of the one split off it are among
+        //its old children and the node split off below
+        from.clear();
+        for (int i = 0; !node->aboveLeaves && i <= node->keyCount; i++) {
+            from.push_back(node->children[i]);
+        }
+        from.push_back(split);
+        if ((ret = fillInner(node, &from[0], from.size())) != 0) {
+            return ret;
+        }
+        split = NULL;
+        if (l == top) {
+            break;
+        }
+
+        //The node split
+        split = new InnerNode;
+        split->pid = siblings[l];
+        split->version = 0;
+        split->aboveLeaves = node->aboveLeaves;
+        if ((ret = fillInner(split, &from[0], from.size())) != 0) {
+            delete split;
+            return ret;
+        }
+    }
+
+    //A new root holds the old one and the node split off it
+    if (top < 0) {
+        InnerNode* root = new InnerNode;
+        root->pid = this->getRootPid();
+        root->version = 0;
+        root->aboveLeaves = (this->getTreeHeight() == 2);
+        from.clear();
+        from.push_back((InnerNode*) this->inner);
+        from.push_back(split);
+        if ((ret = fillInner(root, &from[0], from.size())) != 0) {
+            delete root;
+            return ret;
+        }
+        __sync_synchronize();
+        this->inner = root;
+    }
 
     return 0;
 }
 
+/*
+ * Free a non-leaf node read by readInner() and the nodes below it.
+ * @param node[IN] the node, or NULL
+ */
+template <class Key>
+void BasicBTreeIndex<Key>::dropInner(InnerNode* node)
+{
+    if (node == NULL) return;
+    for (int i = 0; !node->aboveLeaves && i <= node->keyCount; i++) {
+        dropInner(node->children[i]);
+    }
+    delete node;
+}
+
+/*
+ * Find the parent of the leaf node where searchKey may exist, for reading
+ * ahead. It does not wait for an insert changing the path, as the caller
+ * holds a pinned leaf.
+ * @param searchKey[IN] the key to find
+ * @param pid[OUT] the PageId of the lowest non-leaf node on the path
+ * @return error code. 0 if no error, RC_NO_SUCH_RECORD if the root is a
+ *         leaf or an insert is changing the path
+ */
+template <class Key>
+RC BasicBTreeIndex<Key>::locateParent(Key searchKey, PageId& pid)
+{
+    PageId leafPid;
+    RC ret = locateLeaf(searchKey, leafPid, pid, NULL, false);
+
+    if (ret == 0 && pid < 0) {
+        ret = RC_NO_SUCH_RECORD;
+    }
+    return ret;
+}
+
+/*
+ * The children of parent next to the child pid in the direction of a scan.
+ */
+template <class Node>
+static RC getSiblingPtrs(Node& parent, PageId pid, PageId* pids, int& count, bool backward)
+{
+    if (backward) {
+        return parent.getPrevChildPtrs(pid, pids, count);
+    }
+    return parent.getNextChildPtrs(pid, pids, count);
+}
+
+/*
+ * Read the leaves following a leaf into the buffer pool in the background.
+ * The siblings are taken from the parent of the leaf. A new batch is
+ * requested once the scan has used up half of the previous one.
+ * @param pid[IN] the PageId of the leaf the scan just entered
+ * @param key[IN] a key stored in that leaf
+ * @param backward[IN] whether the scan goes to the leaves before it
+ * @param raParent[IN/OUT] the parent of the leaves being scanned
+ * @param raLast[IN/OUT] the last leaf requested for the scan
+ */
+template <class Key>
+void BasicBTreeIndex<Key>::prefetchLeaves(PageId pid, Key key, bool backward, PageId& raParent, PageId& raLast)
+{
+    NonLeafNode parent;
+    PageId pids[LEAF_READ_AHEAD];
+    int count = LEAF_READ_AHEAD;
+    int i, j;
+
+    if (this->getTreeHeight() < 2) return;
+
+    //The parent found by locate() serves until the scan walks past its
+    //last child; then look the new parent up with a key of the leaf
+    if (raParent < 0 || parent.pin(raParent, this->pf) != 0 ||
+        getSiblingPtrs(parent, pid, pids, count, backward) != 0) {
+        count = LEAF_READ_AHEAD;
+        if (locateParent(key, raParent) != 0 ||
+            parent.pin(raParent, this->pf) != 0 ||
+            getSiblingPtrs(parent, pid, pids, count, backward) != 0) {
+            raParent = -1;
+            return;
+        }
+    }
+
+    //Skip the leaves that were requested already
+    for (i = 0; i < count && pids[i] != raLast; i++);
+    if (i < count) {
+        if (i >= LEAF_READ_AHEAD / 2) return;
+        i++;
+    } else {
+        i = 0;
+    }
+
+    //Leaves with consecutive PageIds are requested together
+    int step = backward ? -1 : 1;
+    for (; i < count; i = j) {
+        for (j = i + 1; j < count && pids[j] == pids[j - 1] + step; j++);
+        this->pf.prefetch(backward ? pids[j - 1] : pids[i], j - i);
+    }
+    if (count > 0) raLast = pids[count - 1];
+}
+
 //Debugging function
 ////////////////////////////////
-void BTreeIndex::debugPrintout() {
+static void printKey(int key) {
+    printf("%d", key);
+}
+
+static void printKey(const StringKey& key) {
+    printf("'%.*s'", key.length, key.bytes);
+}
+
+template <class Key>
+void BasicBTreeIndex<Key>::debugPrintout() {
 
     int currentLevel = 1;
     PageId pid = this->getRootPid();
     RecordId rid;
-    int key;
-    BTNonLeafNode nonLeafNode;
-    BTLeafNode leafNode;
+    Key key;
+    NonLeafNode nonLeafNode;
+    LeafNode leafNode;
 
 
     while(currentLevel < this->getTreeHeight()) {
@@ -373,10 +1628,14 @@ void BTreeIndex::debugPrintout() {
     IndexCursor cursor;
     cursor.pid = pid;
     cursor.eid = 0;
+    cursor.raParent = -1;
+    cursor.raLast = -1;
 
     while (this->readForward(cursor, key, rid) == 0) {
         printf("------------\n");
-        printf("Current key:      %d\n", key);
+        printf("Current key:      ");
+        printKey(key);
+        printf("\n");
         printf("Next cursor page: %d\n", cursor.pid);
         printf("Next cursor eid:  %d\n", cursor.eid);
     }
@@ -387,10 +1646,16 @@ void BTreeIndex::debugPrintout() {
 
 //GETTERS
 ////////////////////////////////
-int BTreeIndex::getRootPid() {
+template <class Key>
+int BasicBTreeIndex<Key>::getRootPid() {
     return this->rootPid;
 }
 
-int BTreeIndex::getTreeHeight() {
+template <class Key>
+int BasicBTreeIndex<Key>::getTreeHeight() {
     return this->treeHeight;
 }
+
+// the key types the index is built for
+template class BasicBTreeIndex<int>;
+template class BasicBTreeIndex<StringKey>;
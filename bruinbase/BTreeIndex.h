@@ -13,38 +13,94 @@
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
 
 #include <cstdio>
+#include <vector>
+#include <pthread.h>
              
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
  * An IndexCursor consists of pid (PageId of the leaf node) and 
  * eid (the location of the index entry inside the node).
  * IndexCursor is used for index lookup and traversal.
+ * It also carries the read-ahead of the range scan made with it, set by
+ * locate() and locateLast(), so that cursors used by several threads at
+ * once do not share it.
  */
 typedef struct {
   // PageId of the index entry
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // the parent of the leaves being scanned and the last leaf requested
+  // from the buffer pool; -1 if not known
+  PageId  raParent;
+  PageId  raLast;
 } IndexCursor;
 
 /**
- * Implements a B-Tree index for bruinbase.
- * 
+ * A stream of (key, RecordId) pairs, such as the entries given to
+ * BTreeIndex::bulkLoad(), with keys of type Key.
  */
-class BTreeIndex {
+template <class Key>
+class BasicEntrySource {
  public:
-  BTreeIndex();
+  virtual ~BasicEntrySource() {}
+
+  /**
+   * return the next (key, RecordId) pair of the stream.
+   * @param key[OUT] the key
+   * @param rid[OUT] the RecordId
+   * @return error code. RC_END_OF_FILE after the last pair
+   */
+  virtual RC next(Key& key, RecordId& rid) = 0;
+};
+
+typedef BasicEntrySource<int> EntrySource;
+typedef BasicEntrySource<StringKey> EntrySourceStr;
+
+/**
+ * Implements a B-Tree index for bruinbase, with keys of type Key: int
+ * for BTreeIndex and StringKey for BTreeIndexStr. The key type is stored
+ * in the index file, which only opens with the same one.
+ *
+ * Lookups, scans and inserts may be called by several threads at once.
+ * The non-leaf nodes are kept in memory, each with a version that is odd
+ * while a writer changes it. A lookup goes down them with optimistic lock
+ * coupling: it notes the version of a node, reads the node, and checks
+ * that the version is unchanged once it has the version of the child, or
+ * has pinned the leaf; otherwise it starts over from the root. Lookups
+ * take no locks, so they do not slow each other down. Inserts are made
+ * one at a time, under a mutex, and lock only the nodes a split changes.
+ *
+ * open(), close() and bulkLoad() may not overlap with any other call.
+ * A Scanner sees every entry exactly once while other threads insert;
+ * an IndexCursor used with readForward() or readBackward() may not, as
+ * its entry number goes stale when the leaf changes.
+ */
+template <class Key>
+class BasicBTreeIndex {
+ public:
+  typedef BasicBTLeafNode<Key> LeafNode;
+  typedef BasicBTNonLeafNode<Key> NonLeafNode;
+
+  // the default % of a node filled by bulkLoad(). the room left lets a
+  // few later inserts into a node go without splitting it.
+  static const int DEFAULT_FILL = 90;
+
+  BasicBTreeIndex();
+  ~BasicBTreeIndex();
 
   /**
    * Open the index file in read or write mode.
    * Under 'w' mode, the index file should be created if it does not exist.
    * @param indexname[IN] the name of the index file
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param options[IN] PageFile::OPEN_* flags for the underlying PageFile
    * @return error code. 0 if no error
    */
-  RC open(const std::string& indexname, char mode);
+  RC open(const std::string& indexname, char mode, int options = 0);
 
   /**
    * Close the index file.
@@ -54,11 +110,38 @@ class BTreeIndex {
     
   /**
    * Insert (key, RecordId) pair to the index.
+   * An index bulk loaded with duplicate keys takes a key it holds again,
+   * behind the entries with the key; any other index fails on it.
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
-   * @return error code. 0 if no error
+   * @return error code. 0 if no error, RC_DUPLICATE_KEY if the index
+   *         holds the key and does not keep duplicate keys
    */
-  RC insert(int key, const RecordId& rid);
+  RC insert(Key key, const RecordId& rid);
+
+  /**
+   * Build the index bottom-up from (key, RecordId) pairs sorted by key.
+   * The leaves are filled to the given % in key order and written to
+   * consecutive pages, and then every level of non-leaf nodes is built
+   * from the one below it. Of pairs with the same key, only the first is
+   * kept, as insert() would, unless duplicates is set. An index that is
+   * not empty gets the pairs inserted one at a time instead, skipping
+   * the keys it holds unless it keeps duplicate keys.
+   * The index must be open in 'w' mode.
+   *
+   * An empty index loaded with duplicates set keeps duplicate keys from
+   * then on, which is stored in the index file; later loads and inserts
+   * add to the runs of equal keys. locate() finds one of the entries with
+   * a key; a Scanner started with locate(key) sees them all, as it starts
+   * from the leaf where the run of equal keys begins.
+   * @param source[IN] the pairs, in non-decreasing key order
+   * @param fill[IN] the % of every node to fill, 1 to 100
+   * @param duplicates[IN] whether to keep every pair with the same key
+   * @return error code. 0 if no error, RC_NOT_SORTED if a key is
+   *         smaller than the one before it, RC_INVALID_FILE_MODE if
+   *         duplicates is set and the index holds unique keys
+   */
+  RC bulkLoad(BasicEntrySource<Key>& source, int fill = DEFAULT_FILL, bool duplicates = false);
 
   /**
    * Run the standard B+Tree key search algorithm and identify the
@@ -78,7 +161,23 @@ class BTreeIndex {
    *                    smaller than searchKey.
    * @return 0 if searchKey is found. Othewise, an error code
    */
-  RC locate(int searchKey, IndexCursor& cursor);
+  RC locate(Key searchKey, IndexCursor& cursor);
+
+  /**
+   * Look up a batch of keys at once. The keys are sorted and the tree is
+   * descended once for all of them, so that every node on the way to the
+   * keys is visited once, however many keys lead through it. The leaves
+   * found are read ahead together and then each is pinned once for all
+   * of its keys.
+   * @param keys[IN] the keys to find, in any order
+   * @param n[IN] the number of keys
+   * @param cursors[OUT] for every key, the cursor locate() would set it
+   *                     to; may be NULL
+   * @param rids[OUT] for every key, the RecordId stored with it, or a pid
+   *                  of -1 if the index does not have it; may be NULL
+   * @return the number of keys found, or an error code
+   */
+  int locateBatch(const Key* keys, int n, IndexCursor* cursors, RecordId* rids);
 
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
@@ -88,9 +187,132 @@ class BTreeIndex {
    * @param rid[OUT] the RecordId stored at the index cursor location
    * @return error code. 0 if no error
    */
-  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+  RC readForward(IndexCursor& cursor, Key& key, RecordId& rid);
+
+  /**
+   * Find the leaf node where searchKey may exist, as locate() does, but
+   * set IndexCursor to the index entry with searchKey or, if there is
+   * none, the largest index key that is smaller than searchKey.
+   * IndexCursor.eid is -1 if that entry is in the leaf before, which
+   * readBackward() moves to.
+   * @param searchKey[IN] the key to find
+   * @param cursor[OUT] the cursor pointing to the index entry with the
+   *                    largest key not larger than searchKey
+   * @return 0 if searchKey is found. Othewise, an error code
+   */
+  RC locateLast(Key searchKey, IndexCursor& cursor);
+
+  /**
+   * Read the (key, rid) pair at the location specified by the index cursor,
+   * and move back the cursor to the previous entry.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored at the index cursor location
+   * @param rid[OUT] the RecordId stored at the index cursor location
+   * @return error code. 0 if no error, RC_END_OF_TREE before the first entry
+   */
+  RC readBackward(IndexCursor& cursor, Key& key, RecordId& rid);
+
+  /**
+   * Reads the entries of the index in key order, a leaf at a time. The
+   * leaf being read stays pinned, so that a range scan reads each leaf
+   * once, when it moves on to it, instead of once per entry as with
+   * readForward().
+   *
+   * The scanner stands between two entries: next() returns the ones
+   * after it in ascending order and prev() the ones before it in
+   * descending order, following the links between the leaves either way.
+   * Once it has passed either end of the index the scan is over.
+   */
+  class Scanner {
+   public:
+    /**
+     * @param index[IN] the open index to scan
+     */
+    Scanner(BasicBTreeIndex& index);
+
+    /**
+     * start the scan at the first entry with a key not smaller than
+     * searchKey. In an index that keeps duplicate keys, that is the
+     * first entry of a run of equal keys even where the run begins in a
+     * leaf before the one the key leads to.
+     * @param searchKey[IN] the key to start from
+     * @return error code. 0 if no error
+     */
+    RC locate(Key searchKey);
+
+    /**
+     * start the scan at the first entry of the index.
+     * @return error code. 0 if no error
+     */
+    RC first();
+
+    /**
+     * start the scan right behind the last entry with a key not larger
+     * than searchKey, so that prev() returns that entry first.
+     * @param searchKey[IN] the key to start from
+     * @return error code. 0 if no error
+     */
+    RC locateLast(Key searchKey);
+
+    /**
+     * start the scan behind the last entry of the index.
+     * @return error code. 0 if no error
+     */
+    RC last();
+
+    /**
+     * return up to max of the next entries, all from the same leaf.
+     * @param keys[OUT] the keys of the entries
+     * @param rids[OUT] the RecordIds of the entries
+     * @param max[IN] the most entries to return
+     * @return the number of entries returned, 0 at the end of the
+     *         index, or an error code
+     */
+    int next(Key* keys, RecordId* rids, int max);
+
+    /**
+     * return the next entry.
+     * @param key[OUT] the key of the entry
+     * @param rid[OUT] the RecordId of the entry
+     * @return error code. RC_END_OF_TREE after the last entry
+     */
+    RC next(Key& key, RecordId& rid);
+
+    /**
+     * return up to max of the previous entries, all from the same leaf,
+     * the largest key first.
+     * @param keys[OUT] the keys of the entries
+     * @param rids[OUT] the RecordIds of the entries
+     * @param max[IN] the most entries to return
+     * @return the number of entries returned, 0 at the start of the
+     *         index, or an error code
+     */
+    int prev(Key* keys, RecordId* rids, int max);
 
-  RC insertHelper(int key, const RecordId& rid, int treeLevel, PageId pid, PageId& ret, int& siblingKey);
+    /**
+     * return the previous entry.
+     * @param key[OUT] the key of the entry
+     * @param rid[OUT] the RecordId of the entry
+     * @return error code. RC_END_OF_TREE before the first entry
+     */
+    RC prev(Key& key, RecordId& rid);
+
+   private:
+    BasicBTreeIndex* index;
+    LeafNode    leaf;    // the leaf being read, pinned
+    IndexCursor cursor;  // the next entry, and the read-ahead of the scan.
+                         // pid 0 past either end
+    int         count;   // # of entries in the leaf, -1 if none is pinned
+    bool        moved;   // whether the leaf was reached from a sibling
+
+    RC pin();
+
+    // the scanner holds a pinned page; copying is not allowed
+    Scanner(const Scanner&);
+    Scanner& operator=(const Scanner&);
+  };
+
+  RC insertHelper(Key key, const RecordId& rid, int treeLevel, PageId pid, PageId& ret, Key& siblingKey);
 
   RC getFirstElement(IndexCursor& cursor);
 
@@ -112,7 +334,65 @@ class BTreeIndex {
   ////////////////////////////////////////////////////
   //Custom Variables
   char mode; // holds read or write variable
+  bool duplicates; // whether the index keeps duplicate keys, also stored on disk
+
+  RC readMeta();
+  RC writeMeta();
+
+  RC locateLeaf(Key searchKey, PageId& pid, PageId& parent, LeafNode* leaf, bool wait,
+                bool first = false);
+  RC locateParent(Key searchKey, PageId& pid);
+  void prefetchLeaves(PageId pid, Key key, bool backward, PageId& raParent, PageId& raLast);
+
+  //The non-leaf nodes, read into memory by the first lookup so that a
+  //lookup reads only its leaf. An insert that splits a node changes them
+  //in place, so a node is freed only by close() or bulkLoad(), and a
+  //lookup never reads a node that is gone. Their arrays have a fixed
+  //size for the same reason.
+  struct InnerNode {
+    PageId pid;                        //the page of the node
+    volatile unsigned version;         //odd while a writer changes the node
+    bool aboveLeaves;                  //whether the children are leaves
+    bool full;                         //whether an insert splits the node
+    int keyCount;
+    Key keys[NonLeafNode::MAX_KEY_COUNT];
+    PageId pids[NonLeafNode::MAX_KEY_COUNT + 1];          //the pages of the children
+    InnerNode* children[NonLeafNode::MAX_KEY_COUNT + 1];  //NULL above leaves
+  };
+  InnerNode* volatile inner;
+
+  //The version of inner, rootPid and treeHeight, odd while a root split
+  //changes them
+  volatile unsigned version;
+
+  //Held by an insert, and by the first lookup while it reads the
+  //non-leaf nodes into memory
+  pthread_mutex_t writeMutex;
+
+  RC loadInner();
+  RC readInner(PageId pid, int level, InnerNode*& node);
+  RC fillInner(InnerNode* node, InnerNode** from, int count);
+  RC updateInner(std::vector<InnerNode*>& path, int top);
+  void dropInner(InnerNode* node);
+
+  //The keys of a batch lookup that go to one leaf: those up to end in
+  //key order. The leaf was found with the given version of the node
+  //above it, or of the root if the leaf is the root.
+  struct LeafKeys {
+    PageId pid;
+    int end;
+    const volatile unsigned* guard;
+    unsigned version;
+  };
+
+  //Splits the sorted keys order[first, last) of a batch lookup among the
+  //leaves below node. Returns false if a node changed meanwhile
+  bool groupByLeaf(InnerNode* node, const Key* keys, const int* order, int first, int last,
+                   std::vector<LeafKeys>& leaves);
 
 };
 
+typedef BasicBTreeIndex<int> BTreeIndex;
+typedef BasicBTreeIndex<StringKey> BTreeIndexStr;
+
 #endif /* BTREEINDEX_H */
@@ -1,17 +1,124 @@
 #include "BTreeNode.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+// binary search stops once this many keys are left (two cache lines),
+// which are then compared all at once
+static const int LINEAR_KEYS = 32;
+
+// count the keys in keys[0..n) that come before key: the keys smaller
+// than key, or also the ones equal to it if upper is set. keys are
+// compared 8 or 4 at a time with AVX2 or SSE2 where the compiler has
+// them, and one at a time without branches otherwise.
+static int countBefore(const int* keys, int n, int key, bool upper)
+{
+    int count = 0;
+    int i = 0;
+
+#if defined(__AVX2__)
+    __m256i k8 = _mm256_set1_epi32(key);
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (keys + i));
+        __m256i m = upper ? _mm256_cmpgt_epi32(v, k8) : _mm256_cmpgt_epi32(k8, v);
+        int bits = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+        count += upper ? 8 - bits : bits;
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    __m128i k4 = _mm_set1_epi32(key);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (keys + i));
+        __m128i m = upper ? _mm_cmpgt_epi32(v, k4) : _mm_cmpgt_epi32(k4, v);
+        int bits = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(m)));
+        count += upper ? 4 - bits : bits;
+    }
+#endif
+    for (; i < n; i++) {
+        count += (keys[i] < key) | (upper & (keys[i] == key));
+    }
+    return count;
+}
+
+/*
+ * Find the first of the sorted keys[0..n) that is not smaller than key,
+ * or, if upper is set, larger than key.
+ * @return the position of the key found, n if there is none
+ */
+int searchKeys(const int* keys, int n, int key, bool upper)
+{
+    int lo = 0;
+    int hi = n;
+
+    while (hi - lo > LINEAR_KEYS) {
+        int mid = (lo + hi) / 2;
+        if (keys[mid] < key || (upper && keys[mid] == key)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo + countBefore(keys + lo, hi - lo, key, upper);
+}
+
+/*
+ * Find the first of the sorted StringKeys keys[0..n) that is not smaller
+ * than key, or, if upper is set, larger than key. Comparing two of them
+ * costs more than the cache misses a linear search saves, so the search
+ * is binary all the way.
+ * @return the position of the key found, n if there is none
+ */
+int searchKeys(const StringKey* keys, int n, const StringKey& key, bool upper)
+{
+    int lo = 0;
+    int hi = n;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int diff = keys[mid].compare(key);
+        if (diff < 0 || (upper && diff == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * The shortest prefix of right that is larger than left, or right itself
+ * if it is the same key as left.
+ * @param left[IN] the last key of the left child
+ * @param right[IN] the first key of the right child, not smaller than left
+ * @return the key between them
+ */
+StringKey separatorKey(const StringKey& left, const StringKey& right)
+{
+    int n = 0;
+
+    //The keys agree up to n. The byte of right at n is larger than that
+    //of left, or left ends there
+    while (n < left.length && n < right.length && left.bytes[n] == right.bytes[n]) {
+        n++;
+    }
+    return StringKey(right.bytes, (n < right.length) ? n + 1 : right.length);
+}
 
-void BTLeafNode::printNode() {
+template <class Key>
+void BasicBTLeafNode<Key>::printNode() {
     int keyCount = getKeyCount();
     int i;
     printf("Printing BTLeafNode with %i elements\n", keyCount);
     for (i = 0; i < keyCount; i++) {
-        int key;
+        Key key;
         RecordId record;
         readEntry(i, key, record);
-        printf("key: %i   pid: %i   sid: %i\n", key, record.pid, record.sid);
+        printf("key: %lld   pid: %i   sid: %i\n", (long long) key, record.pid, record.sid);
     }
     printf("Done printing\n");
     return;
@@ -23,10 +130,52 @@ void BTLeafNode::printNode() {
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::read(PageId pid, const PageFile& pf)
+template <class Key>
+RC BasicBTLeafNode<Key>::read(PageId pid, const PageFile& pf)
 { 
+    this->handle.release();
+    this->node = this->buffer;
     return pf.read(pid, this->buffer);
 }
+
+/*
+ * Pin the page pid of the PageFile pf and use the cached frame as the
+ * content of the node instead of copying it into the node's buffer.
+ * @param pid[IN] the PageId to pin
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Key>
+RC BasicBTLeafNode<Key>::pin(PageId pid, const PageFile& pf)
+{
+    RC rc = pf.pin(pid, this->handle);
+    this->node = (rc == 0) ? this->handle.data() : this->buffer;
+    return rc;
+}
+
+/*
+ * Unpin the frame pinned by pin(), if any. The node goes back to its own
+ * buffer.
+ */
+template <class Key>
+void BasicBTLeafNode<Key>::release()
+{
+    this->handle.release();
+    this->node = this->buffer;
+}
+
+/*
+ * If the node wraps a pinned frame, copy the frame into the node's own
+ * buffer and unpin it so that the node can be modified.
+ */
+template <class Key>
+void BasicBTLeafNode<Key>::detach()
+{
+    if (this->node == this->buffer) return;
+    memcpy(this->buffer, this->node, PageFile::PAGE_SIZE);
+    this->node = this->buffer;
+    this->handle.release();
+}
     
 /*
  * Write the content of the node to the page pid in the PageFile pf.
@@ -34,73 +183,73 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::write(PageId pid, PageFile& pf)
+template <class Key>
+RC BasicBTLeafNode<Key>::write(PageId pid, PageFile& pf)
 { 
-    return pf.write(pid, this->buffer); 
+    // a pinned frame stays latched until it is released
+    detach();
+    return pf.write(pid, this->node); 
 }
 
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
-int BTLeafNode::getKeyCount()
+template <class Key>
+int BasicBTLeafNode<Key>::getKeyCount()
 { 
     int temp;
-    memcpy(&temp, buffer + (PageFile::PAGE_SIZE - sizeof(temp)), sizeof(temp));
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - sizeof(temp)), sizeof(temp));
     return temp;
 }
 
 /**
 * Set the key count to n
 */
-void BTLeafNode::setKeyCount(int n) {
-   memcpy(buffer + (PageFile::PAGE_SIZE - sizeof(n)), (char *) &n, sizeof(n));
+template <class Key>
+void BasicBTLeafNode<Key>::setKeyCount(int n) {
+   detach();
+   memcpy(node + (PageFile::PAGE_SIZE - sizeof(n)), (char *) &n, sizeof(n));
 }
 
 /*
  * Insert a (key, rid) pair to the node.
  * @param key[IN] the key to insert
  * @param rid[IN] the RecordId to insert
- * @return 0 if successful. Return an error code if the node is full.
+ * @param duplicates[IN] whether a key in the node may be inserted again
+ * @return 0 if successful. RC_NODE_FULL if the node is full, and
+ *         RC_DUPLICATE_KEY if the key is in the node and duplicates is not set.
  */
-RC BTLeafNode::insert(int key, const RecordId& rid)
+template <class Key>
+RC BasicBTLeafNode<Key>::insert(Key key, const RecordId& rid, bool duplicates)
 { 
-    //TODO
+    detach();
     int keyCount = this->getKeyCount();
-    PageId pid = this->getNextNodePtr();
-    if (keyCount == MAXIMUM_KEY_COUNT) {
+    if (keyCount == MAX_KEY_COUNT) {
         // TODO: error -> node is full
         return RC_NODE_FULL;
     }
 
     int eid;
-    RC returncode = BTLeafNode::locate(key, eid);
+    RC returncode = this->locate(key, eid);
 
     if (returncode == 0) {
-    	// TODO: error -> key already exists in node
-        return -2;
+        if (!duplicates) {
+            return RC_DUPLICATE_KEY;
+        }
+        // a repeated key goes behind the entries with the key, so they
+        // stay in the order they were inserted
+        eid = searchKeys(keys(), keyCount, key, true);
     }
 
-    char tempbuffer[PageFile::PAGE_SIZE];
-    // must subtract 12 to prevent buffer overflow
-    int sizeToCopy = PageFile::PAGE_SIZE - (eid * 12) - 12;
-    
-    // store everything between eid and end of buffer to temp array
-    memcpy(tempbuffer, buffer + (eid * 12), sizeToCopy);
-
-    // store new record's key into eid of original buffer
-    memcpy(buffer + (eid * 12), (char *) &key, sizeof(key));
-
-    // store new record's pointers info into eid + 4 of original buffer
-    memcpy(buffer + (eid * 12) + 4, (char *) &rid.pid, sizeof(rid.pid));
-    memcpy(buffer + (eid * 12) + 8, (char *) &rid.sid, sizeof(rid.sid));
-
-    // move temp buffer back to original buffer but in eid + 1
-    memcpy(buffer + ((eid + 1) * 12), tempbuffer, sizeToCopy);
+    // shift the keys and the RecordIds from eid on to make room
+    memmove(keys() + eid + 1, keys() + eid, (keyCount - eid) * sizeof(Key));
+    memmove(rids() + eid + 1, rids() + eid, (keyCount - eid) * sizeof(RecordId));
+    keys()[eid] = key;
+    rids()[eid] = rid;
 
     // adjust key count
     this->setKeyCount(keyCount + 1);
-    this->setNextNodePtr(pid);
     return 0; 
 }
 
@@ -112,11 +261,16 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
  * @param rid[IN] the RecordId to insert.
  * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
  * @param siblingKey[OUT] the first key in the sibling node after split.
- * @return 0 if successful. Return an error code if there is an error.
+ * @param duplicates[IN] whether a key in the node may be inserted again
+ * @return 0 if successful. RC_DUPLICATE_KEY if the key is in the node and
+ *         duplicates is not set.
  */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid, 
-                              BTLeafNode& sibling, int& siblingKey)
+template <class Key>
+RC BasicBTLeafNode<Key>::insertAndSplit(Key key, const RecordId& rid, 
+                              BasicBTLeafNode& sibling, Key& siblingKey, bool duplicates)
 { 
+    detach();
+    sibling.detach();
     int keyCount = getKeyCount();
     int eid;
     PageId pid = this->getNextNodePtr();
@@ -124,36 +278,40 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
     RC returncode = this->locate(key, eid);
 
     if (returncode == 0) {
-    	return -1;
+        if (!duplicates) {
+            return RC_DUPLICATE_KEY;
+        }
+        eid = searchKeys(keys(), keyCount, key, true);
     }
 
-    char tempbuffer[PageFile::PAGE_SIZE];
-    // must subtract 12 to prevent buffer overflow
-    int sizeToCopy = PageFile::PAGE_SIZE - (eid * 12) - 12;
-    
-    memcpy(tempbuffer, buffer + (eid * 12), sizeToCopy);
-
-    memcpy(buffer + (eid * 12), (char *) &key, sizeof(key));
-    memcpy(buffer + (eid * 12) + 4, (char *) &rid.pid, sizeof(rid.pid));
-    memcpy(buffer + (eid * 12) + 8, (char *) &rid.sid, sizeof(rid.sid));
-    
-    memcpy(buffer + ((eid + 1) * 12), tempbuffer, sizeToCopy);
+    // the node is full, so the entries are put in order in a temporary
+    // array first
+    Key tempKeys[MAX_KEY_COUNT + 1];
+    RecordId tempRids[MAX_KEY_COUNT + 1];
 
-    // adjust key count
-    setKeyCount(keyCount++);
+    memcpy(tempKeys, keys(), eid * sizeof(Key));
+    memcpy(tempRids, rids(), eid * sizeof(RecordId));
+    tempKeys[eid] = key;
+    tempRids[eid] = rid;
+    memcpy(tempKeys + eid + 1, keys() + eid, (keyCount - eid) * sizeof(Key));
+    memcpy(tempRids + eid + 1, rids() + eid, (keyCount - eid) * sizeof(RecordId));
+    keyCount++;
 
+    // the first half, rounded up, stays
     int newKeyCount = keyCount / 2;
     if (keyCount % 2 != 0) {
         newKeyCount++;
     }
     int siblingKeyCount = keyCount - newKeyCount;
 
-    // move to sibling buffer -- will have direct access since same class
-    memcpy(sibling.buffer, this->buffer + 12 * newKeyCount, 12 * siblingKeyCount);
+    memcpy(keys(), tempKeys, newKeyCount * sizeof(Key));
+    memcpy(rids(), tempRids, newKeyCount * sizeof(RecordId));
+    memcpy(sibling.keys(), tempKeys + newKeyCount, siblingKeyCount * sizeof(Key));
+    memcpy(sibling.rids(), tempRids + newKeyCount, siblingKeyCount * sizeof(RecordId));
     sibling.setKeyCount(siblingKeyCount);
 
     setKeyCount(newKeyCount);
-    memcpy(&siblingKey, sibling.buffer, sizeof(key));
+    siblingKey = tempKeys[newKeyCount];
     //MUST REMEMBER TO SET THE CURRENT NODES NEXT POINTER TO POINT TO SIBLING POINTERS CORRECTLY IN FUNCTIONS 
     sibling.setNextNodePtr(pid);
     this->setNextNodePtr(pid);
@@ -161,6 +319,28 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
     return 0; 
 }
 
+/*
+ * Append the (key, rid) pair after the last entry of the node.
+ * @param key[IN] the key to append
+ * @param rid[IN] the RecordId to append
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+template <class Key>
+RC BasicBTLeafNode<Key>::append(Key key, const RecordId& rid)
+{
+    detach();
+    int keyCount = this->getKeyCount();
+    if (keyCount == MAX_KEY_COUNT) {
+        return RC_NODE_FULL;
+    }
+
+    keys()[keyCount] = key;
+    rids()[keyCount] = rid;
+
+    this->setKeyCount(keyCount + 1);
+    return 0;
+}
+
 /**
  * If searchKey exists in the node, set eid to the index entry
  * with searchKey and return 0. If not, set eid to the index entry
@@ -172,34 +352,36 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
                    behind the largest key smaller than searchKey.
  * @return 0 if searchKey is found. Otherwise return an error code.
  */
-RC BTLeafNode::locate(int searchKey, int& eid)
+template <class Key>
+RC BasicBTLeafNode<Key>::locate(Key searchKey, int& eid)
 { 
     int keyCount = this->getKeyCount();
-    int curKey;
-    int slot = -1;
 
-    RC ret = RC_NO_SUCH_RECORD;
-    RecordId record;
-    for (int i = 0; i < keyCount; i++) {
-        // key is 4 bytes, pointer is 8 bytes
-        // when eid is i, access i * 12 in buffer array
-        this->readEntry(i, curKey, record);
-        
-        //memcpy(&curKey, buffer + (i * 12), sizeof(curKey));
-        if (curKey == searchKey) {
-            slot = i;
-            ret = 0;
-            break;
-        } else if (curKey > searchKey) {
-        	slot = i;
-        	break;
-        }
+    eid = searchKeys(keys(), keyCount, searchKey, false);
+    if (eid < keyCount && keys()[eid] == searchKey) {
+        return 0;
     }
+    return RC_NO_SUCH_RECORD;
+}
 
-    if (slot == -1) eid = keyCount;
-    else eid = slot;
-
-    return ret;
+/*
+ * If searchKey exists in the node, set eid to the index entry
+ * with searchKey and return 0. If not, set eid to the index entry
+ * with the largest key that is smaller than searchKey, -1 if there is
+ * none, and return the error code RC_NO_SUCH_RECORD.
+ * @param searchKey[IN] the key to search for.
+ * @param eid[OUT] the index entry number with the largest key not
+                   larger than searchKey.
+ * @return 0 if searchKey is found. Otherwise return an error code.
+ */
+template <class Key>
+RC BasicBTLeafNode<Key>::locateLast(Key searchKey, int& eid)
+{
+    eid = searchKeys(keys(), this->getKeyCount(), searchKey, true) - 1;
+    if (eid >= 0 && keys()[eid] == searchKey) {
+        return 0;
+    }
+    return RC_NO_SUCH_RECORD;
 }
 
 /*
@@ -209,26 +391,70 @@ RC BTLeafNode::locate(int searchKey, int& eid)
  * @param rid[OUT] the RecordId from the entry
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
+template <class Key>
+RC BasicBTLeafNode<Key>::readEntry(int eid, Key& key, RecordId& rid)
 { 
     int keyCount = this->getKeyCount();
     if (eid >= keyCount) return -1;
 
-    memcpy(&key, buffer + (eid * 12), sizeof(key));
-    memcpy(&rid.pid, buffer + (eid * 12) + 4, sizeof(rid.pid));
-    memcpy(&rid.sid, buffer + (eid * 12) + 8, sizeof(rid.sid));
+    key = keys()[eid];
+    rid = rids()[eid];
 
     return 0; 
 }
 
+/*
+ * Read up to max (key, rid) pairs from the eid entry on.
+ * @param eid[IN] the entry number to start from
+ * @param keys[OUT] the keys
+ * @param rids[OUT] the RecordIds
+ * @param max[IN] the most pairs to read
+ * @return the number of pairs read
+ */
+template <class Key>
+int BasicBTLeafNode<Key>::readEntries(int eid, Key* keys, RecordId* rids, int max)
+{
+    int n = this->getKeyCount() - eid;
+    if (n > max) n = max;
+    if (n <= 0) return 0;
+
+    memcpy(keys, this->keys() + eid, n * sizeof(Key));
+    memcpy(rids, this->rids() + eid, n * sizeof(RecordId));
+    return n;
+}
+
+/*
+ * Read up to max (key, rid) pairs before the eid entry, from the one
+ * right before it back.
+ * @param eid[IN] the entry number to stop before
+ * @param keys[OUT] the keys, in descending order
+ * @param rids[OUT] the RecordIds
+ * @param max[IN] the most pairs to read
+ * @return the number of pairs read
+ */
+template <class Key>
+int BasicBTLeafNode<Key>::readEntriesBackward(int eid, Key* keys, RecordId* rids, int max)
+{
+    int keyCount = this->getKeyCount();
+    if (eid > keyCount) eid = keyCount;
+
+    int n = (eid < max) ? eid : max;
+    for (int i = 0; i < n; i++) {
+        keys[i] = this->keys()[eid - 1 - i];
+        rids[i] = this->rids()[eid - 1 - i];
+    }
+    return (n > 0) ? n : 0;
+}
+
 /*
  * Return the pid of the next slibling node.
  * @return the PageId of the next sibling node 
  */
-PageId BTLeafNode::getNextNodePtr()
+template <class Key>
+PageId BasicBTLeafNode<Key>::getNextNodePtr()
 { 
     PageId temp;
-    memcpy(&temp, buffer + (PageFile::PAGE_SIZE - ( 2 * sizeof(int) ) ), sizeof(temp));
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - ( 2 * sizeof(int) ) ), sizeof(temp));
     return temp; 
 }
 
@@ -237,28 +463,51 @@ PageId BTLeafNode::getNextNodePtr()
  * @param pid[IN] the PageId of the next sibling node 
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTLeafNode::setNextNodePtr(PageId pid)
+template <class Key>
+RC BasicBTLeafNode<Key>::setNextNodePtr(PageId pid)
 { 
-    memcpy(buffer + (PageFile::PAGE_SIZE - (2 * sizeof(pid))), (char *) &pid, sizeof(pid));
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - (2 * sizeof(pid))), (char *) &pid, sizeof(pid));
     return 0; 
 }
 
+/*
+ * Return the pid of the previous sibling node.
+ * @return the PageId of the previous sibling node, 0 if there is none
+ */
+template <class Key>
+PageId BasicBTLeafNode<Key>::getPrevNodePtr()
+{
+    PageId temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - (3 * sizeof(int))), sizeof(temp));
+    return temp;
+}
 
-void BTNonLeafNode::printNode() {
+/*
+ * Set the pid of the previous sibling node.
+ * @param pid[IN] the PageId of the previous sibling node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Key>
+RC BasicBTLeafNode<Key>::setPrevNodePtr(PageId pid)
+{
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - (3 * sizeof(pid))), (char *) &pid, sizeof(pid));
+    return 0;
+}
+
+
+template <class Key>
+void BasicBTNonLeafNode<Key>::printNode() {
     int keyCount = getKeyCount();
     int i = 0;
-    PageId pid;
-    int key;
     printf("Printing BTNonLeafNode with %i elements\n", keyCount);
     
     // print first pid in node:
-    memcpy(&pid, buffer, sizeof(pid));
-    printf("pid_%i: %i\n", i, pid);
+    printf("pid_%i: %i\n", i, pids()[0]);
 
-    for (i = 0; i < keyCount;) {
-        memcpy(&key, buffer + (i * 8) + sizeof(key), sizeof(key));
-        memcpy(&pid, buffer + (++i * 8), sizeof(pid));
-        printf("key_%i: %i     pid_%i: %i\n", i-1, key, i, pid);
+    for (i = 0; i < keyCount; i++) {
+        printf("key_%i: %lld     pid_%i: %i\n", i, (long long) keys()[i], i + 1, pids()[i + 1]);
     }
     printf("Done printing\n");
     return;   
@@ -270,12 +519,44 @@ void BTNonLeafNode::printNode() {
  * @param pf[IN] PageFile to read from
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
+template <class Key>
+RC BasicBTNonLeafNode<Key>::read(PageId pid, const PageFile& pf)
 { 
+    this->handle.release();
+    this->node = this->buffer;
     pf.read(pid, this->buffer);
     return 0; 
 }
 
+/*
+ * Pin the page pid of the PageFile pf and use the cached frame as the
+ * content of the node instead of copying it into the node's buffer.
+ * @param pid[IN] the PageId to pin
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+template <class Key>
+RC BasicBTNonLeafNode<Key>::pin(PageId pid, const PageFile& pf)
+{
+    // inner nodes are on the path of every lookup; keep them cached
+    RC rc = pf.pin(pid, this->handle, PageFile::PIN_SHARED | PageFile::PIN_PRIORITY);
+    this->node = (rc == 0) ? this->handle.data() : this->buffer;
+    return rc;
+}
+
+/*
+ * If the node wraps a pinned frame, copy the frame into the node's own
+ * buffer and unpin it so that the node can be modified.
+ */
+template <class Key>
+void BasicBTNonLeafNode<Key>::detach()
+{
+    if (this->node == this->buffer) return;
+    memcpy(this->buffer, this->node, PageFile::PAGE_SIZE);
+    this->node = this->buffer;
+    this->handle.release();
+}
+
     
 /*
  * Write the content of the node to the page pid in the PageFile pf.
@@ -283,68 +564,80 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  * @param pf[IN] PageFile to write to
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::write(PageId pid, PageFile& pf)
+template <class Key>
+RC BasicBTNonLeafNode<Key>::write(PageId pid, PageFile& pf)
 { 
-    pf.write(pid, this->buffer);
-    return 0; 
+    // a pinned frame stays latched until it is released
+    detach();
+    return pf.write(pid, this->node); 
 }
 
 /*
  * Return the number of keys stored in the node.
  * @return the number of keys in the node
  */
-int BTNonLeafNode::getKeyCount()
+template <class Key>
+int BasicBTNonLeafNode<Key>::getKeyCount()
 { 
     // return this->keyCount; 
     int temp;
-    memcpy(&temp, buffer + (PageFile::PAGE_SIZE - sizeof(temp)), sizeof(temp));
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - sizeof(temp)), sizeof(temp));
     return temp;
 }
 
 /**
 * Set the key count to n
 */
-void BTNonLeafNode::setKeyCount(int n) {
-   memcpy(buffer + (PageFile::PAGE_SIZE - sizeof(n)), (char *) &n, sizeof(n));
+template <class Key>
+void BasicBTNonLeafNode<Key>::setKeyCount(int n) {
+   detach();
+   memcpy(node + (PageFile::PAGE_SIZE - sizeof(n)), (char *) &n, sizeof(n));
 }
 
 
+/*
+ * Find where a new key goes: right behind the pointer left if it is in
+ * the node, or else behind the keys not larger than it.
+ * @param key[IN] the key to insert
+ * @param left[IN] the child-node pointer the new one goes behind, or -1
+ * @return the index of the new key; its pointer goes one further
+ */
+template <class Key>
+int BasicBTNonLeafNode<Key>::insertPosition(Key key, PageId left)
+{
+    int keyCount = this->getKeyCount();
+
+    for (int i = 0; left >= 0 && i <= keyCount; i++) {
+        if (pids()[i] == left) return i;
+    }
+    return searchKeys(keys(), keyCount, key, true);
+}
+
 /*
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param left[IN] the child-node pointer the new one goes behind, or -1
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid)
+template <class Key>
+RC BasicBTNonLeafNode<Key>::insert(Key key, PageId pid, PageId left)
 { 
+    detach();
     int keyCount = this->getKeyCount();
-    int curKey;
 
-    if (keyCount == MAXIMUM_KEY_COUNT) {
+    if (keyCount == MAX_KEY_COUNT) {
         // TODO: error -> node is full
         return RC_NODE_FULL;
     }
 
-    int idx;
-    for (idx = 0; idx < keyCount; idx++) {
-        memcpy(&curKey, buffer + (idx * 8) + sizeof(int), sizeof(int));
-        
-        if (curKey > key) {
-            break;
-        } 
-    }
-
-    // move everything after to tempbuffer
-    char tempbuffer[PageFile::PAGE_SIZE];
-    int sizeToCopy = PageFile::PAGE_SIZE - (idx * 8) - 12; // - 8 for what we are inserting, -4 to position correctly
-    memcpy(tempbuffer, buffer + (idx * 8) + 4, sizeToCopy);
-
-    // store new things in
-    memcpy(buffer + (idx * 8) + 4, (char *) &key, sizeof(key));
-    memcpy(buffer + ((idx + 1) * 8), (char *) &pid, sizeof(pid));
-
-    // move temp buffer back to original buffer but in eid + 1
-    memcpy(buffer + ((idx + 1) * 8) + 4, tempbuffer, sizeToCopy);
+    // the new key goes behind the keys not larger than it, or behind the
+    // pointer left, and the new pointer right behind the new key
+    int idx = insertPosition(key, left);
+    memmove(keys() + idx + 1, keys() + idx, (keyCount - idx) * sizeof(Key));
+    memmove(pids() + idx + 2, pids() + idx + 1, (keyCount - idx) * sizeof(PageId));
+    keys()[idx] = key;
+    pids()[idx + 1] = pid;
 
     // adjust key count
     setKeyCount(keyCount + 1);
@@ -360,56 +653,72 @@ RC BTNonLeafNode::insert(int key, PageId pid)
  * @param pid[IN] the PageId to insert
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+ * @param left[IN] the child-node pointer the new one goes behind, or -1
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
+template <class Key>
+RC BasicBTNonLeafNode<Key>::insertAndSplit(Key key, PageId pid, BasicBTNonLeafNode& sibling, Key& midKey,
+                                           PageId left)
 { 
-    int idx;
+    detach();
+    sibling.detach();
     int keyCount = this->getKeyCount();
-    int curKey;
-
-    for (idx = 0; idx < keyCount; idx++) {
-        memcpy(&curKey, buffer + (idx * 8) + sizeof(int), sizeof(int));
-        
-        if (curKey > key) {
-            break;
-        } 
-    }
-
-    // move everything after to tempbuffer
-    char tempbuffer[PageFile::PAGE_SIZE];
-    int sizeToCopy = PageFile::PAGE_SIZE - (idx * 8) - 12; // - 8 for what we are inserting, -4 to position correctly
-    memcpy(tempbuffer, buffer + (idx * 8) + 4, sizeToCopy);
-
-    // store new things in
-    memcpy(buffer + (idx * 8) + 4, (char *) &key, sizeof(key));
-    memcpy(buffer + ((idx + 1) * 8), (char *) &pid, sizeof(pid));
-
-    // move temp buffer back to original buffer but in eid + 1
-    memcpy(buffer + ((idx + 1) * 8) + 4, tempbuffer, sizeToCopy);
-
-    // adjust key count
-    setKeyCount(keyCount + 1);
-
-
-    // split into two 
-    int currentKeyCount = this->getKeyCount();
-    int siblingKeyCount = currentKeyCount / 2;
-    // middle key will be copied so don't increment
-    currentKeyCount = currentKeyCount / 2;
 
-    // we move the remaining elements to sibling, WITHOUT COPYING MIDPOINT VALUE, it is MOVED not COPIED
-    memcpy(sibling.buffer, this->buffer + (currentKeyCount + 1) * 8, (siblingKeyCount) * 8 + sizeof(int));
+    // the node is full, so the entries are put in order in a temporary
+    // array first
+    Key tempKeys[MAX_KEY_COUNT + 1];
+    PageId tempPids[MAX_KEY_COUNT + 2];
+
+    int idx = insertPosition(key, left);
+    memcpy(tempKeys, keys(), idx * sizeof(Key));
+    memcpy(tempPids, pids(), (idx + 1) * sizeof(PageId));
+    tempKeys[idx] = key;
+    tempPids[idx + 1] = pid;
+    memcpy(tempKeys + idx + 1, keys() + idx, (keyCount - idx) * sizeof(Key));
+    memcpy(tempPids + idx + 2, pids() + idx + 1, (keyCount - idx) * sizeof(PageId));
+    keyCount++;
+
+    // split into two. the middle key is MOVED up to the parent, not
+    // copied to either node
+    int currentKeyCount = keyCount / 2;
+    int siblingKeyCount = keyCount - currentKeyCount - 1;
+
+    memcpy(keys(), tempKeys, currentKeyCount * sizeof(Key));
+    memcpy(pids(), tempPids, (currentKeyCount + 1) * sizeof(PageId));
+    memcpy(sibling.keys(), tempKeys + currentKeyCount + 1, siblingKeyCount * sizeof(Key));
+    memcpy(sibling.pids(), tempPids + currentKeyCount + 1, (siblingKeyCount + 1) * sizeof(PageId));
 
     this->setKeyCount(currentKeyCount);
     sibling.setKeyCount(siblingKeyCount);
 
     // get midpoint value
-    memcpy(&midKey, buffer + ((currentKeyCount+1) * 8) - sizeof(int), sizeof(int));
+    midKey = tempKeys[currentKeyCount];
 
     return 0; 
 }
 
+/*
+ * Append the (key, pid) pair after the last entry of the node.
+ * @param key[IN] the key to append
+ * @param pid[IN] the PageId to append behind the key
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+template <class Key>
+RC BasicBTNonLeafNode<Key>::append(Key key, PageId pid)
+{
+    detach();
+    int keyCount = this->getKeyCount();
+    if (keyCount == MAX_KEY_COUNT) {
+        return RC_NODE_FULL;
+    }
+
+    keys()[keyCount] = key;
+    pids()[keyCount + 1] = pid;
+
+    setKeyCount(keyCount + 1);
+    return 0;
+}
+
 /*
  * Given the searchKey, find the child-node pointer to follow and
  * output it in pid.
@@ -417,30 +726,82 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
  * @param pid[OUT] the pointer to the child node to follow.
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
+template <class Key>
+RC BasicBTNonLeafNode<Key>::locateChildPtr(Key searchKey, PageId& pid)
 { 
+    // follow the pointer in front of the first key larger than searchKey
+    int i = searchKeys(keys(), this->getKeyCount(), searchKey, true);
+
+    pid = pids()[i];
+    return 0;
+}
+
+/*
+ * Copy the child-node pointers that follow the pointer pid in the node.
+ * @param pid[IN] a child-node pointer in the node
+ * @param next[OUT] the pointers following pid, in key order
+ * @param count[IN/OUT] the most pointers to copy; the number copied
+ * @return 0 if successful. RC_NO_SUCH_RECORD if pid is not in the node.
+ */
+template <class Key>
+RC BasicBTNonLeafNode<Key>::getNextChildPtrs(PageId pid, PageId* next, int& count)
+{
     int keyCount = this->getKeyCount();
-    int curKey;
-    int slot = -1;
+    int max = count;
+    int i;
 
-    RC ret = RC_NO_SUCH_RECORD;
+    for (i = 0; i <= keyCount && pids()[i] != pid; i++);
+    if (i > keyCount) {
+        count = 0;
+        return RC_NO_SUCH_RECORD;
+    }
 
-    RecordId record;
+    for (count = 0, i++; count < max && i <= keyCount; count++, i++) {
+        next[count] = pids()[i];
+    }
+    return 0;
+}
 
+/*
+ * Copy the child-node pointers that precede the pointer pid in the node.
+ * @param pid[IN] a child-node pointer in the node
+ * @param prev[OUT] the pointers preceding pid, in descending key order
+ * @param count[IN/OUT] the most pointers to copy; the number copied
+ * @return 0 if successful. RC_NO_SUCH_RECORD if pid is not in the node.
+ */
+template <class Key>
+RC BasicBTNonLeafNode<Key>::getPrevChildPtrs(PageId pid, PageId* prev, int& count)
+{
+    int keyCount = this->getKeyCount();
+    int max = count;
     int i;
-    for (i = 0; i < keyCount; i++) {
-        memcpy(&curKey, buffer + (i * 8) + sizeof(int), sizeof(int));
-        
-        if (curKey > searchKey) {
-            memcpy(&pid, buffer + (i * 8), sizeof(PageId));
-            return 0;
-        } 
+
+    for (i = 0; i <= keyCount && pids()[i] != pid; i++);
+    if (i > keyCount) {
+        count = 0;
+        return RC_NO_SUCH_RECORD;
     }
 
-    memcpy(&pid, buffer + (i*8), sizeof(PageId));
+    for (count = 0, i--; count < max && i >= 0; count++, i--) {
+        prev[count] = pids()[i];
+    }
     return 0;
 }
 
+/*
+ * Copy the keys and the child-node pointers of the node.
+ * @param keys[OUT] the getKeyCount() keys
+ * @param pids[OUT] the getKeyCount() + 1 pointers
+ */
+template <class Key>
+void BasicBTNonLeafNode<Key>::getEntries(Key* keys, PageId* pids)
+{
+    int keyCount = this->getKeyCount();
+
+    memcpy(keys, this->keys(), keyCount * sizeof(Key));
+    memcpy(pids, this->pids(), (keyCount + 1) * sizeof(PageId));
+}
+
 /*
  * Initialize the root node with (pid1, key, pid2).
  * @param pid1[IN] the first PageId to insert
@@ -448,25 +809,688 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
  * @param pid2[IN] the PageId to insert behind the key
  * @return 0 if successful. Return an error code if there is an error.
  */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+template <class Key>
+RC BasicBTNonLeafNode<Key>::initializeRoot(PageId pid1, Key key, PageId pid2)
 { 
-    memset(buffer, 0, PageFile::PAGE_SIZE);
-
-    //set things
-    //////////////////////
-    memcpy(this->buffer, (char *) &pid1, sizeof(PageId));
-
-    memcpy(this->buffer + sizeof(PageId), (char *) &key, sizeof(int));
+    detach();
+    memset(node, 0, PageFile::PAGE_SIZE);
 
-    memcpy(this->buffer + sizeof(PageId) + sizeof(int) , (char *) &pid2, sizeof(PageId));
+    keys()[0] = key;
+    pids()[0] = pid1;
+    pids()[1] = pid2;
 
     this->setKeyCount(1); //set keycount to 1
     
     return 0; 
 }
 
-RC BTNonLeafNode::getFirstPage(PageId& pid) {
+template <class Key>
+RC BasicBTNonLeafNode<Key>::getFirstPage(PageId& pid) {
+    if (this->getKeyCount() == 0) { return RC_NO_SUCH_RECORD; }
+    pid = pids()[0];
+    return 0;
+}
+
+// the key types the nodes are built for. StringKey has nodes of its
+// own, below
+template class BasicBTLeafNode<int>;
+template class BasicBTNonLeafNode<int>;
+
+
+//StringKey leaf nodes
+////////////////////////////////
+
+void BasicBTLeafNode<StringKey>::printNode() {
+    int keyCount = getKeyCount();
+    printf("Printing BTLeafNode with %i elements\n", keyCount);
+    for (int i = 0; i < keyCount; i++) {
+        StringKey key;
+        RecordId record;
+        readEntry(i, key, record);
+        printf("key: '%.*s'   pid: %i   sid: %i\n", key.length, key.bytes, record.pid, record.sid);
+    }
+    printf("Done printing\n");
+}
+
+RC BasicBTLeafNode<StringKey>::read(PageId pid, const PageFile& pf)
+{
+    this->handle.release();
+    this->node = this->buffer;
+    return pf.read(pid, this->buffer);
+}
+
+RC BasicBTLeafNode<StringKey>::pin(PageId pid, const PageFile& pf)
+{
+    RC rc = pf.pin(pid, this->handle);
+    this->node = (rc == 0) ? this->handle.data() : this->buffer;
+    return rc;
+}
+
+void BasicBTLeafNode<StringKey>::release()
+{
+    this->handle.release();
+    this->node = this->buffer;
+}
+
+void BasicBTLeafNode<StringKey>::detach()
+{
+    if (this->node == this->buffer) return;
+    memcpy(this->buffer, this->node, PageFile::PAGE_SIZE);
+    this->node = this->buffer;
+    this->handle.release();
+}
+
+RC BasicBTLeafNode<StringKey>::write(PageId pid, PageFile& pf)
+{
+    detach();
+    return pf.write(pid, this->node);
+}
+
+int BasicBTLeafNode<StringKey>::getKeyCount()
+{
+    int temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - sizeof(temp)), sizeof(temp));
+    return temp;
+}
+
+/*
+ * Set the key count to n. A count of 0 empties the node, and frees the
+ * bytes of its keys.
+ */
+void BasicBTLeafNode<StringKey>::setKeyCount(int n) {
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - sizeof(n)), (char *) &n, sizeof(n));
+    if (n == 0) {
+        setKeyBytes(0);
+    }
+}
+
+/*
+ * The bytes the keys take, stored in front of the previous-node pointer.
+ */
+int BasicBTLeafNode<StringKey>::getKeyBytes()
+{
+    int temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - 4 * sizeof(temp)), sizeof(temp));
+    return temp;
+}
+
+void BasicBTLeafNode<StringKey>::setKeyBytes(int n)
+{
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - 4 * sizeof(n)), (char *) &n, sizeof(n));
+}
+
+PageId BasicBTLeafNode<StringKey>::getNextNodePtr()
+{
+    PageId temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - 2 * sizeof(temp)), sizeof(temp));
+    return temp;
+}
+
+RC BasicBTLeafNode<StringKey>::setNextNodePtr(PageId pid)
+{
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - 2 * sizeof(pid)), (char *) &pid, sizeof(pid));
+    return 0;
+}
+
+PageId BasicBTLeafNode<StringKey>::getPrevNodePtr()
+{
+    PageId temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - 3 * sizeof(temp)), sizeof(temp));
+    return temp;
+}
+
+RC BasicBTLeafNode<StringKey>::setPrevNodePtr(PageId pid)
+{
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - 3 * sizeof(pid)), (char *) &pid, sizeof(pid));
+    return 0;
+}
+
+/*
+ * The key of the eid entry: its length byte, followed by its bytes.
+ */
+const char* BasicBTLeafNode<StringKey>::keyAt(int eid)
+{
+    unsigned short offset;
+    memcpy(&offset, node + eid * SLOT_SIZE + sizeof(RecordId), sizeof(offset));
+    return node + offset;
+}
+
+/*
+ * Compare the key of the eid entry with key, as StringKey::compare() does,
+ * without copying it.
+ */
+int BasicBTLeafNode<StringKey>::compareKey(int eid, const StringKey& key)
+{
+    const char* k = keyAt(eid);
+    int length = (unsigned char) k[0];
+    int diff = memcmp(k + 1, key.bytes, (length < key.length) ? length : key.length);
+    return (diff != 0) ? diff : length - key.length;
+}
+
+/*
+ * Find the first entry with a key not smaller than key, or, if upper is
+ * set, larger than key.
+ * @return the entry number, the key count if there is none
+ */
+int BasicBTLeafNode<StringKey>::search(const StringKey& key, bool upper)
+{
+    int lo = 0;
+    int hi = getKeyCount();
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int diff = compareKey(mid, key);
+        if (diff < 0 || (upper && diff == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void BasicBTLeafNode<StringKey>::getKey(int eid, StringKey& key)
+{
+    const char* k = keyAt(eid);
+    key.length = (unsigned char) k[0];
+    memcpy(key.bytes, k + 1, key.length);
+}
+
+/*
+ * Write an entry to slot eid, with its key below the keys stacked so far.
+ * The caller has made room for the slot and checked there is room for the
+ * key; the key count is left to it.
+ */
+void BasicBTLeafNode<StringKey>::putEntry(int eid, const StringKey& key, const RecordId& rid)
+{
+    int keyBytes = getKeyBytes() + 1 + key.length;
+    unsigned short offset = CAPACITY - keyBytes;
+
+    node[offset] = (char) key.length;
+    memcpy(node + offset + 1, key.bytes, key.length);
+    memcpy(node + eid * SLOT_SIZE, &rid, sizeof(rid));
+    memcpy(node + eid * SLOT_SIZE + sizeof(rid), &offset, sizeof(offset));
+    setKeyBytes(keyBytes);
+}
+
+/*
+ * Insert a (key, rid) pair to the node.
+ * @return 0 if successful. RC_NODE_FULL if the node is full, and
+ *         RC_DUPLICATE_KEY if the key is in the node and duplicates is not set.
+ */
+RC BasicBTLeafNode<StringKey>::insert(const StringKey& key, const RecordId& rid, bool duplicates)
+{
+    detach();
+    int keyCount = this->getKeyCount();
+    if (isFull()) {
+        return RC_NODE_FULL;
+    }
+
+    int eid;
+    if (this->locate(key, eid) == 0) {
+        if (!duplicates) {
+            return RC_DUPLICATE_KEY;
+        }
+        eid = search(key, true);
+    }
+
+    memmove(node + (eid + 1) * SLOT_SIZE, node + eid * SLOT_SIZE, (keyCount - eid) * SLOT_SIZE);
+    putEntry(eid, key, rid);
+    this->setKeyCount(keyCount + 1);
+    return 0;
+}
+
+/*
+ * Insert the (key, rid) pair to the node and split the node with sibling,
+ * so that each gets about half of the bytes.
+ * @param siblingKey[OUT] the shortest key between the two nodes
+ * @return 0 if successful. RC_DUPLICATE_KEY if the key is in the node and
+ *         duplicates is not set.
+ */
+RC BasicBTLeafNode<StringKey>::insertAndSplit(const StringKey& key, const RecordId& rid,
+                                              BasicBTLeafNode& sibling, StringKey& siblingKey,
+                                              bool duplicates)
+{
+    detach();
+    sibling.detach();
+    int keyCount = getKeyCount();
+    int eid;
+    PageId pid = this->getNextNodePtr();
+
+    if (this->locate(key, eid) == 0) {
+        if (!duplicates) {
+            return RC_DUPLICATE_KEY;
+        }
+        eid = search(key, true);
+    }
+
+    //The entries are laid out again from a copy of the node, with the new
+    //one at eid. The first ones up to half of the bytes stay
+    BasicBTLeafNode old;
+    memcpy(old.buffer, this->node, PageFile::PAGE_SIZE);
+
+    int total = old.getUsedBytes() + SLOT_SIZE + 1 + key.length;
+    int half = 0;
+    int stay;
+    for (stay = 0; stay < keyCount && half * 2 < total; stay++) {
+        int length = (stay == eid) ? key.length : (unsigned char) old.keyAt(stay - (stay > eid))[0];
+        half += SLOT_SIZE + 1 + length;
+    }
+    if (stay < 1) stay = 1;
+
+    StringKey last;
+    this->setKeyCount(0);
+    for (int i = 0; i <= keyCount; i++) {
+        StringKey k;
+        RecordId r;
+        if (i == eid) {
+            k = key;
+            r = rid;
+        } else {
+            old.readEntry(i - (i > eid), k, r);
+        }
+
+        if (i < stay) {
+            this->append(k, r);
+            last = k;
+        } else {
+            if (i == stay) {
+                siblingKey = separatorKey(last, k);
+            }
+            sibling.append(k, r);
+        }
+    }
+
+    sibling.setNextNodePtr(pid);
+    this->setNextNodePtr(pid);
+
+    return 0;
+}
+
+/*
+ * Append the (key, rid) pair after the last entry of the node.
+ * @return 0 if successful. RC_NODE_FULL if there is no room for it.
+ */
+RC BasicBTLeafNode<StringKey>::append(const StringKey& key, const RecordId& rid)
+{
+    detach();
+    int keyCount = this->getKeyCount();
+    if (getUsedBytes() + SLOT_SIZE + 1 + key.length > CAPACITY) {
+        return RC_NODE_FULL;
+    }
+
+    putEntry(keyCount, key, rid);
+    this->setKeyCount(keyCount + 1);
+    return 0;
+}
+
+RC BasicBTLeafNode<StringKey>::locate(const StringKey& searchKey, int& eid)
+{
+    eid = search(searchKey, false);
+    if (eid < this->getKeyCount() && compareKey(eid, searchKey) == 0) {
+        return 0;
+    }
+    return RC_NO_SUCH_RECORD;
+}
+
+RC BasicBTLeafNode<StringKey>::locateLast(const StringKey& searchKey, int& eid)
+{
+    eid = search(searchKey, true) - 1;
+    if (eid >= 0 && compareKey(eid, searchKey) == 0) {
+        return 0;
+    }
+    return RC_NO_SUCH_RECORD;
+}
+
+RC BasicBTLeafNode<StringKey>::readEntry(int eid, StringKey& key, RecordId& rid)
+{
+    if (eid < 0 || eid >= this->getKeyCount()) return -1;
+
+    getKey(eid, key);
+    memcpy(&rid, node + eid * SLOT_SIZE, sizeof(rid));
+    return 0;
+}
+
+int BasicBTLeafNode<StringKey>::readEntries(int eid, StringKey* keys, RecordId* rids, int max)
+{
+    int n = this->getKeyCount() - eid;
+    if (n > max) n = max;
+
+    for (int i = 0; i < n; i++) {
+        readEntry(eid + i, keys[i], rids[i]);
+    }
+    return (n > 0) ? n : 0;
+}
+
+int BasicBTLeafNode<StringKey>::readEntriesBackward(int eid, StringKey* keys, RecordId* rids, int max)
+{
+    int keyCount = this->getKeyCount();
+    if (eid > keyCount) eid = keyCount;
+
+    int n = (eid < max) ? eid : max;
+    for (int i = 0; i < n; i++) {
+        readEntry(eid - 1 - i, keys[i], rids[i]);
+    }
+    return (n > 0) ? n : 0;
+}
+
+
+//StringKey nonleaf nodes
+////////////////////////////////
+
+void BasicBTNonLeafNode<StringKey>::printNode() {
+    int keyCount = getKeyCount();
+    printf("Printing BTNonLeafNode with %i elements\n", keyCount);
+    printf("pid_0: %i\n", getPid(0));
+    for (int i = 0; i < keyCount; i++) {
+        StringKey key;
+        getKey(i, key);
+        printf("key_%i: '%.*s'     pid_%i: %i\n", i, key.length, key.bytes, i + 1, getPid(i + 1));
+    }
+    printf("Done printing\n");
+}
+
+RC BasicBTNonLeafNode<StringKey>::read(PageId pid, const PageFile& pf)
+{
+    this->handle.release();
+    this->node = this->buffer;
+    return pf.read(pid, this->buffer);
+}
+
+RC BasicBTNonLeafNode<StringKey>::pin(PageId pid, const PageFile& pf)
+{
+    // inner nodes are on the path of every lookup; keep them cached
+    RC rc = pf.pin(pid, this->handle, PageFile::PIN_SHARED | PageFile::PIN_PRIORITY);
+    this->node = (rc == 0) ? this->handle.data() : this->buffer;
+    return rc;
+}
+
+void BasicBTNonLeafNode<StringKey>::detach()
+{
+    if (this->node == this->buffer) return;
+    memcpy(this->buffer, this->node, PageFile::PAGE_SIZE);
+    this->node = this->buffer;
+    this->handle.release();
+}
+
+RC BasicBTNonLeafNode<StringKey>::write(PageId pid, PageFile& pf)
+{
+    detach();
+    return pf.write(pid, this->node);
+}
+
+int BasicBTNonLeafNode<StringKey>::getKeyCount()
+{
+    int temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - sizeof(temp)), sizeof(temp));
+    return temp;
+}
+
+/*
+ * Set the key count to n. A count of 0 empties the node, and frees the
+ * bytes of its keys.
+ */
+void BasicBTNonLeafNode<StringKey>::setKeyCount(int n) {
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - sizeof(n)), (char *) &n, sizeof(n));
+    if (n == 0) {
+        setKeyBytes(0);
+    }
+}
+
+/*
+ * The bytes the keys take, stored in front of the key count.
+ */
+int BasicBTNonLeafNode<StringKey>::getKeyBytes()
+{
+    int temp;
+    memcpy(&temp, node + (PageFile::PAGE_SIZE - 2 * sizeof(temp)), sizeof(temp));
+    return temp;
+}
+
+void BasicBTNonLeafNode<StringKey>::setKeyBytes(int n)
+{
+    detach();
+    memcpy(node + (PageFile::PAGE_SIZE - 2 * sizeof(n)), (char *) &n, sizeof(n));
+}
+
+/*
+ * Child-node pointer i: the first one, or the one in the slot of key i - 1.
+ */
+PageId BasicBTNonLeafNode<StringKey>::getPid(int i)
+{
+    PageId pid;
+    memcpy(&pid, node + ((i == 0) ? 0 : sizeof(PageId) + (i - 1) * SLOT_SIZE), sizeof(pid));
+    return pid;
+}
+
+const char* BasicBTNonLeafNode<StringKey>::keyAt(int i)
+{
+    unsigned short offset;
+    memcpy(&offset, node + sizeof(PageId) + i * SLOT_SIZE + sizeof(PageId), sizeof(offset));
+    return node + offset;
+}
+
+int BasicBTNonLeafNode<StringKey>::compareKey(int i, const StringKey& key)
+{
+    const char* k = keyAt(i);
+    int length = (unsigned char) k[0];
+    int diff = memcmp(k + 1, key.bytes, (length < key.length) ? length : key.length);
+    return (diff != 0) ? diff : length - key.length;
+}
+
+int BasicBTNonLeafNode<StringKey>::search(const StringKey& key, bool upper)
+{
+    int lo = 0;
+    int hi = getKeyCount();
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        int diff = compareKey(mid, key);
+        if (diff < 0 || (upper && diff == 0)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+void BasicBTNonLeafNode<StringKey>::getKey(int i, StringKey& key)
+{
+    const char* k = keyAt(i);
+    key.length = (unsigned char) k[0];
+    memcpy(key.bytes, k + 1, key.length);
+}
+
+/*
+ * Write key i and the pointer behind it to slot i, with the key below the
+ * keys stacked so far. The caller has made room for the slot and checked
+ * there is room for the key; the key count is left to it.
+ */
+void BasicBTNonLeafNode<StringKey>::putEntry(int i, const StringKey& key, PageId pid)
+{
+    int keyBytes = getKeyBytes() + 1 + key.length;
+    unsigned short offset = sizeof(PageId) + CAPACITY - keyBytes;
+    char* slot = node + sizeof(PageId) + i * SLOT_SIZE;
+
+    node[offset] = (char) key.length;
+    memcpy(node + offset + 1, key.bytes, key.length);
+    memcpy(slot, &pid, sizeof(pid));
+    memcpy(slot + sizeof(pid), &offset, sizeof(offset));
+    setKeyBytes(keyBytes);
+}
+
+int BasicBTNonLeafNode<StringKey>::insertPosition(const StringKey& key, PageId left)
+{
+    int keyCount = this->getKeyCount();
+
+    for (int i = 0; left >= 0 && i <= keyCount; i++) {
+        if (getPid(i) == left) return i;
+    }
+    return search(key, true);
+}
+
+RC BasicBTNonLeafNode<StringKey>::insert(const StringKey& key, PageId pid, PageId left)
+{
+    detach();
+    int keyCount = this->getKeyCount();
+
+    if (isFull()) {
+        return RC_NODE_FULL;
+    }
+
+    int idx = insertPosition(key, left);
+    char* slot = node + sizeof(PageId) + idx * SLOT_SIZE;
+    memmove(slot + SLOT_SIZE, slot, (keyCount - idx) * SLOT_SIZE);
+    putEntry(idx, key, pid);
+    setKeyCount(keyCount + 1);
+
+    return 0;
+}
+
+/*
+ * Insert the (key, pid) pair to the node and split the node with sibling.
+ * The key moved up is the one where the keys in front of it take about
+ * half of the bytes.
+ * @param midKey[OUT] the key moved up to the parent
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BasicBTNonLeafNode<StringKey>::insertAndSplit(const StringKey& key, PageId pid,
+                                                 BasicBTNonLeafNode& sibling, StringKey& midKey,
+                                                 PageId left)
+{
+    detach();
+    sibling.detach();
+    int keyCount = this->getKeyCount();
+    int idx = insertPosition(key, left);
+
+    //The keys are laid out again from a copy of the node, with the new one
+    //at idx, and the pointer behind each key goes with it
+    BasicBTNonLeafNode old;
+    memcpy(old.buffer, this->node, PageFile::PAGE_SIZE);
+
+    int total = old.getUsedBytes() + SLOT_SIZE + 1 + key.length;
+    int half = 0;
+    int mid;
+    for (mid = 0; mid < keyCount && half * 2 < total; mid++) {
+        int length = (mid == idx) ? key.length : (unsigned char) old.keyAt(mid - (mid > idx))[0];
+        half += SLOT_SIZE + 1 + length;
+    }
+    //Both nodes keep a key
+    if (mid < 1) mid = 1;
+    if (mid > keyCount - 1) mid = keyCount - 1;
+
+    PageId first = old.getPid(0);
+    for (int i = 0; i <= keyCount; i++) {
+        StringKey k;
+        PageId p;
+        if (i == idx) {
+            k = key;
+            p = pid;
+        } else {
+            old.getKey(i - (i > idx), k);
+            p = old.getPid(i - (i > idx) + 1);
+        }
+
+        if (i == mid) {
+            midKey = k;
+            first = p;
+        } else if (i == 0 || i == mid + 1) {
+            (i == 0 ? *this : sibling).initializeRoot(first, k, p);
+        } else {
+            (i < mid ? *this : sibling).append(k, p);
+        }
+    }
+
+    return 0;
+}
+
+RC BasicBTNonLeafNode<StringKey>::append(const StringKey& key, PageId pid)
+{
+    detach();
+    int keyCount = this->getKeyCount();
+    if (getUsedBytes() + SLOT_SIZE + 1 + key.length > CAPACITY) {
+        return RC_NODE_FULL;
+    }
+
+    putEntry(keyCount, key, pid);
+    setKeyCount(keyCount + 1);
+    return 0;
+}
+
+RC BasicBTNonLeafNode<StringKey>::locateChildPtr(const StringKey& searchKey, PageId& pid)
+{
+    // follow the pointer in front of the first key larger than searchKey
+    pid = getPid(search(searchKey, true));
+    return 0;
+}
+
+RC BasicBTNonLeafNode<StringKey>::getNextChildPtrs(PageId pid, PageId* next, int& count)
+{
+    int keyCount = this->getKeyCount();
+    int max = count;
+    int i;
+
+    for (i = 0; i <= keyCount && getPid(i) != pid; i++);
+    if (i > keyCount) {
+        count = 0;
+        return RC_NO_SUCH_RECORD;
+    }
+
+    for (count = 0, i++; count < max && i <= keyCount; count++, i++) {
+        next[count] = getPid(i);
+    }
+    return 0;
+}
+
+RC BasicBTNonLeafNode<StringKey>::getPrevChildPtrs(PageId pid, PageId* prev, int& count)
+{
+    int keyCount = this->getKeyCount();
+    int max = count;
+    int i;
+
+    for (i = 0; i <= keyCount && getPid(i) != pid; i++);
+    if (i > keyCount) {
+        count = 0;
+        return RC_NO_SUCH_RECORD;
+    }
+
+    for (count = 0, i--; count < max && i >= 0; count++, i--) {
+        prev[count] = getPid(i);
+    }
+    return 0;
+}
+
+void BasicBTNonLeafNode<StringKey>::getEntries(StringKey* keys, PageId* pids)
+{
+    int keyCount = this->getKeyCount();
+
+    pids[0] = getPid(0);
+    for (int i = 0; i < keyCount; i++) {
+        getKey(i, keys[i]);
+        pids[i + 1] = getPid(i + 1);
+    }
+}
+
+RC BasicBTNonLeafNode<StringKey>::initializeRoot(PageId pid1, const StringKey& key, PageId pid2)
+{
+    detach();
+    memset(node, 0, PageFile::PAGE_SIZE);
+
+    memcpy(node, &pid1, sizeof(pid1));
+    putEntry(0, key, pid2);
+    this->setKeyCount(1);
+
+    return 0;
+}
+
+RC BasicBTNonLeafNode<StringKey>::getFirstPage(PageId& pid) {
     if (this->getKeyCount() == 0) { return RC_NO_SUCH_RECORD; }
-    memcpy(&pid, this->buffer, sizeof(PageId));
+    pid = getPid(0);
     return 0;
 }
@@ -13,21 +13,106 @@
 #include "RecordFile.h"
 #include "PageFile.h"
 
-//User defined stuff
-
-//For how many keys can be placed in a single node
-#define MAXIMUM_KEY_COUNT 70
-
 #include <string.h> //This is for memcpy
 #include <cstdio> // for printf
+#include <limits>
 
 /**
- * BTLeafNode: The class representing a B+tree leaf node.
+ * A key of up to MAX_LENGTH bytes, such as the value of a tuple. Keys
+ * compare like strings: byte by byte, and the shorter of two keys that
+ * agree up to its length comes first. A longer value is cut to
+ * MAX_LENGTH bytes, which keeps the order of values but may make two of
+ * them the same key.
  */
-class BTLeafNode {
+struct StringKey {
+    static const int MAX_LENGTH = RecordFile::MAX_VALUE_LENGTH;
+
+    unsigned char length;
+    char bytes[MAX_LENGTH];
+
+    StringKey() : length(0) {}
+    StringKey(const char* s, int n) {
+        length = (n < MAX_LENGTH) ? n : MAX_LENGTH;
+        memcpy(bytes, s, length);
+    }
+
+    //<0, 0 or >0 as the key is smaller than, equal to or larger than k
+    int compare(const StringKey& k) const {
+        int diff = memcmp(bytes, k.bytes, (length < k.length) ? length : k.length);
+        return (diff != 0) ? diff : length - k.length;
+    }
+
+    bool operator<(const StringKey& k) const { return compare(k) < 0; }
+    bool operator>(const StringKey& k) const { return compare(k) > 0; }
+    bool operator<=(const StringKey& k) const { return compare(k) <= 0; }
+    bool operator>=(const StringKey& k) const { return compare(k) >= 0; }
+    bool operator==(const StringKey& k) const { return compare(k) == 0; }
+    bool operator!=(const StringKey& k) const { return compare(k) != 0; }
+};
+
+//The smallest and largest StringKey, which the index scans start from
+//as from the smallest and largest int
+namespace std {
+template <>
+class numeric_limits<StringKey> {
   public:
-    BTLeafNode() {
+    static const bool is_specialized = true;
+    static StringKey min() { return StringKey(); }
+    static StringKey max() {
+        StringKey key;
+        key.length = StringKey::MAX_LENGTH;
+        memset(key.bytes, 0xff, StringKey::MAX_LENGTH);
+        return key;
+    }
+};
+}
+
+/**
+ * Find the first of the sorted keys[0..n) that is not smaller than key,
+ * or, if upper is set, larger than key. This is the search of the nodes,
+ * for the keys of a node kept elsewhere.
+ * @param keys[IN] the keys, in non-decreasing order
+ * @param n[IN] the number of keys
+ * @param key[IN] the key to search for
+ * @param upper[IN] whether to skip the keys equal to key
+ * @return the position of the key found, n if there is none
+ */
+int searchKeys(const int* keys, int n, int key, bool upper);
+int searchKeys(const StringKey* keys, int n, const StringKey& key, bool upper);
+
+/**
+ * The key a non-leaf node keeps between two children: one not larger
+ * than the first key of the right child, and larger than the last key of
+ * the left one unless the two are the same key. An int key is the first
+ * key of the right child; a StringKey is the shortest prefix of it that
+ * will do, so that more of them fit in a node.
+ * @param left[IN] the last key of the left child
+ * @param right[IN] the first key of the right child, not smaller than left
+ * @return the key between them
+ */
+inline int separatorKey(int left, int right) { return right; }
+StringKey separatorKey(const StringKey& left, const StringKey& right);
+
+/**
+ * BasicBTLeafNode: The class representing a B+tree leaf node, with keys
+ * of type Key. StringKey keys have a node layout of their own, below.
+ */
+template <class Key>
+class BasicBTLeafNode {
+  public:
+   /**
+    * How many (key, rid) entries fit in a leaf. The keys are an array at
+    * the start of the page and the RecordIds an array behind them, so
+    * that a search reads the keys alone: a few cache lines instead of the
+    * whole node. The last 12 bytes of the page hold the previous-node
+    * pointer, the next-node pointer and the key count.
+    */
+    static const int MAX_KEY_COUNT =
+        (PageFile::PAGE_SIZE - 16) / (sizeof(Key) + sizeof(RecordId));
+
+    BasicBTLeafNode() {
         memset(buffer, 0, PageFile::PAGE_SIZE);
+        node = buffer;
     }
 
    void printNode();
@@ -37,9 +122,13 @@ class BTLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param rid[IN] the RecordId to insert
-    * @return 0 if successful. Return an error code if the node is full.
+    * @param duplicates[IN] whether a key in the node may be inserted
+    *                       again. it goes behind the entries with the key
+    * @return 0 if successful. RC_NODE_FULL if the node is full, and
+    *         RC_DUPLICATE_KEY if the key is in the node and duplicates
+    *         is not set.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(Key key, const RecordId& rid, bool duplicates = false);
 
    /**
     * Insert the (key, rid) pair to the node
@@ -50,9 +139,33 @@ class BTLeafNode {
     * @param rid[IN] the RecordId to insert.
     * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
     * @param siblingKey[OUT] the first key in the sibling node after split.
-    * @return 0 if successful. Return an error code if there is an error.
+    * @param duplicates[IN] whether a key in the node may be inserted again
+    * @return 0 if successful. RC_DUPLICATE_KEY if the key is in the node
+    *         and duplicates is not set.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+    RC insertAndSplit(Key key, const RecordId& rid, BasicBTLeafNode& sibling, Key& siblingKey,
+                      bool duplicates = false);
+
+   /**
+    * Append the (key, rid) pair after the last entry of the node.
+    * The key must not be smaller than any key in the node.
+    * @param key[IN] the key to append
+    * @param rid[IN] the RecordId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(Key key, const RecordId& rid);
+
+   /**
+    * Return whether the node is filled to fill % of the entries it holds.
+    * Only an insert into a node filled to 100% splits it; a node filled
+    * to less takes at least one more entry.
+    * @param fill[IN] the % of the node, 1 to 100
+    * @return true if the node is filled that far
+    */
+    bool isFull(int fill = 100) {
+        int max = MAX_KEY_COUNT * fill / 100;
+        return getKeyCount() >= ((max > 1) ? max : 1);
+    }
 
    /**
     * If searchKey exists in the node, set eid to the index entry
@@ -65,7 +178,19 @@ class BTLeafNode {
                       behind the largest key smaller than searchKey.
     * @return 0 if searchKey is found. If not, RC_NO_SEARCH_RECORD.
     */
-    RC locate(int searchKey, int& eid);
+    RC locate(Key searchKey, int& eid);
+
+   /**
+    * If searchKey exists in the node, set eid to the index entry
+    * with searchKey and return 0. If not, set eid to the index entry
+    * with the largest key that is smaller than searchKey, -1 if there is
+    * none, and return the error code RC_NO_SUCH_RECORD.
+    * @param searchKey[IN] the key to search for.
+    * @param eid[OUT] the index entry number with the largest key not
+                      larger than searchKey.
+    * @return 0 if searchKey is found. If not, RC_NO_SEARCH_RECORD.
+    */
+    RC locateLast(Key searchKey, int& eid);
 
    /**
     * Read the (key, rid) pair from the eid entry.
@@ -74,7 +199,28 @@ class BTLeafNode {
     * @param rid[OUT] the RecordId from the slot
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC readEntry(int eid, int& key, RecordId& rid);
+    RC readEntry(int eid, Key& key, RecordId& rid);
+
+   /**
+    * Read up to max (key, rid) pairs from the eid entry on.
+    * @param eid[IN] the entry number to start from
+    * @param keys[OUT] the keys
+    * @param rids[OUT] the RecordIds
+    * @param max[IN] the most pairs to read
+    * @return the number of pairs read
+    */
+    int readEntries(int eid, Key* keys, RecordId* rids, int max);
+
+   /**
+    * Read up to max (key, rid) pairs before the eid entry, from the one
+    * right before it back, so that the keys come out in descending order.
+    * @param eid[IN] the entry number to stop before
+    * @param keys[OUT] the keys
+    * @param rids[OUT] the RecordIds
+    * @param max[IN] the most pairs to read
+    * @return the number of pairs read
+    */
+    int readEntriesBackward(int eid, Key* keys, RecordId* rids, int max);
 
    /**
     * Return the pid of the next slibling node.
@@ -90,6 +236,19 @@ class BTLeafNode {
     */
     RC setNextNodePtr(PageId pid);
 
+   /**
+    * Return the pid of the previous sibling node.
+    * @return the PageId of the previous sibling node, 0 if there is none
+    */
+    PageId getPrevNodePtr();
+
+   /**
+    * Set the previous sibling node PageId.
+    * @param pid[IN] the PageId of the previous sibling node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setPrevNodePtr(PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
@@ -103,6 +262,24 @@ class BTLeafNode {
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Pin the page pid of the PageFile pf in the buffer pool and use the
+    * cached frame as the content of the node, without copying it.
+    * The frame stays pinned until the next read() or pin(), or until the
+    * node is destroyed. Modifying the node first copies the frame into
+    * the node's own buffer, so a pinned frame is never changed.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
+
+   /**
+    * Unpin the frame pinned by pin(), if any, so that other threads may
+    * modify the page. The node goes back to its own buffer.
+    */
+    void release();
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
@@ -119,18 +296,46 @@ class BTLeafNode {
     * The main memory buffer for loading the content of the disk page 
     * that contains the node.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char buffer[PageFile::PAGE_SIZE] __attribute__((aligned(64)));
     PageId pid;
+
+   /**
+    * The RecordIds start at the first 8-byte boundary behind the keys.
+    */
+    static const int RID_OFFSET = (MAX_KEY_COUNT * sizeof(Key) + 7) / 8 * 8;
+
+    Key* keys() { return (Key*) node; }
+    RecordId* rids() { return (RecordId*) (node + RID_OFFSET); }
+
+   /**
+    * The content of the node: either buffer or a frame pinned by handle.
+    */
+    char* node;
+    PageHandle handle;
+
+    void detach();
 }; 
 
 
 /**
- * BTNonLeafNode: The class representing a B+tree nonleaf node.
+ * BasicBTNonLeafNode: The class representing a B+tree nonleaf node, with
+ * keys of type Key.
  */
-class BTNonLeafNode {
+template <class Key>
+class BasicBTNonLeafNode {
   public:
-    BTNonLeafNode() {
+   /**
+    * How many keys fit in a nonleaf node. As in a leaf, the keys are an
+    * array at the start of the page. The MAX_KEY_COUNT + 1 child-node
+    * pointers follow them, and the last 4 bytes of the page hold the key
+    * count.
+    */
+    static const int MAX_KEY_COUNT =
+        (PageFile::PAGE_SIZE - sizeof(int)) / (sizeof(Key) + sizeof(PageId)) - 1;
+
+    BasicBTNonLeafNode() {
         memset(buffer, 0, PageFile::PAGE_SIZE);
+        node = buffer;
     }
 
     void printNode();
@@ -140,9 +345,13 @@ class BTNonLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param left[IN] the child-node pointer the new one goes right behind,
+    *                 such as the child that split; -1 to put the new key
+    *                 behind the keys not larger than it. with duplicate
+    *                 keys only the child tells where the new one goes
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(Key key, PageId pid, PageId left = -1);
 
    /**
     * Insert the (key, pid) pair to the node
@@ -154,9 +363,35 @@ class BTNonLeafNode {
     * @param pid[IN] the PageId to insert
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param left[IN] the child-node pointer the new one goes right behind,
+    *                 as for insert()
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(Key key, PageId pid, BasicBTNonLeafNode& sibling, Key& midKey,
+                      PageId left = -1);
+
+   /**
+    * Append the (key, pid) pair after the last entry of the node.
+    * The key must not be smaller than any key in the node, and the node
+    * must have been given its first pointer by initializeRoot().
+    * @param key[IN] the key to append
+    * @param pid[IN] the PageId to append behind the key
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RC append(Key key, PageId pid);
+
+   /**
+    * Return whether the node is filled to fill % of the keys it holds.
+    * Only an insert into a node filled to 100% splits it. A node counts
+    * as filled only once it has 3 keys, so that bulkLoad() may take the
+    * last one back for the next node and still leave it two.
+    * @param fill[IN] the % of the node, 1 to 100
+    * @return true if the node is filled that far
+    */
+    bool isFull(int fill = 100) {
+        int max = (MAX_KEY_COUNT + 1) * fill / 100 - 1;
+        return getKeyCount() >= ((max > 3) ? max : 3);
+    }
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
@@ -166,7 +401,32 @@ class BTNonLeafNode {
     * @param pid[OUT] the pointer to the child node to follow.
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC locateChildPtr(int searchKey, PageId& pid);
+    RC locateChildPtr(Key searchKey, PageId& pid);
+
+   /**
+    * Copy the child-node pointers that follow the pointer pid in the node.
+    * @param pid[IN] a child-node pointer in the node
+    * @param next[OUT] the pointers following pid, in key order
+    * @param count[IN/OUT] the most pointers to copy; the number copied
+    * @return 0 if successful. RC_NO_SUCH_RECORD if pid is not in the node.
+    */
+    RC getNextChildPtrs(PageId pid, PageId* next, int& count);
+
+   /**
+    * Copy the child-node pointers that precede the pointer pid in the node.
+    * @param pid[IN] a child-node pointer in the node
+    * @param prev[OUT] the pointers preceding pid, in descending key order
+    * @param count[IN/OUT] the most pointers to copy; the number copied
+    * @return 0 if successful. RC_NO_SUCH_RECORD if pid is not in the node.
+    */
+    RC getPrevChildPtrs(PageId pid, PageId* prev, int& count);
+
+   /**
+    * Copy the keys and the child-node pointers of the node.
+    * @param keys[OUT] the getKeyCount() keys
+    * @param pids[OUT] the getKeyCount() + 1 pointers
+    */
+    void getEntries(Key* keys, PageId* pids);
 
    /**
     * Initialize the root node with (pid1, key, pid2).
@@ -175,7 +435,7 @@ class BTNonLeafNode {
     * @param pid2[IN] the PageId to insert behind the key
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC initializeRoot(PageId pid1, int key, PageId pid2);
+    RC initializeRoot(PageId pid1, Key key, PageId pid2);
 
    /**
     * Return the number of keys stored in the node.
@@ -190,6 +450,18 @@ class BTNonLeafNode {
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Pin the page pid of the PageFile pf in the buffer pool and use the
+    * cached frame as the content of the node, without copying it.
+    * The frame stays pinned until the next read() or pin(), or until the
+    * node is destroyed. Modifying the node first copies the frame into
+    * the node's own buffer, so a pinned frame is never changed.
+    * @param pid[IN] the PageId to pin
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC pin(PageId pid, const PageFile& pf);
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
@@ -206,8 +478,243 @@ class BTNonLeafNode {
     * The main memory buffer for loading the content of the disk page 
     * that contains the node.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char buffer[PageFile::PAGE_SIZE] __attribute__((aligned(64)));
     int keyCount;
+
+   /**
+    * The child-node pointers start right behind the keys. Pointer i
+    * leads to the keys smaller than key i.
+    */
+    static const int PID_OFFSET = MAX_KEY_COUNT * sizeof(Key);
+
+    Key* keys() { return (Key*) node; }
+    PageId* pids() { return (PageId*) (node + PID_OFFSET); }
+
+    int insertPosition(Key key, PageId left);
+
+   /**
+    * The content of the node: either buffer or a frame pinned by handle.
+    */
+    char* node;
+    PageHandle handle;
+
+    void detach();
 }; 
 
+/**
+ * The leaf node of an index with StringKey keys. The keys vary in length,
+ * so they are kept apart from the entries: an array of slots at the start
+ * of the page holds the RecordId of every entry and the offset of its
+ * key, and the keys, each a length byte followed by its bytes, are
+ * stacked from the end of the page down. The last 16 bytes of the page
+ * hold the bytes the keys take, and the previous-node pointer, the
+ * next-node pointer and the key count where the other leaves have them.
+ * The methods are those of BasicBTLeafNode.
+ */
+template <>
+class BasicBTLeafNode<StringKey> {
+  public:
+   /**
+    * How many entries with empty keys fit in a leaf. Longer keys fit
+    * fewer; isFull() tells when there is no room for another one.
+    */
+    static const int MAX_KEY_COUNT =
+        (PageFile::PAGE_SIZE - 16) / (sizeof(RecordId) + sizeof(unsigned short) + 1);
+
+    BasicBTLeafNode() {
+        memset(buffer, 0, PageFile::PAGE_SIZE);
+        node = buffer;
+    }
+
+    void printNode();
+
+    RC insert(const StringKey& key, const RecordId& rid, bool duplicates = false);
+
+   /**
+    * As for other keys, but the entries are split where each node gets
+    * about half of the bytes, and siblingKey is the shortest key that
+    * parts the two nodes, as separatorKey() makes it.
+    */
+    RC insertAndSplit(const StringKey& key, const RecordId& rid, BasicBTLeafNode& sibling,
+                      StringKey& siblingKey, bool duplicates = false);
+
+    RC append(const StringKey& key, const RecordId& rid);
+
+   /**
+    * Return whether the node is filled to fill % of the bytes it has
+    * room for while it can still take a key of the longest length.
+    * @param fill[IN] the % of the node, 1 to 100
+    * @return true if the node is filled that far
+    */
+    bool isFull(int fill = 100) {
+        return getUsedBytes() >= (CAPACITY - MAX_ENTRY) * fill / 100;
+    }
+
+    RC locate(const StringKey& searchKey, int& eid);
+    RC locateLast(const StringKey& searchKey, int& eid);
+    RC readEntry(int eid, StringKey& key, RecordId& rid);
+    int readEntries(int eid, StringKey* keys, RecordId* rids, int max);
+    int readEntriesBackward(int eid, StringKey* keys, RecordId* rids, int max);
+
+    PageId getNextNodePtr();
+    RC setNextNodePtr(PageId pid);
+    PageId getPrevNodePtr();
+    RC setPrevNodePtr(PageId pid);
+    int getKeyCount();
+
+    RC read(PageId pid, const PageFile& pf);
+    RC pin(PageId pid, const PageFile& pf);
+    void release();
+    RC write(PageId pid, PageFile& pf);
+
+   /**
+    * Set the key count to n. A count of 0 empties the node; a smaller
+    * one drops the entries behind the first n.
+    */
+    void setKeyCount(int n);
+
+  private:
+    char buffer[PageFile::PAGE_SIZE] __attribute__((aligned(64)));
+
+   /**
+    * A slot is the RecordId of an entry and the offset of its key.
+    */
+    static const int SLOT_SIZE = sizeof(RecordId) + sizeof(unsigned short);
+
+   /**
+    * The bytes of the page for slots and keys, and those an entry with
+    * a key of the longest length takes.
+    */
+    static const int CAPACITY = PageFile::PAGE_SIZE - 16;
+    static const int MAX_ENTRY = SLOT_SIZE + 1 + StringKey::MAX_LENGTH;
+
+    int getKeyBytes();
+    void setKeyBytes(int n);
+    int getUsedBytes() { return getKeyCount() * SLOT_SIZE + getKeyBytes(); }
+
+    const char* keyAt(int eid);
+    int compareKey(int eid, const StringKey& key);
+    int search(const StringKey& key, bool upper);
+    void getKey(int eid, StringKey& key);
+    void putEntry(int eid, const StringKey& key, const RecordId& rid);
+
+   /**
+    * The content of the node: either buffer or a frame pinned by handle.
+    */
+    char* node;
+    PageHandle handle;
+
+    void detach();
+};
+
+
+/**
+ * The non-leaf node of an index with StringKey keys. The first child-node
+ * pointer is at the start of the page, followed by an array of slots, one
+ * for each key: the pointer that follows the key and the offset of the
+ * key. The keys, each a length byte followed by its bytes, are stacked
+ * from the end of the page down, and the last 8 bytes of the page hold
+ * the bytes the keys take and the key count. The keys are separators made
+ * by separatorKey(), mostly a few bytes long, so a node holds many more
+ * of them than keys of the longest length. The methods are those of
+ * BasicBTNonLeafNode.
+ */
+template <>
+class BasicBTNonLeafNode<StringKey> {
+  public:
+   /**
+    * How many empty keys fit in a nonleaf node. Longer keys fit fewer;
+    * isFull() tells when there is no room for another one.
+    */
+    static const int MAX_KEY_COUNT =
+        (PageFile::PAGE_SIZE - 8 - sizeof(PageId)) / (sizeof(PageId) + sizeof(unsigned short) + 1);
+
+    BasicBTNonLeafNode() {
+        memset(buffer, 0, PageFile::PAGE_SIZE);
+        node = buffer;
+    }
+
+    void printNode();
+
+    RC insert(const StringKey& key, PageId pid, PageId left = -1);
+
+   /**
+    * As for other keys, but the key moved up to the parent is the one
+    * where each node gets about half of the bytes.
+    */
+    RC insertAndSplit(const StringKey& key, PageId pid, BasicBTNonLeafNode& sibling,
+                      StringKey& midKey, PageId left = -1);
+
+    RC append(const StringKey& key, PageId pid);
+
+   /**
+    * Return whether the node is filled to fill % of the bytes it has
+    * room for while it can still take a key of the longest length. As
+    * with other keys, a node counts as filled only once it has 3 keys.
+    * @param fill[IN] the % of the node, 1 to 100
+    * @return true if the node is filled that far
+    */
+    bool isFull(int fill = 100) {
+        return getKeyCount() >= 3 &&
+               getUsedBytes() >= (CAPACITY - MAX_ENTRY) * fill / 100;
+    }
+
+    RC locateChildPtr(const StringKey& searchKey, PageId& pid);
+    RC getNextChildPtrs(PageId pid, PageId* next, int& count);
+    RC getPrevChildPtrs(PageId pid, PageId* prev, int& count);
+    void getEntries(StringKey* keys, PageId* pids);
+    RC initializeRoot(PageId pid1, const StringKey& key, PageId pid2);
+    int getKeyCount();
+
+    RC read(PageId pid, const PageFile& pf);
+    RC pin(PageId pid, const PageFile& pf);
+    RC write(PageId pid, PageFile& pf);
+
+   /**
+    * Set the key count to n. A count of 0 empties the node; a smaller
+    * one drops the keys behind the first n and the pointers behind them.
+    */
+    void setKeyCount(int n);
+    RC getFirstPage(PageId& pid);
+
+  private:
+    char buffer[PageFile::PAGE_SIZE] __attribute__((aligned(64)));
+
+   /**
+    * A slot is the child-node pointer behind a key and the offset of the
+    * key. The slots start behind the first pointer.
+    */
+    static const int SLOT_SIZE = sizeof(PageId) + sizeof(unsigned short);
+
+   /**
+    * The bytes of the page for slots and keys, and those a key of the
+    * longest length takes with its slot.
+    */
+    static const int CAPACITY = PageFile::PAGE_SIZE - 8 - sizeof(PageId);
+    static const int MAX_ENTRY = SLOT_SIZE + 1 + StringKey::MAX_LENGTH;
+
+    int getKeyBytes();
+    void setKeyBytes(int n);
+    int getUsedBytes() { return getKeyCount() * SLOT_SIZE + getKeyBytes(); }
+
+    PageId getPid(int i);
+    const char* keyAt(int i);
+    int compareKey(int i, const StringKey& key);
+    int search(const StringKey& key, bool upper);
+    void getKey(int i, StringKey& key);
+    void putEntry(int i, const StringKey& key, PageId pid);
+    int insertPosition(const StringKey& key, PageId left);
+
+   /**
+    * The content of the node: either buffer or a frame pinned by handle.
+    */
+    char* node;
+    PageHandle handle;
+
+    void detach();
+};
+
+typedef BasicBTLeafNode<int> BTLeafNode;
+typedef BasicBTNonLeafNode<int> BTNonLeafNode;
+
 #endif /* BTREENODE_H */
@@ -26,5 +26,10 @@ const int RC_INVALID_CURSOR      = -1011;
 const int RC_NO_SUCH_RECORD      = -1012;
 const int RC_END_OF_TREE         = -1013;
 const int RC_INVALID_ATTRIBUTE   = -1014;
+const int RC_OUT_OF_MEMORY       = -1015;
+const int RC_NO_FREE_FRAME       = -1016;
+const int RC_END_OF_FILE         = -1017;
+const int RC_NOT_SORTED          = -1018;
+const int RC_DUPLICATE_KEY       = -1019;
 
 #endif // BRUINBASE_H
@@ -0,0 +1,547 @@
+#include "BufferPool.h"
+#include "IOStats.h"
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <sched.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using std::vector;
+
+// the longest run of pages written by one pwritev() call
+#ifdef IOV_MAX
+static const int MAX_RUN = IOV_MAX;
+#else
+static const int MAX_RUN = 1024;
+#endif
+
+BufferRing::BufferRing(int frameCount)
+{
+  size = frameCount / 8;
+  if (size > MAX_FRAMES) size = MAX_FRAMES;
+  if (size < 2) size = 2;
+  for (int i = 0; i < MAX_FRAMES; i++) slots[i] = -1;
+  next = 0;
+}
+
+BufferPool::BufferPool(int count)
+{
+  frameCount = 0;
+  frames = NULL;
+  data = NULL;
+  buckets = NULL;
+  bucketMask = 0;
+  clockHand = 0;
+  priorityCount = 0;
+  for (int i = 0; i < SHARD_COUNT; i++) pthread_mutex_init(&shards[i], NULL);
+
+  if (count > 0) resize(count);
+}
+
+BufferPool::~BufferPool()
+{
+  flushAll();
+  release();
+  for (int i = 0; i < SHARD_COUNT; i++) pthread_mutex_destroy(&shards[i]);
+}
+
+void BufferPool::release()
+{
+  for (int i = 0; i < frameCount; i++) {
+    pthread_mutex_destroy(&frames[i].mutex);
+    pthread_rwlock_destroy(&frames[i].latch);
+  }
+  delete [] frames;
+  free(data);
+  delete [] buckets;
+  frames = NULL;
+  data = NULL;
+  buckets = NULL;
+  frameCount = 0;
+  bucketMask = 0;
+  clockHand = 0;
+  priorityCount = 0;
+}
+
+RC BufferPool::resize(int count)
+{
+  RC    rc;
+  int   nbuckets;
+  void* mem;
+
+  if (count < MIN_FRAME_COUNT) count = MIN_FRAME_COUNT;
+
+  // the memory of pinned frames is still in use
+  for (int i = 0; i < frameCount; i++) {
+    if (frames[i].pinCount > 0) return RC_NO_FREE_FRAME;
+  }
+
+  // do not lose the pages that were not written yet
+  if ((rc = flushAll()) < 0) return rc;
+  release();
+
+  // use about two buckets per frame to keep the hash chains short,
+  // and at least one bucket per shard
+  for (nbuckets = SHARD_COUNT; nbuckets < 2 * count; nbuckets <<= 1);
+
+  frames = new (std::nothrow) Frame[count];
+  buckets = new (std::nothrow) int[nbuckets];
+  if (posix_memalign(&mem, FRAME_ALIGNMENT, (size_t)count * PageFile::PAGE_SIZE) == 0) {
+    data = (char*)mem;
+  }
+  if (frames == NULL || data == NULL || buckets == NULL) {
+    release();
+    return RC_OUT_OF_MEMORY;
+  }
+
+  for (int i = 0; i < count; i++) {
+    frames[i].fd = -1;
+    frames[i].pid = -1;
+    frames[i].usage = 0;
+    frames[i].pinCount = 0;
+    frames[i].dirty = false;
+    frames[i].valid = false;
+    frames[i].priority = false;
+    frames[i].next = -1;
+    pthread_mutex_init(&frames[i].mutex, NULL);
+    pthread_rwlock_init(&frames[i].latch, NULL);
+  }
+  for (int i = 0; i < nbuckets; i++) buckets[i] = -1;
+
+  frameCount = count;
+  bucketMask = nbuckets - 1;
+  return 0;
+}
+
+int BufferPool::bucketOf(int fd, PageId pid) const
+{
+  // multiplicative hashing of the (fd, pid) pair
+  unsigned h = (unsigned)pid * 2654435761u ^ (unsigned)fd * 40503u;
+  return (int)((h ^ (h >> 16)) & bucketMask);
+}
+
+int BufferPool::pinCached(int fd, PageId pid, bool onlyDirty, bool touch)
+{
+  int b = bucketOf(fd, pid);
+  int f, found = -1;
+
+  pthread_mutex_lock(shardOf(b));
+  for (f = buckets[b]; f >= 0; f = frames[f].next) {
+    if (frames[f].fd != fd || frames[f].pid != pid) continue;
+
+    pthread_mutex_lock(&frames[f].mutex);
+    if (!onlyDirty || frames[f].dirty) {
+      frames[f].pinCount++;
+      if (touch && frames[f].usage < MAX_USAGE) frames[f].usage++;
+      found = f;
+    }
+    pthread_mutex_unlock(&frames[f].mutex);
+    break;
+  }
+  pthread_mutex_unlock(shardOf(b));
+
+  return found;
+}
+
+int BufferPool::claimVictim(BufferRing* ring)
+{
+  unsigned slot;
+  int f;
+
+  if (ring == NULL) return sweep();
+
+  // recycle the frame in the next slot of the ring unless it is in use,
+  // was accessed by somebody else than the scan, or was prioritized
+  slot = __sync_fetch_and_add(&ring->next, 1) % (unsigned)ring->size;
+  f = __atomic_load_n(&ring->slots[slot], __ATOMIC_RELAXED);
+  if (f >= 0 && f < frameCount) {
+    pthread_mutex_lock(&frames[f].mutex);
+    if (frames[f].pinCount == 0 && frames[f].usage <= 1 && !frames[f].priority) {
+      frames[f].pinCount = 1;
+      pthread_mutex_unlock(&frames[f].mutex);
+      return f;
+    }
+    pthread_mutex_unlock(&frames[f].mutex);
+  }
+
+  // otherwise put a frame of the pool into the slot
+  if ((f = sweep()) >= 0) __atomic_store_n(&ring->slots[slot], f, __ATOMIC_RELAXED);
+  return f;
+}
+
+int BufferPool::sweep()
+{
+  int f;
+
+  // sweep the clock hand until we find an empty frame or an unpinned
+  // frame whose usage count has dropped to zero. every full sweep
+  // decrements all usage counts except those of priority pages, so if
+  // nothing is found within MAX_USAGE + 1 sweeps, every frame is pinned
+  // or holds a priority page. the victim is claimed by pinning it.
+  for (int steps = 0; steps <= (MAX_USAGE + 1) * frameCount; steps++) {
+    f = (int)(__sync_fetch_and_add(&clockHand, 1) % (unsigned)frameCount);
+
+    pthread_mutex_lock(&frames[f].mutex);
+    if (frames[f].pinCount == 0) {
+      if (frames[f].fd < 0 || frames[f].usage == 0) {
+        frames[f].pinCount = 1;
+        pthread_mutex_unlock(&frames[f].mutex);
+        return f;
+      }
+      if (!frames[f].priority) frames[f].usage--;
+    }
+    pthread_mutex_unlock(&frames[f].mutex);
+  }
+
+  // give up a priority page rather than fail
+  for (int steps = 0; steps < frameCount; steps++) {
+    f = (int)(__sync_fetch_and_add(&clockHand, 1) % (unsigned)frameCount);
+
+    pthread_mutex_lock(&frames[f].mutex);
+    if (frames[f].pinCount == 0) {
+      frames[f].pinCount = 1;
+      pthread_mutex_unlock(&frames[f].mutex);
+      return f;
+    }
+    pthread_mutex_unlock(&frames[f].mutex);
+  }
+
+  return -1;
+}
+
+void BufferPool::unlink(int f)
+{
+  int* link = &buckets[bucketOf(frames[f].fd, frames[f].pid)];
+
+  // walk the chain to the link pointing at f and bypass it.
+  // the caller holds the shard mutex and the frame mutex.
+  while (*link != f) link = &frames[*link].next;
+  *link = frames[f].next;
+
+  frames[f].fd = -1;
+  frames[f].pid = -1;
+  frames[f].usage = 0;
+  frames[f].dirty = false;
+  frames[f].valid = false;
+  frames[f].next = -1;
+  if (frames[f].priority) {
+    frames[f].priority = false;
+    __sync_fetch_and_sub(&priorityCount, 1);
+  }
+}
+
+int BufferPool::pinPage(int fd, PageId pid, bool& isNew, BufferRing* ring)
+{
+  int    f, v, b, vfd;
+  PageId vpid;
+  bool   vdirty, busy;
+
+  isNew = false;
+  if (frameCount == 0) return -1;
+
+  // a victim may be pinned by another thread before we evict it,
+  // in which case we look for another one
+  for (int tries = 0; tries < frameCount; tries++) {
+    if ((f = pinCached(fd, pid, false, ring == NULL)) >= 0) return f;
+
+    if ((v = claimVictim(ring)) < 0) return -1;
+
+    pthread_mutex_lock(&frames[v].mutex);
+    vfd = frames[v].fd;
+    vpid = frames[v].pid;
+    vdirty = frames[v].dirty;
+    pthread_mutex_unlock(&frames[v].mutex);
+
+    if (vfd >= 0) {
+      // a victim that cannot be written back stays in the pool
+      if (vdirty && writeBack(v) < 0) {
+        unpin(v);
+        continue;
+      }
+
+      // drop the old page unless it was pinned or modified meanwhile
+      b = bucketOf(vfd, vpid);
+      pthread_mutex_lock(shardOf(b));
+      pthread_mutex_lock(&frames[v].mutex);
+      busy = frames[v].pinCount > 1 || frames[v].dirty;
+      if (busy) frames[v].pinCount--;
+      else unlink(v);
+      pthread_mutex_unlock(&frames[v].mutex);
+      pthread_mutex_unlock(shardOf(b));
+      if (busy) continue;
+      IOStats::count(vfd, &IOStats::evictions);
+    }
+
+    // the victim is now pinned by us only and cannot be found by others,
+    // so its latch is free. link it at the head of the chain for
+    // (fd, pid) unless another thread loaded the page in the meantime.
+    if (pthread_rwlock_trywrlock(&frames[v].latch) != 0) {
+      unpin(v);
+      continue;
+    }
+    b = bucketOf(fd, pid);
+    pthread_mutex_lock(shardOf(b));
+    for (f = buckets[b]; f >= 0; f = frames[f].next) {
+      if (frames[f].fd == fd && frames[f].pid == pid) break;
+    }
+    if (f >= 0) {
+      pthread_mutex_lock(&frames[f].mutex);
+      frames[f].pinCount++;
+      if (ring == NULL && frames[f].usage < MAX_USAGE) frames[f].usage++;
+      pthread_mutex_unlock(&frames[f].mutex);
+    } else {
+      pthread_mutex_lock(&frames[v].mutex);
+      frames[v].fd = fd;
+      frames[v].pid = pid;
+      frames[v].usage = 1;
+      frames[v].dirty = false;
+      frames[v].valid = false;
+      frames[v].next = buckets[b];
+      pthread_mutex_unlock(&frames[v].mutex);
+      buckets[b] = v;
+    }
+    pthread_mutex_unlock(shardOf(b));
+
+    if (f >= 0) {
+      unlatch(v);
+      unpin(v);
+      return f;
+    }
+    isNew = true;
+    return v;
+  }
+
+  return -1;
+}
+
+void BufferPool::finishLoad(int f, bool ok)
+{
+  int b;
+
+  if (ok) {
+    pthread_mutex_lock(&frames[f].mutex);
+    frames[f].valid = true;
+    pthread_mutex_unlock(&frames[f].mutex);
+  } else {
+    // the frame is pinned, so nobody else changes its page
+    b = bucketOf(frames[f].fd, frames[f].pid);
+    pthread_mutex_lock(shardOf(b));
+    pthread_mutex_lock(&frames[f].mutex);
+    unlink(f);
+    pthread_mutex_unlock(&frames[f].mutex);
+    pthread_mutex_unlock(shardOf(b));
+  }
+
+  unlatch(f);
+}
+
+void BufferPool::unpin(int f)
+{
+  pthread_mutex_lock(&frames[f].mutex);
+  frames[f].pinCount--;
+  pthread_mutex_unlock(&frames[f].mutex);
+}
+
+bool BufferPool::latch(int f, bool exclusive)
+{
+  bool valid;
+
+  if (exclusive) pthread_rwlock_wrlock(&frames[f].latch);
+  else pthread_rwlock_rdlock(&frames[f].latch);
+
+  pthread_mutex_lock(&frames[f].mutex);
+  valid = frames[f].valid;
+  pthread_mutex_unlock(&frames[f].mutex);
+
+  return valid;
+}
+
+void BufferPool::prioritize(int f)
+{
+  pthread_mutex_lock(&frames[f].mutex);
+  if (!frames[f].priority && frames[f].fd >= 0) {
+    // reserve a place among the priority pages, or give it back
+    if (__sync_add_and_fetch(&priorityCount, 1) <= frameCount / PRIORITY_SHARE) {
+      frames[f].priority = true;
+    } else {
+      __sync_fetch_and_sub(&priorityCount, 1);
+    }
+  }
+  pthread_mutex_unlock(&frames[f].mutex);
+}
+
+void BufferPool::markDirty(int f)
+{
+  pthread_mutex_lock(&frames[f].mutex);
+  frames[f].dirty = true;
+  pthread_mutex_unlock(&frames[f].mutex);
+}
+
+RC BufferPool::writeBack(int f)
+{
+  int    fd = frames[f].fd;
+  PageId pid = frames[f].pid;
+  int    below[MAX_RUN / 2], run[MAX_RUN];
+  int    g, nbelow, n;
+  RC     rc;
+
+  // whoever holds the latch of the victim may be waiting for us;
+  // give up on the victim rather than wait
+  if (pthread_rwlock_tryrdlock(&frames[f].latch) != 0) return RC_FILE_WRITE_FAILED;
+
+  // extend the run to the dirty pages right before and after page f
+  // so that they are written by the same call. a neighbour is pinned
+  // and latched for reading so that it is not modified while we write it.
+  for (nbelow = 0; pid - nbelow > 0 && nbelow < MAX_RUN / 2; nbelow++) {
+    if ((g = pinCached(fd, pid - nbelow - 1, true, false)) < 0) break;
+    if (pthread_rwlock_tryrdlock(&frames[g].latch) != 0) { unpin(g); break; }
+    below[nbelow] = g;
+  }
+  for (n = 0; n < nbelow; n++) run[n] = below[nbelow - 1 - n];
+  run[n++] = f;
+  for (; n < MAX_RUN; n++) {
+    if ((g = pinCached(fd, pid - nbelow + n, true, false)) < 0) break;
+    if (pthread_rwlock_tryrdlock(&frames[g].latch) != 0) { unpin(g); break; }
+    run[n] = g;
+  }
+
+  rc = writeFrames(run, n);
+
+  for (int i = 0; i < n; i++) {
+    unlatch(run[i]);
+    if (run[i] != f) unpin(run[i]);
+  }
+  return rc;
+}
+
+RC BufferPool::writeFrames(int* list, int n)
+{
+  struct iovec iov[MAX_RUN];
+  off_t   offset;
+  ssize_t written;
+  int     i, cnt;
+  long long start;
+
+  // list[] holds latched frames of consecutive pages of one file
+  for (i = 0; i < n; i++) {
+    iov[i].iov_base = frameData(list[i]);
+    iov[i].iov_len = PageFile::PAGE_SIZE;
+  }
+  offset = (off_t)frames[list[0]].pid * PageFile::PAGE_SIZE;
+  start = IOStats::now();
+
+  // pwritev() may write less than asked for; continue where it stopped
+  for (i = 0, cnt = n; cnt > 0; ) {
+    written = ::pwritev(frames[list[0]].fd, iov + i, cnt, offset);
+    if (written <= 0) return RC_FILE_WRITE_FAILED;
+    offset += written;
+    while (cnt > 0 && written >= (ssize_t)iov[i].iov_len) {
+      written -= iov[i].iov_len;
+      i++;
+      cnt--;
+    }
+    if (cnt > 0 && written > 0) {
+      iov[i].iov_base = (char*)iov[i].iov_base + written;
+      iov[i].iov_len -= written;
+    }
+  }
+
+  // the frames could not be modified while we held their latches
+  for (i = 0; i < n; i++) {
+    pthread_mutex_lock(&frames[list[i]].mutex);
+    frames[list[i]].dirty = false;
+    pthread_mutex_unlock(&frames[list[i]].mutex);
+  }
+  __sync_fetch_and_add(&PageFile::writeCount, n);
+  IOStats::call(frames[list[0]].fd, IOStats::WRITE, n, start);
+
+  return 0;
+}
+
+// orders frame numbers by the (fd, pid) of the pages they hold
+struct BufferPool::FrameOrder {
+  const Frame* frames;
+  FrameOrder(const Frame* f) : frames(f) {}
+  bool operator() (int a, int b) const {
+    if (frames[a].fd != frames[b].fd) return frames[a].fd < frames[b].fd;
+    return frames[a].pid < frames[b].pid;
+  }
+};
+
+RC BufferPool::flushFile(int fd)
+{
+  RC rc = 0;
+  vector<int> dirty;
+  size_t i, j;
+
+  // collect and pin the dirty frames, sort them by page and write each
+  // run of consecutive pages with a single call
+  for (int f = 0; f < frameCount; f++) {
+    pthread_mutex_lock(&frames[f].mutex);
+    if (frames[f].dirty && (fd < 0 || frames[f].fd == fd)) {
+      frames[f].pinCount++;
+      dirty.push_back(f);
+    }
+    pthread_mutex_unlock(&frames[f].mutex);
+  }
+  std::sort(dirty.begin(), dirty.end(), FrameOrder(frames));
+
+  for (i = 0; i < dirty.size(); i = j) {
+    // wait only for the first latch of a run; the run is cut short
+    // at a frame somebody else has latched for writing
+    pthread_rwlock_rdlock(&frames[dirty[i]].latch);
+    for (j = i + 1; j < dirty.size() && (int)(j - i) < MAX_RUN; j++) {
+      if (frames[dirty[j]].fd != frames[dirty[i]].fd) break;
+      if (frames[dirty[j]].pid != frames[dirty[i]].pid + (PageId)(j - i)) break;
+      if (pthread_rwlock_tryrdlock(&frames[dirty[j]].latch) != 0) break;
+    }
+    RC err = writeFrames(&dirty[i], (int)(j - i));
+    if (err < 0) rc = err;
+    for (size_t k = i; k < j; k++) {
+      unlatch(dirty[k]);
+      unpin(dirty[k]);
+    }
+  }
+
+  return rc;
+}
+
+RC BufferPool::flushAll()
+{
+  return flushFile(-1);
+}
+
+void BufferPool::discardFile(int fd)
+{
+  int    b, ffd;
+  PageId fpid;
+  bool   pinned, done;
+
+  for (int f = 0; f < frameCount; f++) {
+    for (done = false; !done; ) {
+      pthread_mutex_lock(&frames[f].mutex);
+      ffd = frames[f].fd;
+      fpid = frames[f].pid;
+      pinned = frames[f].pinCount > 0;
+      pthread_mutex_unlock(&frames[f].mutex);
+      if (ffd != fd) break;
+
+      // the pages of a closed file are pinned only by threads that
+      // are evicting them; wait until they are done
+      if (pinned) { sched_yield(); continue; }
+
+      b = bucketOf(ffd, fpid);
+      pthread_mutex_lock(shardOf(b));
+      pthread_mutex_lock(&frames[f].mutex);
+      if (frames[f].fd == ffd && frames[f].pid == fpid && frames[f].pinCount == 0) {
+        unlink(f);
+        done = true;
+      }
+      pthread_mutex_unlock(&frames[f].mutex);
+      pthread_mutex_unlock(shardOf(b));
+    }
+  }
+}
@@ -0,0 +1,222 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <cstddef>
+#include <pthread.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * A small set of frames that a scan recycles for the pages it reads.
+ * The ring hands its own frames out again before it takes new ones from
+ * the pool, and pages read through a ring do not count as accessed for
+ * the CLOCK policy, so a pass over a large file displaces at most
+ * getSize() pages of other files instead of the whole pool.
+ */
+class BufferRing {
+ public:
+  static const int MAX_FRAMES = 64;  // largest ring we allow
+
+  /**
+   * @param frameCount[IN] the number of frames in the pool; the ring
+   *        takes an eighth of them, up to MAX_FRAMES
+   */
+  BufferRing(int frameCount);
+
+  /**
+   * @return the number of frames the ring recycles
+   */
+  int getSize() const { return size; }
+
+ private:
+  friend class BufferPool;
+
+  int      size;               // # of slots in use
+  int      slots[MAX_FRAMES];  // frame of each slot, -1 if not taken yet
+  unsigned next;               // next slot to recycle (atomic)
+};
+
+/**
+ * A fixed number of page-sized frames shared by every open PageFile.
+ * Frames are found through a hash table keyed on (fd, pid) and replaced
+ * with the CLOCK policy: every frame has a small usage count that is
+ * bumped on each access and decremented by the sweeping clock hand, so
+ * a page must go unreferenced for several sweeps before it is evicted.
+ *
+ * Frames may be dirty, i.e., newer than the disk page. A dirty page is
+ * written back when it is evicted or flushed; runs of dirty pages with
+ * consecutive page ids in the same file go out in one pwritev() call.
+ *
+ * The pool may be used by several threads at once. The hash table is
+ * split into SHARD_COUNT shards with a mutex each, the descriptor of every
+ * frame has its own mutex, and the page content of every frame is guarded
+ * by a reader/writer latch. A frame is pinned before it is latched, and
+ * the pool never waits for a latch while holding a mutex or another
+ * latch. Only resize() requires that no other thread uses the pool.
+ */
+class BufferPool {
+ public:
+
+  static const int MAX_USAGE = 5;        // cap of the per-frame usage count
+  static const int MIN_FRAME_COUNT = 16; // smallest pool we allow
+  static const int SHARD_COUNT = 64;     // # of mutexes over the hash table
+
+  // at most 1/PRIORITY_SHARE of the frames may hold priority pages
+  static const int PRIORITY_SHARE = 4;
+
+  // alignment of the frame memory. frames are aligned to the smaller of
+  // this and PAGE_SIZE, which is enough for files opened with O_DIRECT.
+  static const int FRAME_ALIGNMENT = 4096;
+
+  BufferPool(int frameCount = 0);
+  ~BufferPool();
+
+  /**
+   * (re)allocate the pool with the given number of frames.
+   * dirty pages are written back and all cached pages are dropped.
+   * fails if any frame is pinned. this function is not thread-safe.
+   * @param frameCount[IN] the number of page frames in the pool
+   * @return error code. 0 if no error
+   */
+  RC resize(int frameCount);
+
+  /**
+   * @return the number of frames in the pool
+   */
+  int getFrameCount() const { return frameCount; }
+
+  /**
+   * pin the frame caching page pid of the file fd.
+   * if the page is not cached, a victim frame is picked with the CLOCK
+   * policy and assigned to the page. a dirty victim is written back
+   * first, together with the dirty pages adjacent to it. in that case
+   * isNew is set, the content of the frame is undefined, and the frame
+   * is returned exclusively latched; the caller fills it and calls
+   * finishLoad(). a successful lookup counts as an access for the
+   * replacement policy, unless the page is pinned through a ring; then
+   * the victim is picked among the frames of the ring first.
+   * @param fd[IN] file descriptor of the file
+   * @param pid[IN] page id in the file
+   * @param isNew[OUT] whether the page was not cached
+   * @param ring[IN] the ring of a scan, or NULL
+   * @return frame number, or -1 if every frame is pinned
+   */
+  int pinPage(int fd, PageId pid, bool& isNew, BufferRing* ring = NULL);
+
+  /**
+   * finish loading a frame returned by pinPage() with isNew set and
+   * release its latch. the frame stays pinned. if the page could not be
+   * loaded, it is dropped from the pool and other threads waiting for it
+   * find it invalid.
+   * @param f[IN] the frame that was loaded
+   * @param ok[IN] whether the page was loaded successfully
+   */
+  void finishLoad(int f, bool ok);
+
+  /**
+   * undo one pin of frame f.
+   */
+  void unpin(int f);
+
+  /**
+   * latch the content of a pinned frame f.
+   * @param f[IN] the frame to latch
+   * @param exclusive[IN] true to latch for writing, false for reading
+   * @return false if the frame was dropped because its page could not be
+   *         loaded; the latch is held either way.
+   */
+  bool latch(int f, bool exclusive);
+
+  /**
+   * release the latch of frame f.
+   */
+  void unlatch(int f) { pthread_rwlock_unlock(&frames[f].latch); }
+
+  /**
+   * keep the page in pinned frame f in the pool in preference to other
+   * pages, e.g., because it is an inner node of an index. the CLOCK
+   * sweep passes over priority pages and evicts them only when nothing
+   * else can be evicted. once 1/PRIORITY_SHARE of the pool holds priority
+   * pages, further requests are ignored.
+   */
+  void prioritize(int f);
+
+  /**
+   * note that frame f is newer than its disk page.
+   * the frame must be exclusively latched.
+   */
+  void markDirty(int f);
+
+  /**
+   * write back every dirty page of file fd.
+   * @param fd[IN] file descriptor of the file
+   * @return error code. 0 if no error
+   */
+  RC flushFile(int fd);
+
+  /**
+   * write back every dirty page in the pool.
+   * @return error code. 0 if no error
+   */
+  RC flushAll();
+
+  /**
+   * drop every cached page of file fd.
+   * dirty pages are dropped without being written back.
+   * no page of the file may be pinned.
+   */
+  void discardFile(int fd);
+
+  /**
+   * @return pointer to the PAGE_SIZE bytes of frame f
+   */
+  char* frameData(int f) { return data + (size_t)f * PageFile::PAGE_SIZE; }
+
+ private:
+  struct Frame {
+    // fd, pid and next change only while both the frame mutex and
+    // the mutex of the shard the frame is linked into are held.
+    // the other fields are guarded by the frame mutex.
+    int    fd;      // file of the cached page (-1 if the frame is empty)
+    PageId pid;     // page id of the cached page
+    int    usage;   // CLOCK usage count
+    int    pinCount; // # of outstanding pins; pinned frames are not evicted
+    bool   dirty;   // whether the frame is newer than the disk page
+    bool   valid;   // whether the frame holds the content of its page
+    bool   priority; // whether the page was prioritized
+    int    next;    // next frame in the same hash chain (-1 at the end)
+
+    pthread_mutex_t  mutex; // guards the frame descriptor
+    pthread_rwlock_t latch; // guards the page content of the frame
+  };
+
+  struct FrameOrder;
+
+  int    frameCount;  // # of frames
+  Frame* frames;      // frame descriptors
+  char*  data;        // frameCount * PAGE_SIZE bytes of page data, aligned
+                      // to FRAME_ALIGNMENT
+  int*   buckets;     // hash buckets, each the head of a frame chain
+  int    bucketMask;  // (# buckets - 1); # buckets is a power of two
+  unsigned clockHand; // next frame examined by the CLOCK sweep (atomic)
+  int    priorityCount; // # of frames holding priority pages (atomic)
+
+  // bucket b of the hash table is guarded by shards[b % SHARD_COUNT]
+  pthread_mutex_t shards[SHARD_COUNT];
+
+  int  bucketOf(int fd, PageId pid) const;
+  pthread_mutex_t* shardOf(int bucket) { return &shards[bucket % SHARD_COUNT]; }
+  int  pinCached(int fd, PageId pid, bool onlyDirty, bool touch);
+  int  claimVictim(BufferRing* ring);
+  int  sweep();
+  void unlink(int f);
+  void release();
+  RC   writeBack(int f);
+  RC   writeFrames(int* list, int n);
+
+  // the pool owns raw memory; copying is not allowed
+  BufferPool(const BufferPool&);
+  BufferPool& operator=(const BufferPool&);
+};
+
+#endif // BUFFERPOOL_H
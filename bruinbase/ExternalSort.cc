@@ -0,0 +1,307 @@
+#include "ExternalSort.h"
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+// the smallest buffer of records, and the smallest buffer a run is read
+// through during the merge
+static const size_t MIN_BUFFER = 64 * 1024;
+static const size_t MIN_INPUT = 16 * 1024;
+
+ExternalSort::ExternalSort(size_t memory, int threads)
+{
+  Buffer* b;
+
+  if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1) threads = 1;
+  if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+  // every thread sorts a buffer of its own
+  capacity = memory / threads;
+  if (capacity < MIN_BUFFER) capacity = MIN_BUFFER;
+  for (int i = 0; i < threads; i++) {
+    b = new Buffer;
+    b->owner = this;
+    b->file = NULL;
+    b->busy = false;
+    b->rc = 0;
+    buffers.push_back(b);
+  }
+
+  filling = 0;
+  sorted = false;
+  last = -1;
+  item = 0;
+}
+
+ExternalSort::~ExternalSort()
+{
+  for (unsigned i = 0; i < buffers.size(); i++) {
+    wait(*buffers[i]);
+    delete buffers[i];
+  }
+  for (unsigned i = 0; i < runs.size(); i++) {
+    if (runs[i]->file != NULL) fclose(runs[i]->file);
+    delete runs[i];
+  }
+}
+
+RC ExternalSort::add(long long key, const void* data, int length, int prefix)
+{
+  RC      rc;
+  Buffer* b = buffers[filling];
+  Item    it;
+
+  if (sorted) return RC_INVALID_FILE_MODE;
+
+  // a full buffer is written to a run, and the next one is filled
+  // meanwhile, once its own run is written
+  if (!b->items.empty() &&
+      b->bytes.size() + (b->items.size() + 1) * sizeof(Item) + sizeof(int) + length > capacity) {
+    if ((rc = spill(*b)) < 0) return rc;
+    filling = (filling + 1) % buffers.size();
+    b = buffers[filling];
+    if ((rc = wait(*b)) < 0) return rc;
+  }
+
+  it.key = key;
+  it.offset = b->bytes.size();
+  it.prefix = (prefix < length) ? prefix : length;
+  b->items.push_back(it);
+  b->bytes.insert(b->bytes.end(), (const char*)&length, (const char*)&length + sizeof(int));
+  b->bytes.insert(b->bytes.end(), (const char*)data, (const char*)data + length);
+
+  return 0;
+}
+
+RC ExternalSort::sort()
+{
+  RC      rc = 0, err;
+  Buffer* b = buffers[filling];
+  size_t  size;
+  int     k;
+
+  if (sorted) return 0;
+  sorted = true;
+
+  // input that fits in a buffer is sorted where it is
+  if (runs.empty()) {
+    std::stable_sort(b->items.begin(), b->items.end(), ByKey(b->bytes.empty() ? NULL : &b->bytes[0]));
+    item = 0;
+    return 0;
+  }
+
+  // write out the last records and wait for every run
+  if (!b->items.empty()) rc = spill(*b);
+  for (unsigned i = 0; i < buffers.size(); i++) {
+    if ((err = wait(*buffers[i])) < 0 && rc == 0) rc = err;
+    std::vector<char>().swap(buffers[i]->bytes);
+    std::vector<Item>().swap(buffers[i]->items);
+  }
+  if (rc < 0) return rc;
+
+  // the memory of the buffers is shared by the runs being merged
+  size = capacity * buffers.size() / runs.size();
+  if (size < MIN_INPUT) size = MIN_INPUT;
+  for (unsigned i = 0; i < runs.size(); i++) {
+    if (fseek(runs[i]->file, 0, SEEK_SET) != 0) return RC_FILE_SEEK_FAILED;
+    runs[i]->input.resize(size);
+    runs[i]->pos = runs[i]->end = 0;
+    if ((rc = advance(*runs[i])) < 0) return rc;
+  }
+
+  // build the loser tree. its nodes start out holding k, a run that
+  // beats every other, which the real runs push out one by one.
+  k = runs.size();
+  tree.assign(k, k);
+  for (int i = k - 1; i >= 0; i--) adjust(i);
+  last = -1;
+
+  return 0;
+}
+
+RC ExternalSort::next(long long& key, const char*& data, int& length)
+{
+  RC      rc;
+  Buffer* b;
+  Run*    r;
+
+  if (!sorted && (rc = sort()) < 0) return rc;
+
+  // nothing was spilled: the records are in the buffer
+  if (runs.empty()) {
+    b = buffers[filling];
+    if (item >= b->items.size()) return RC_END_OF_FILE;
+    key = b->items[item].key;
+    memcpy(&length, &b->bytes[b->items[item].offset], sizeof(int));
+    data = &b->bytes[b->items[item].offset + sizeof(int)];
+    item++;
+    return 0;
+  }
+
+  // the run of the record returned last moves on to its next record,
+  // which then plays its way up the tree
+  if (last >= 0) {
+    if ((rc = advance(*runs[last])) < 0) return rc;
+    adjust(last);
+    last = -1;
+  }
+
+  r = runs[tree[0]];
+  if (r->done) return RC_END_OF_FILE;
+  key = r->key;
+  length = r->length;
+  data = r->data.empty() ? NULL : &r->data[0];
+  last = tree[0];
+
+  return 0;
+}
+
+RC ExternalSort::spill(Buffer& b)
+{
+  Run* r;
+
+  if ((b.file = tmpfile()) == NULL) return RC_FILE_OPEN_FAILED;
+  r = new Run;
+  r->file = b.file;
+  r->pos = r->end = 0;
+  r->done = false;
+  r->key = 0;
+  r->length = 0;
+  r->prefix = 0;
+  runs.push_back(r);
+
+  // the run is sorted in the background if there is another buffer to
+  // fill meanwhile, and right away if not or if no thread can be started
+  if (buffers.size() > 1 && pthread_create(&b.thread, NULL, sortRun, &b) == 0) {
+    b.busy = true;
+    return 0;
+  }
+  sortRun(&b);
+  return wait(b);
+}
+
+RC ExternalSort::wait(Buffer& b)
+{
+  RC rc;
+
+  if (b.busy) {
+    pthread_join(b.thread, NULL);
+    b.busy = false;
+  }
+  rc = b.rc;
+  b.rc = 0;
+  return rc;
+}
+
+void* ExternalSort::sortRun(void* self)
+{
+  Buffer* b = (Buffer*)self;
+
+  std::stable_sort(b->items.begin(), b->items.end(), ByKey(b->bytes.empty() ? NULL : &b->bytes[0]));
+  b->rc = write(*b, b->file);
+  b->items.clear();
+  b->bytes.clear();
+  return NULL;
+}
+
+RC ExternalSort::write(Buffer& b, FILE* file)
+{
+  int length;
+
+  // a record is its key, its prefix, its length and its bytes
+  for (unsigned i = 0; i < b.items.size(); i++) {
+    memcpy(&length, &b.bytes[b.items[i].offset], sizeof(int));
+    if (fwrite(&b.items[i].key, sizeof(long long), 1, file) != 1 ||
+        fwrite(&b.items[i].prefix, sizeof(int), 1, file) != 1 ||
+        fwrite(&b.bytes[b.items[i].offset], sizeof(int) + length, 1, file) != 1) {
+      return RC_FILE_WRITE_FAILED;
+    }
+  }
+  if (fflush(file) != 0) return RC_FILE_WRITE_FAILED;
+
+  return 0;
+}
+
+RC ExternalSort::advance(Run& r)
+{
+  size_t n;
+
+  if (r.done) return 0;
+
+  n = read(r, &r.key, sizeof(long long));
+  if (n == 0) {
+    r.done = true;
+    return ferror(r.file) ? RC_FILE_READ_FAILED : 0;
+  }
+  if (n < sizeof(long long) || read(r, &r.prefix, sizeof(int)) < sizeof(int) ||
+      read(r, &r.length, sizeof(int)) < sizeof(int)) return RC_FILE_READ_FAILED;
+  if (r.length < 0 || r.prefix < 0 || r.prefix > r.length) return RC_INVALID_FILE_FORMAT;
+
+  if ((int)r.data.size() < r.length) r.data.resize(r.length);
+  if (r.length > 0 && read(r, &r.data[0], r.length) < (size_t)r.length) return RC_FILE_READ_FAILED;
+
+  return 0;
+}
+
+size_t ExternalSort::read(Run& r, void* dst, size_t n)
+{
+  size_t got, count;
+
+  for (got = 0; got < n; got += count) {
+    if (r.pos == r.end) {
+      r.end = fread(&r.input[0], 1, r.input.size(), r.file);
+      r.pos = 0;
+      if (r.end == 0) break;
+    }
+    count = std::min(n - got, r.end - r.pos);
+    memcpy((char*)dst + got, &r.input[r.pos], count);
+    r.pos += count;
+  }
+
+  return got;
+}
+
+bool ExternalSort::beats(int a, int b) const
+{
+  int k = runs.size();
+
+  // a finished run loses to every run, and equal records go to the run
+  // written first, which keeps the sort stable
+  if (a == k) return true;
+  if (b == k) return false;
+  if (runs[a]->done) return false;
+  if (runs[b]->done) return true;
+
+  const Run& ra = *runs[a];
+  const Run& rb = *runs[b];
+  int diff = compare(ra.key, ra.data.empty() ? NULL : &ra.data[0], ra.prefix,
+                     rb.key, rb.data.empty() ? NULL : &rb.data[0], rb.prefix);
+  if (diff != 0) return diff < 0;
+  return a < b;
+}
+
+int ExternalSort::compare(long long keyA, const char* a, int prefixA,
+                          long long keyB, const char* b, int prefixB)
+{
+  int n = (prefixA < prefixB) ? prefixA : prefixB;
+  int diff;
+
+  // the prefixes are only compared when the keys are equal, byte by byte
+  // and then by length, as strings are
+  if (keyA != keyB) return (keyA < keyB) ? -1 : 1;
+  if (n > 0 && (diff = memcmp(a, b, n)) != 0) return diff;
+  return prefixA - prefixB;
+}
+
+void ExternalSort::adjust(int s)
+{
+  int k = runs.size();
+
+  // run s is leaf s + k of the tree. at every node on its way to the
+  // root the winner goes on up and the loser stays.
+  for (int t = (s + k) / 2; t > 0; t /= 2) {
+    if (beats(tree[t], s)) std::swap(s, tree[t]);
+  }
+  tree[0] = s;
+}
@@ -0,0 +1,143 @@
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <cstdio>
+#include <vector>
+#include <pthread.h>
+#include "Bruinbase.h"
+
+/**
+ * Sorts records by a 64-bit key within a memory budget. A record is a key
+ * and a string of bytes, such as the RecordId of an index entry or the
+ * value of a tuple.
+ *
+ * The records added are gathered in buffers that share the budget. When
+ * a buffer is full it is sorted and written to a temporary file, a run,
+ * by a thread of its own while the next buffer is filled, so that runs
+ * are sorted on several cores at once. sort() then merges the runs with
+ * a loser tree, which finds the next record with one comparison per
+ * level of the tree. Input that fits in one buffer is never written out.
+ *
+ * Records with the same key may also be ordered by a string at the start
+ * of their bytes, such as a value whose first bytes make up the key, so
+ * that the bytes are only compared where the keys cannot tell records
+ * apart. The sort is stable: records equal in both come out in the order
+ * they were added.
+ */
+class ExternalSort {
+ public:
+  static const size_t DEFAULT_MEMORY = 16 * 1024 * 1024;
+  static const int MAX_THREADS = 8;
+
+  /**
+   * @param memory[IN] the bytes the records may take in memory
+   * @param threads[IN] # of runs sorted at once; 0 for the # of cores
+   */
+  ExternalSort(size_t memory = DEFAULT_MEMORY, int threads = 0);
+  ~ExternalSort();
+
+  /**
+   * add a record. it may not be called after sort().
+   * @param key[IN] the key to sort by
+   * @param data[IN] the bytes of the record
+   * @param length[IN] # of bytes
+   * @param prefix[IN] # of bytes at the start of data that order the
+   *                   records with the same key, compared like strings
+   *                   of that length
+   * @return error code. 0 if no error
+   */
+  RC add(long long key, const void* data, int length, int prefix = 0);
+
+  /**
+   * sort the records added, so that next() returns them in key order.
+   * @return error code. 0 if no error
+   */
+  RC sort();
+
+  /**
+   * return the next record in key order.
+   * @param key[OUT] the key of the record
+   * @param data[OUT] the bytes of the record, valid until the next call
+   * @param length[OUT] # of bytes
+   * @return error code. RC_END_OF_FILE after the last record
+   */
+  RC next(long long& key, const char*& data, int& length);
+
+  /**
+   * @return # of runs written to temporary files
+   */
+  int getRunCount() const { return runs.size(); }
+
+ private:
+  // a record in a buffer: its key, where its bytes are, and how many
+  // of them order it after the key
+  struct Item {
+    long long key;
+    unsigned  offset;
+    int       prefix;
+  };
+
+  // the records gathered in memory, sorted and written to a run by a
+  // thread of its own
+  struct Buffer {
+    ExternalSort* owner;
+    std::vector<char> bytes;  // the length and bytes of every record
+    std::vector<Item> items;
+    FILE*     file;           // the run the buffer is written to
+    pthread_t thread;
+    bool      busy;           // whether the thread is running
+    RC        rc;             // the result of the thread
+  };
+
+  // a run being merged, with the record it is at
+  struct Run {
+    FILE* file;
+    std::vector<char> input;  // bytes read from the file
+    size_t pos, end;          // the unused bytes of input
+    bool  done;               // whether all of the records were taken
+    long long key;            // the current record
+    std::vector<char> data;
+    int   length;
+    int   prefix;
+  };
+
+  size_t capacity;            // the bytes of a buffer
+  std::vector<Buffer*> buffers;
+  int    filling;             // the buffer records are added to
+  std::vector<Run*> runs;
+  bool   sorted;
+
+  // the merge. tree[0] is the run with the next record; tree[1..k) hold
+  // the runs that lost at each node.
+  std::vector<int> tree;
+  int    last;                // the run to advance before the next record
+  size_t item;                // the next record when nothing was spilled
+
+  RC   spill(Buffer& b);
+  RC   wait(Buffer& b);
+  static void* sortRun(void* self);
+  static RC write(Buffer& b, FILE* file);
+  RC   advance(Run& r);
+  size_t read(Run& r, void* dst, size_t n);
+  bool beats(int a, int b) const;
+  void adjust(int s);
+
+  static int compare(long long keyA, const char* a, int prefixA,
+                     long long keyB, const char* b, int prefixB);
+
+  // orders the records of a buffer
+  struct ByKey {
+    const char* bytes;
+    ByKey(const char* bytes) : bytes(bytes) {}
+    bool operator()(const Item& a, const Item& b) const {
+      return compare(a.key, bytes + a.offset + sizeof(int), a.prefix,
+                     b.key, bytes + b.offset + sizeof(int), b.prefix) < 0;
+    }
+  };
+
+  // the threads refer to the object; copying is not allowed
+  ExternalSort(const ExternalSort&);
+  ExternalSort& operator=(const ExternalSort&);
+};
+
+#endif // EXTERNALSORT_H
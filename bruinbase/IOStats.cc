@@ -0,0 +1,342 @@
+#include "IOStats.h"
+#include "PageFile.h"
+#include "PageCodec.h"
+#include <map>
+#include <pthread.h>
+#include <time.h>
+
+using std::map;
+using std::string;
+
+// file descriptors beyond this are only counted in the total
+static const int MAX_FDS = 1024;
+
+static const char* OP_NAMES[IOStats::OP_COUNT] = { "read", "prefetch", "write" };
+
+static pthread_mutex_t registryMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static IOStats totals;             // the counters of all files together
+static IOStats* byFd[MAX_FDS];     // the counters of the file open on fd
+
+// the counters of every file ever opened, by name. they are never freed,
+// so byFd[] and I/O in flight may refer to them at any time.
+static map<string, IOStats*>& byName()
+{
+  static map<string, IOStats*> files;
+  return files;
+}
+
+// the counters when the current query started, and the difference
+// they made by the end of the last query
+static IOStats queryStartTotal, lastQueryTotal;
+static map<string, IOStats> queryStart, lastQuery;
+static long long queryStartTime, lastQueryTime = -1;
+
+IOStats::IOStats()
+{
+  hits = misses = mapped = evictions = 0;
+  decoded = decodeHits = rawBytes = storedBytes = 0;
+  codec = PageCodec::NONE;
+  for (int op = 0; op < OP_COUNT; op++) {
+    calls[op] = pages[op] = usecs[op] = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) latency[op][i] = 0;
+  }
+}
+
+void IOStats::bind(int fd, const string& filename)
+{
+  IOStats* s;
+
+  if (fd < 0 || fd >= MAX_FDS) return;
+
+  pthread_mutex_lock(&registryMutex);
+  map<string, IOStats*>::iterator it = byName().find(filename);
+  if (it == byName().end()) {
+    s = new IOStats;
+    byName()[filename] = s;
+  } else {
+    s = it->second;
+  }
+  __atomic_store_n(&byFd[fd], s, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&registryMutex);
+}
+
+void IOStats::unbind(int fd)
+{
+  if (fd < 0 || fd >= MAX_FDS) return;
+  __atomic_store_n(&byFd[fd], (IOStats*)NULL, __ATOMIC_RELEASE);
+}
+
+static IOStats* fileOf(int fd)
+{
+  if (fd < 0 || fd >= MAX_FDS) return NULL;
+  return __atomic_load_n(&byFd[fd], __ATOMIC_ACQUIRE);
+}
+
+void IOStats::count(int fd, long long IOStats::* counter, long long n)
+{
+  IOStats* s = fileOf(fd);
+
+  __sync_fetch_and_add(&(totals.*counter), n);
+  if (s != NULL) __sync_fetch_and_add(&(s->*counter), n);
+}
+
+void IOStats::setCodec(int fd, int codec)
+{
+  IOStats* s = fileOf(fd);
+
+  if (s != NULL) __atomic_store_n(&s->codec, codec, __ATOMIC_RELAXED);
+}
+
+void IOStats::call(int fd, Op op, int npages, long long start)
+{
+  IOStats*  targets[2] = { &totals, fileOf(fd) };
+  long long elapsed = now() - start;
+  int       bucket;
+
+  for (bucket = 0; bucket < LATENCY_BUCKETS - 1 && (elapsed >> (bucket + 1)) > 0; bucket++);
+
+  for (int i = 0; i < 2 && targets[i] != NULL; i++) {
+    __sync_fetch_and_add(&targets[i]->calls[op], 1);
+    __sync_fetch_and_add(&targets[i]->pages[op], npages);
+    __sync_fetch_and_add(&targets[i]->usecs[op], elapsed);
+    __sync_fetch_and_add(&targets[i]->latency[op][bucket], 1);
+  }
+}
+
+long long IOStats::now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// copy the counters of src, which other threads may be updating
+static void load(IOStats& dst, const IOStats& src)
+{
+  dst.hits = __atomic_load_n(&src.hits, __ATOMIC_RELAXED);
+  dst.misses = __atomic_load_n(&src.misses, __ATOMIC_RELAXED);
+  dst.mapped = __atomic_load_n(&src.mapped, __ATOMIC_RELAXED);
+  dst.evictions = __atomic_load_n(&src.evictions, __ATOMIC_RELAXED);
+  dst.decoded = __atomic_load_n(&src.decoded, __ATOMIC_RELAXED);
+  dst.decodeHits = __atomic_load_n(&src.decodeHits, __ATOMIC_RELAXED);
+  dst.rawBytes = __atomic_load_n(&src.rawBytes, __ATOMIC_RELAXED);
+  dst.storedBytes = __atomic_load_n(&src.storedBytes, __ATOMIC_RELAXED);
+  dst.codec = __atomic_load_n(&src.codec, __ATOMIC_RELAXED);
+  for (int op = 0; op < IOStats::OP_COUNT; op++) {
+    dst.calls[op] = __atomic_load_n(&src.calls[op], __ATOMIC_RELAXED);
+    dst.pages[op] = __atomic_load_n(&src.pages[op], __ATOMIC_RELAXED);
+    dst.usecs[op] = __atomic_load_n(&src.usecs[op], __ATOMIC_RELAXED);
+    for (int i = 0; i < IOStats::LATENCY_BUCKETS; i++) {
+      dst.latency[op][i] = __atomic_load_n(&src.latency[op][i], __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// subtract the counters of b from a
+static void subtract(IOStats& a, const IOStats& b)
+{
+  a.hits -= b.hits;
+  a.misses -= b.misses;
+  a.mapped -= b.mapped;
+  a.evictions -= b.evictions;
+  a.decoded -= b.decoded;
+  a.decodeHits -= b.decodeHits;
+  a.rawBytes -= b.rawBytes;
+  a.storedBytes -= b.storedBytes;
+  for (int op = 0; op < IOStats::OP_COUNT; op++) {
+    a.calls[op] -= b.calls[op];
+    a.pages[op] -= b.pages[op];
+    a.usecs[op] -= b.usecs[op];
+    for (int i = 0; i < IOStats::LATENCY_BUCKETS; i++) a.latency[op][i] -= b.latency[op][i];
+  }
+}
+
+static bool isZero(const IOStats& s)
+{
+  if (s.hits || s.misses || s.mapped || s.evictions) return false;
+  if (s.decoded || s.decodeHits || s.rawBytes) return false;
+  for (int op = 0; op < IOStats::OP_COUNT; op++) {
+    if (s.calls[op] || s.pages[op]) return false;
+  }
+  return true;
+}
+
+// take a copy of the total and of the counters of every file
+static void snapshot(IOStats& total, map<string, IOStats>& files)
+{
+  map<string, IOStats*>::const_iterator it;
+
+  load(total, totals);
+  files.clear();
+  pthread_mutex_lock(&registryMutex);
+  for (it = byName().begin(); it != byName().end(); ++it) {
+    load(files[it->first], *it->second);
+  }
+  pthread_mutex_unlock(&registryMutex);
+}
+
+void IOStats::beginQuery()
+{
+  snapshot(queryStartTotal, queryStart);
+  queryStartTime = now();
+}
+
+void IOStats::endQuery()
+{
+  map<string, IOStats>::iterator it;
+
+  lastQueryTime = now() - queryStartTime;
+  snapshot(lastQueryTotal, lastQuery);
+  subtract(lastQueryTotal, queryStartTotal);
+
+  // keep only the files the query touched
+  for (it = lastQuery.begin(); it != lastQuery.end(); ) {
+    map<string, IOStats>::iterator start = queryStart.find(it->first);
+    if (start != queryStart.end()) subtract(it->second, start->second);
+    if (isZero(it->second)) lastQuery.erase(it++);
+    else ++it;
+  }
+}
+
+static void printFileRow(FILE* out, const string& name, const IOStats& s)
+{
+  long long requests = s.hits + s.misses;
+
+  fprintf(out, "  %-20s %10lld %10lld %6.1f%% %10lld %10lld %10lld %10lld %10lld\n",
+          name.c_str(), s.hits, s.misses,
+          requests > 0 ? 100.0 * s.hits / requests : 0.0,
+          s.mapped, s.evictions,
+          s.pages[IOStats::READ], s.pages[IOStats::PREFETCH], s.pages[IOStats::WRITE]);
+}
+
+static void printCodecRow(FILE* out, const string& name, const char* codec, const IOStats& s)
+{
+  fprintf(out, "  %-20s %6s %10lld %10lld %14lld %14lld %6.2f\n",
+          name.c_str(), codec, s.decoded, s.decodeHits, s.rawBytes, s.storedBytes,
+          s.storedBytes > 0 ? (double)s.rawBytes / s.storedBytes : 0.0);
+}
+
+static void printText(FILE* out, const IOStats& total, const map<string, IOStats>& files)
+{
+  map<string, IOStats>::const_iterator it;
+
+  fprintf(out, "  %-20s %10s %10s %7s %10s %10s %10s %10s %10s\n", "file",
+          "hits", "misses", "hit%", "mapped", "evicted", "read", "prefetched", "written");
+  for (it = files.begin(); it != files.end(); ++it) printFileRow(out, it->first, it->second);
+  printFileRow(out, "(all files)", total);
+
+  // the files with compressed pages
+  if (total.decoded > 0 || total.decodeHits > 0 || total.rawBytes > 0) {
+    fprintf(out, "\n  %-20s %6s %10s %10s %14s %14s %6s\n", "file",
+            "codec", "decoded", "cached", "raw bytes", "stored bytes", "ratio");
+    for (it = files.begin(); it != files.end(); ++it) {
+      const IOStats& f = it->second;
+      if (f.codec == PageCodec::NONE && f.decoded == 0 && f.rawBytes == 0) continue;
+      printCodecRow(out, it->first, PageCodec::name(f.codec), f);
+    }
+    printCodecRow(out, "(all files)", "", total);
+  }
+
+  fprintf(out, "\n  %-20s %10s %10s %14s %12s %10s\n", "operation",
+          "calls", "pages", "bytes", "time(us)", "avg(us)");
+  for (int op = 0; op < IOStats::OP_COUNT; op++) {
+    fprintf(out, "  %-20s %10lld %10lld %14lld %12lld %10.1f\n", OP_NAMES[op],
+            total.calls[op], total.pages[op], total.pages[op] * PageFile::PAGE_SIZE,
+            total.usecs[op], total.calls[op] > 0 ? (double)total.usecs[op] / total.calls[op] : 0.0);
+  }
+
+  // the latency histograms list the non-empty buckets as "<limit:count"
+  for (int op = 0; op < IOStats::OP_COUNT; op++) {
+    if (total.calls[op] == 0) continue;
+    fprintf(out, "  %s latency (us):", OP_NAMES[op]);
+    for (int i = 0; i < IOStats::LATENCY_BUCKETS; i++) {
+      if (total.latency[op][i] == 0) continue;
+      if (i == IOStats::LATENCY_BUCKETS - 1) fprintf(out, " >=%lld:%lld", 1LL << i, total.latency[op][i]);
+      else fprintf(out, " <%lld:%lld", 2LL << i, total.latency[op][i]);
+    }
+    fprintf(out, "\n");
+  }
+}
+
+static void printJsonString(FILE* out, const string& s)
+{
+  fputc('"', out);
+  for (size_t i = 0; i < s.size(); i++) {
+    unsigned char c = s[i];
+    if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+    else if (c < 0x20) fprintf(out, "\\u%04x", c);
+    else fputc(c, out);
+  }
+  fputc('"', out);
+}
+
+// the codec is printed for a single file only
+static void printJsonStats(FILE* out, const IOStats& s, bool file)
+{
+  fprintf(out, "{\"hits\": %lld, \"misses\": %lld, \"mapped\": %lld, \"evictions\": %lld",
+          s.hits, s.misses, s.mapped, s.evictions);
+  if (file) fprintf(out, ", \"codec\": \"%s\"", PageCodec::name(s.codec));
+  fprintf(out, ", \"decoded\": %lld, \"decode_hits\": %lld, \"raw_bytes\": %lld, \"stored_bytes\": %lld",
+          s.decoded, s.decodeHits, s.rawBytes, s.storedBytes);
+  for (int op = 0; op < IOStats::OP_COUNT; op++) {
+    fprintf(out, ", \"%s\": {\"calls\": %lld, \"pages\": %lld, \"bytes\": %lld, \"time_us\": %lld, \"latency_us\": [",
+            OP_NAMES[op], s.calls[op], s.pages[op], s.pages[op] * PageFile::PAGE_SIZE, s.usecs[op]);
+    for (int i = 0; i < IOStats::LATENCY_BUCKETS; i++) {
+      fprintf(out, i > 0 ? ", %lld" : "%lld", s.latency[op][i]);
+    }
+    fprintf(out, "]}");
+  }
+  fprintf(out, "}");
+}
+
+static void printJson(FILE* out, const IOStats& total, const map<string, IOStats>& files)
+{
+  map<string, IOStats>::const_iterator it;
+
+  fprintf(out, "\"total\": ");
+  printJsonStats(out, total, false);
+  fprintf(out, ", \"files\": {");
+  for (it = files.begin(); it != files.end(); ++it) {
+    if (it != files.begin()) fprintf(out, ", ");
+    printJsonString(out, it->first);
+    fprintf(out, ": ");
+    printJsonStats(out, it->second, true);
+  }
+  fprintf(out, "}");
+}
+
+void IOStats::print(FILE* out, bool json)
+{
+  IOStats total;
+  map<string, IOStats> files;
+
+  snapshot(total, files);
+
+  if (json) {
+    // bucket i of "latency_us" counts the calls taking [2^i, 2^(i+1)) us
+    fprintf(out, "{\"page_size\": %d, ", PageFile::PAGE_SIZE);
+    printJson(out, total, files);
+    fprintf(out, ", \"last_query\": ");
+    if (lastQueryTime < 0) {
+      fprintf(out, "null");
+    } else {
+      fprintf(out, "{\"elapsed_us\": %lld, ", lastQueryTime);
+      printJson(out, lastQueryTotal, lastQuery);
+      fprintf(out, "}");
+    }
+    fprintf(out, "}\n");
+    return;
+  }
+
+  fprintf(out, "I/O since start (page size %d bytes):\n", PageFile::PAGE_SIZE);
+  printText(out, total, files);
+
+  if (lastQueryTime >= 0) {
+    long long io = 0;
+    for (int op = 0; op < OP_COUNT; op++) io += lastQueryTotal.usecs[op];
+    fprintf(out, "\nLast query: %lld us elapsed, %lld us in I/O calls\n", lastQueryTime, io);
+    printText(out, lastQueryTotal, lastQuery);
+  }
+}
@@ -0,0 +1,114 @@
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include <cstdio>
+#include <string>
+#include "Bruinbase.h"
+
+/**
+ * Buffer pool and disk I/O counters of a file, or of all files together.
+ * Counters are kept per file name, so they survive the file being closed
+ * and opened again by the next query, and are updated atomically by
+ * every thread doing I/O.
+ *
+ * Disk I/O is broken down by operation: READ for pages read on demand,
+ * PREFETCH for pages read ahead in the background, and WRITE for pages
+ * written back or written through. For every operation the number of
+ * system calls, the pages transferred, the time spent in the calls and
+ * a histogram of the call latencies are kept.
+ *
+ * For a table whose data pages are compressed, the codec, the bytes of
+ * the pages before and after compression, and the decompressions done
+ * or saved by a cached page are kept as well.
+ */
+class IOStats {
+ public:
+
+  // I/O operations
+  enum Op { READ, PREFETCH, WRITE, OP_COUNT };
+
+  // bucket i of a latency histogram counts the calls that took
+  // [2^i, 2^(i+1)) microseconds; bucket 0 also counts faster calls
+  // and the last bucket also counts slower ones
+  static const int LATENCY_BUCKETS = 24;
+
+  long long hits;       // page requests served from the buffer pool
+  long long misses;     // page requests that had to wait for the disk
+  long long mapped;     // page requests served from a memory mapping
+  long long evictions;  // pages evicted from the buffer pool
+  long long calls[OP_COUNT];  // # of system calls
+  long long pages[OP_COUNT];  // # of pages transferred
+  long long usecs[OP_COUNT];  // microseconds spent in the calls
+  long long latency[OP_COUNT][LATENCY_BUCKETS];
+  long long decoded;      // data pages decompressed
+  long long decodeHits;   // decompressions saved by a page already decoded
+  long long rawBytes;     // bytes of the data pages written, uncompressed
+  long long storedBytes;  // bytes the compressed pages took on the disk
+  int       codec;        // PageCodec of the data pages, NONE if unknown
+
+  IOStats();
+
+  /**
+   * attach the counters of a file to its file descriptor, so that I/O
+   * done by the buffer pool on the descriptor is counted for the file.
+   * @param fd[IN] file descriptor of the open file
+   * @param filename[IN] the name the file was opened with
+   */
+  static void bind(int fd, const std::string& filename);
+
+  /**
+   * detach the counters from a file descriptor that is being closed.
+   * @param fd[IN] file descriptor of the file
+   */
+  static void unbind(int fd);
+
+  /**
+   * count page requests for file fd.
+   * @param fd[IN] file descriptor of the file
+   * @param counter[IN] &IOStats::hits, &IOStats::misses, ...
+   * @param n[IN] the number to add
+   */
+  static void count(int fd, long long IOStats::* counter, long long n = 1);
+
+  /**
+   * record the codec the data pages of file fd are compressed with.
+   * @param fd[IN] file descriptor of the file
+   * @param codec[IN] one of the PageCodec codecs
+   */
+  static void setCodec(int fd, int codec);
+
+  /**
+   * count a system call on file fd.
+   * @param fd[IN] file descriptor of the file
+   * @param op[IN] the operation the call was made for
+   * @param npages[IN] the number of pages transferred
+   * @param start[IN] the time the call started, from now()
+   */
+  static void call(int fd, Op op, int npages, long long start);
+
+  /**
+   * @return the current time in microseconds
+   */
+  static long long now();
+
+  /**
+   * start recording the I/O of a query.
+   */
+  static void beginQuery();
+
+  /**
+   * finish recording the I/O of a query; it is reported as the last
+   * query by print().
+   */
+  static void endQuery();
+
+  /**
+   * print the counters of every file, their total and those of the last
+   * query, as a table or as a JSON object.
+   * @param out[IN] the stream to print to
+   * @param json[IN] whether to print JSON
+   */
+  static void print(FILE* out, bool json);
+};
+
+#endif // IOSTATS_H
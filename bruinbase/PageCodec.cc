@@ -0,0 +1,382 @@
+#include "PageCodec.h"
+#include <cstring>
+#include <vector>
+#include <strings.h>
+
+using std::string;
+using std::vector;
+
+//
+// an LZ stream is a sequence of sequences. a sequence starts with a token
+// byte whose high four bits are the number of literals and whose low four
+// bits are the match length minus MIN_MATCH. a field of 15 is continued
+// by bytes that are added to it, up to and including the first byte that
+// is not 255. the literals follow, then the 16-bit offset of the match,
+// counted back from the current output position. the last sequence has
+// only literals and ends the stream.
+//
+static const int MIN_MATCH = 4;
+static const int MAX_OFFSET = 65535;
+static const int HASH_BITS = 12;
+
+//
+// a DICT stream is a sequence of bytes. a byte below 0x80 stands for
+// itself, DICT_ESCAPE is followed by a byte that stands for itself, and
+// byte 0x81+i is dictionary code i, which stands for the bytes of the
+// two symbols it was merged from. only bytes below 0x80 are merged.
+//
+static const int DICT_ESCAPE = 0x80;
+
+static const char* CODEC_NAMES[] = { "none", "lz", "dict" };
+
+// hash the four bytes at p
+static unsigned hash4(const unsigned char* p)
+{
+  unsigned v;
+
+  memcpy(&v, p, sizeof(v));
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// write the continuation bytes of a token field of 15 or more
+static bool putLength(unsigned char*& op, const unsigned char* oend, int length)
+{
+  for (length -= 15; length >= 255; length -= 255) {
+    if (op >= oend) return false;
+    *op++ = 255;
+  }
+  if (op >= oend) return false;
+  *op++ = length;
+  return true;
+}
+
+// read the continuation bytes of a token field of 15
+static bool getLength(const unsigned char*& ip, const unsigned char* iend, int& length)
+{
+  unsigned char b;
+
+  do {
+    if (ip >= iend) return false;
+    b = *ip++;
+    length += b;
+  } while (b == 255);
+  return true;
+}
+
+// write a sequence of nlit literals and a match of mlen bytes at offset.
+// the last sequence has no match and mlen is 0.
+static bool putSequence(unsigned char*& op, const unsigned char* oend,
+                        const unsigned char* literals, int nlit, int offset, int mlen)
+{
+  int mfield = (mlen > 0) ? mlen - MIN_MATCH : 0;
+
+  if (op >= oend) return false;
+  *op++ = ((nlit < 15 ? nlit : 15) << 4) | (mfield < 15 ? mfield : 15);
+  if (nlit >= 15 && !putLength(op, oend, nlit)) return false;
+  if (oend - op < nlit) return false;
+  memcpy(op, literals, nlit);
+  op += nlit;
+
+  if (mlen == 0) return true;
+  if (oend - op < 2) return false;
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+  if (mfield >= 15 && !putLength(op, oend, mfield)) return false;
+  return true;
+}
+
+static int lzCompress(const unsigned char* src, int n, unsigned char* dst, int capacity)
+{
+  int table[1 << HASH_BITS];
+  const unsigned char* ip = src;
+  const unsigned char* anchor = src;   // the first byte not yet written
+  const unsigned char* end = src + n;
+  const unsigned char* limit = (n > MIN_MATCH) ? end - MIN_MATCH : src;
+  const unsigned char* match;
+  unsigned char* op = dst;
+  unsigned char* oend = dst + capacity;
+  unsigned h;
+  int ref, length;
+
+  memset(table, -1, sizeof(table));
+
+  // the table remembers the last position of every hashed four bytes.
+  // a position whose bytes really match starts a copy.
+  while (ip < limit) {
+    h = hash4(ip);
+    ref = table[h];
+    table[h] = ip - src;
+    if (ref < 0 || (ip - src) - ref > MAX_OFFSET || memcmp(src + ref, ip, MIN_MATCH) != 0) {
+      ip++;
+      continue;
+    }
+
+    match = src + ref;
+    for (length = MIN_MATCH; ip + length < end && match[length] == ip[length]; length++);
+    if (!putSequence(op, oend, anchor, ip - anchor, ip - match, length)) return -1;
+    ip += length;
+    anchor = ip;
+  }
+
+  // the rest of the input is literals
+  if (!putSequence(op, oend, anchor, end - anchor, 0, 0)) return -1;
+  return op - dst;
+}
+
+static int lzDecompress(const unsigned char* src, int n, unsigned char* dst, int capacity)
+{
+  const unsigned char* ip = src;
+  const unsigned char* iend = src + n;
+  unsigned char* op = dst;
+  unsigned char* oend = dst + capacity;
+  const unsigned char* match;
+  int token, nlit, mlen, offset;
+
+  while (ip < iend) {
+    token = *ip++;
+
+    // the literals
+    nlit = token >> 4;
+    if (nlit == 15 && !getLength(ip, iend, nlit)) return -1;
+    if (iend - ip < nlit || oend - op < nlit) return -1;
+    memcpy(op, ip, nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == iend) break;
+
+    // the match, which may overlap the bytes it produces
+    if (iend - ip < 2) return -1;
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    mlen = token & 15;
+    if (mlen == 15 && !getLength(ip, iend, mlen)) return -1;
+    mlen += MIN_MATCH;
+    if (offset == 0 || offset > op - dst || oend - op < mlen) return -1;
+    for (match = op - offset; mlen > 0; mlen--) *op++ = *match++;
+  }
+
+  return op - dst;
+}
+
+PageCodec::PageCodec(int codec)
+{
+  this->codec = codec;
+  trained = false;
+  ncodes = 0;
+  index();
+}
+
+const char* PageCodec::name(int codec)
+{
+  if (codec < NONE || codec > DICT) return "unknown";
+  return CODEC_NAMES[codec];
+}
+
+int PageCodec::parse(const string& name)
+{
+  for (int codec = NONE; codec <= DICT; codec++) {
+    if (strcasecmp(name.c_str(), CODEC_NAMES[codec]) == 0) return codec;
+  }
+  return -1;
+}
+
+void PageCodec::train(const char* sample, int n)
+{
+  vector<int> symbols(n), counts(256 * 256);
+  int a, b, best, i, j, m;
+
+  // the symbols of the sample; a byte that is not merged is -1
+  for (i = 0; i < n; i++) {
+    symbols[i] = ((unsigned char)sample[i] < DICT_ESCAPE) ? (unsigned char)sample[i] : -1;
+  }
+
+  // merge the most frequent pair of adjacent symbols into a new code
+  // until the codes run out or no pair repeats
+  for (ncodes = 0, m = n; ncodes < 127; ) {
+    memset(&counts[0], 0, counts.size() * sizeof(int));
+    for (i = 0; i + 1 < m; i++) {
+      a = symbols[i];
+      b = symbols[i + 1];
+      if (a < 0 || b < 0 || symbolLength(a) + symbolLength(b) > MAX_EXPANSION) continue;
+      counts[a * 256 + b]++;
+    }
+    for (best = 0, i = 1; i < 256 * 256; i++) {
+      if (counts[i] > counts[best]) best = i;
+    }
+    if (counts[best] < 2) break;
+
+    a = best / 256;
+    b = best % 256;
+    for (i = 0, j = 0; i < m; j++) {
+      if (i + 1 < m && symbols[i] == a && symbols[i + 1] == b) {
+        symbols[j] = DICT_ESCAPE + 1 + ncodes;
+        i += 2;
+      } else {
+        symbols[j] = symbols[i++];
+      }
+    }
+    m = j;
+    addCode(a, b);
+  }
+
+  trained = true;
+  index();
+}
+
+int PageCodec::save(char* buffer) const
+{
+  memcpy(buffer, pairs, 2 * ncodes);
+  return 2 * ncodes;
+}
+
+bool PageCodec::load(const char* buffer, int n)
+{
+  const unsigned char* p = (const unsigned char*)buffer;
+
+  ncodes = 0;
+  trained = false;
+  if (n < 0 || n > MAX_DICTIONARY || n % 2 != 0) return false;
+
+  // a code is merged from bytes and from the codes before it
+  for (int i = 0; i < n; i += 2) {
+    if (p[i] == DICT_ESCAPE || p[i] > DICT_ESCAPE + ncodes ||
+        p[i + 1] == DICT_ESCAPE || p[i + 1] > DICT_ESCAPE + ncodes ||
+        symbolLength(p[i]) + symbolLength(p[i + 1]) > MAX_EXPANSION) {
+      ncodes = 0;
+      index();
+      return false;
+    }
+    addCode(p[i], p[i + 1]);
+  }
+
+  trained = true;
+  index();
+  return true;
+}
+
+int PageCodec::symbolLength(int symbol) const
+{
+  return (symbol < DICT_ESCAPE) ? 1 : length[symbol - DICT_ESCAPE - 1];
+}
+
+void PageCodec::addCode(int a, int b)
+{
+  int symbols[2] = { a, b };
+
+  pairs[ncodes][0] = a;
+  pairs[ncodes][1] = b;
+  length[ncodes] = 0;
+  for (int i = 0; i < 2; i++) {
+    if (symbols[i] < DICT_ESCAPE) {
+      expansion[ncodes][length[ncodes]++] = symbols[i];
+    } else {
+      int code = symbols[i] - DICT_ESCAPE - 1;
+      memcpy(expansion[ncodes] + length[ncodes], expansion[code], length[code]);
+      length[ncodes] += length[code];
+    }
+  }
+  ncodes++;
+}
+
+void PageCodec::index()
+{
+  int n = 0;
+
+  // order the codes by their first byte, and the codes of a byte from
+  // the longest to the shortest, so that dictCompress() takes the first
+  // code that matches
+  for (int b = 0; b < DICT_ESCAPE; b++) {
+    first[b] = n;
+    for (int len = MAX_EXPANSION; len >= 2; len--) {
+      for (int i = 0; i < ncodes; i++) {
+        if (expansion[i][0] == b && length[i] == len) order[n++] = i;
+      }
+    }
+  }
+  first[DICT_ESCAPE] = n;
+}
+
+int PageCodec::dictCompress(const unsigned char* src, int n, unsigned char* dst, int capacity) const
+{
+  int i, k, code, op = 0;
+  unsigned char c;
+
+  for (i = 0; i < n; ) {
+    c = src[i];
+    if (c >= DICT_ESCAPE) {
+      if (capacity - op < 2) return -1;
+      dst[op++] = DICT_ESCAPE;
+      dst[op++] = c;
+      i++;
+      continue;
+    }
+
+    // the longest code that matches, or the byte itself
+    for (k = first[c]; k < first[c + 1]; k++) {
+      code = order[k];
+      if (length[code] <= n - i && memcmp(expansion[code], src + i, length[code]) == 0) break;
+    }
+    if (op >= capacity) return -1;
+    if (k < first[c + 1]) {
+      dst[op++] = DICT_ESCAPE + 1 + code;
+      i += length[code];
+    } else {
+      dst[op++] = c;
+      i++;
+    }
+  }
+
+  return op;
+}
+
+int PageCodec::dictDecompress(const unsigned char* src, int n, unsigned char* dst, int capacity) const
+{
+  int i, code, op = 0;
+
+  for (i = 0; i < n; i++) {
+    if (src[i] < DICT_ESCAPE) {
+      if (op >= capacity) return -1;
+      dst[op++] = src[i];
+    } else if (src[i] == DICT_ESCAPE) {
+      if (++i >= n || op >= capacity) return -1;
+      dst[op++] = src[i];
+    } else {
+      code = src[i] - DICT_ESCAPE - 1;
+      if (code >= ncodes || capacity - op < length[code]) return -1;
+      memcpy(dst + op, expansion[code], length[code]);
+      op += length[code];
+    }
+  }
+
+  return op;
+}
+
+int PageCodec::compress(const char* src, int n, char* dst, int capacity) const
+{
+  switch (codec) {
+  case NONE:
+    if (n > capacity) return -1;
+    memcpy(dst, src, n);
+    return n;
+  case LZ:
+    return lzCompress((const unsigned char*)src, n, (unsigned char*)dst, capacity);
+  case DICT:
+    return dictCompress((const unsigned char*)src, n, (unsigned char*)dst, capacity);
+  }
+  return -1;
+}
+
+int PageCodec::decompress(const char* src, int n, char* dst, int capacity) const
+{
+  switch (codec) {
+  case NONE:
+    if (n > capacity) return -1;
+    memcpy(dst, src, n);
+    return n;
+  case LZ:
+    return lzDecompress((const unsigned char*)src, n, (unsigned char*)dst, capacity);
+  case DICT:
+    return dictDecompress((const unsigned char*)src, n, (unsigned char*)dst, capacity);
+  }
+  return -1;
+}
@@ -0,0 +1,119 @@
+#ifndef PAGECODEC_H
+#define PAGECODEC_H
+
+#include <string>
+
+/**
+ * A compression codec for the data pages of a table file.
+ *
+ * LZ is a byte-oriented LZ77 codec in the style of LZ4: the output is a
+ * sequence of literal runs, each followed by a copy of an earlier part
+ * of the output. It needs no dictionary and decodes a page in a single
+ * pass.
+ *
+ * DICT replaces common byte strings of the data by single byte codes.
+ * The strings are found by train() on a sample of the data, by merging
+ * the most frequent pair of symbols again and again (byte pair
+ * encoding), and are saved with the file. Short English text such as
+ * movie titles repeats little within a page, which is where a shared
+ * dictionary does better than LZ.
+ */
+class PageCodec {
+ public:
+  static const int NONE = 0;   // pages are stored as they are
+  static const int LZ = 1;     // LZ77 compression of every data page
+  static const int DICT = 2;   // dictionary coding of every data page
+
+  // the largest saved dictionary, in bytes
+  static const int MAX_DICTIONARY = 2 * 127;
+
+  PageCodec(int codec = NONE);
+
+  /**
+   * @return the codec, one of NONE, LZ and DICT
+   */
+  int getCodec() const { return codec; }
+
+  /**
+   * @param codec[IN] one of the codecs
+   * @return the name of the codec, as given to LOAD
+   */
+  static const char* name(int codec);
+
+  /**
+   * find a codec by name, ignoring case.
+   * @param name[IN] the name of the codec
+   * @return the codec, or -1 if there is no such codec
+   */
+  static int parse(const std::string& name);
+
+  /**
+   * @return whether compress() has to wait for train() or load()
+   */
+  bool needsTraining() const { return codec == DICT && !trained; }
+
+  /**
+   * build the dictionary from a sample of the data to compress.
+   * @param sample[IN] the sample
+   * @param n[IN] the size of the sample in bytes
+   */
+  void train(const char* sample, int n);
+
+  /**
+   * save the dictionary.
+   * @param buffer[OUT] at least MAX_DICTIONARY bytes
+   * @return the number of bytes saved
+   */
+  int save(char* buffer) const;
+
+  /**
+   * load a dictionary saved by save().
+   * @param buffer[IN] the saved dictionary
+   * @param n[IN] the number of bytes saved
+   * @return whether the dictionary is valid
+   */
+  bool load(const char* buffer, int n);
+
+  /**
+   * compress n bytes.
+   * @param src[IN] the bytes to compress
+   * @param n[IN] the number of bytes; at most 65536
+   * @param dst[OUT] the compressed bytes
+   * @param capacity[IN] the size of dst
+   * @return the number of compressed bytes, or -1 if they do not fit
+   *         in capacity bytes
+   */
+  int compress(const char* src, int n, char* dst, int capacity) const;
+
+  /**
+   * decompress n bytes.
+   * @param src[IN] the compressed bytes
+   * @param n[IN] the number of compressed bytes
+   * @param dst[OUT] the decompressed bytes
+   * @param capacity[IN] the size of dst
+   * @return the number of decompressed bytes, or -1 if src is corrupt
+   *         or does not fit in capacity bytes
+   */
+  int decompress(const char* src, int n, char* dst, int capacity) const;
+
+ private:
+  // a dictionary code stands for at most this many bytes
+  static const int MAX_EXPANSION = 16;
+
+  int  codec;
+  bool trained;  // whether the dictionary of DICT is built
+  int  ncodes;   // # of dictionary codes
+  unsigned char pairs[127][2];  // the pair of symbols code 0x81+i stands for
+  unsigned char length[127];    // # of bytes code 0x81+i stands for
+  unsigned char expansion[127][MAX_EXPANSION];  // the bytes themselves
+  unsigned char first[129];     // the codes of a first byte, longest first,
+  unsigned char order[127];     // are order[first[b]..first[b+1])
+
+  void index();
+  int  symbolLength(int symbol) const;
+  void addCode(int a, int b);
+  int  dictCompress(const unsigned char* src, int n, unsigned char* dst, int capacity) const;
+  int  dictDecompress(const unsigned char* src, int n, unsigned char* dst, int capacity) const;
+};
+
+#endif // PAGECODEC_H
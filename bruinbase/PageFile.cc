@@ -9,32 +9,78 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "BufferPool.h"
+#include "ReadAhead.h"
+#include "IOStats.h"
 #include <cstring>
+#include <new>
+#include <cstdlib>
+#include <algorithm>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 using std::string;
 
+// the alignment of file offsets and memory buffers that O_DIRECT requires
+// for the file, or 0 if its file system does not support direct I/O.
+// kernels that cannot tell get the traditional sector size.
+static int directAlignment(int fd)
+{
+#ifdef STATX_DIOALIGN
+  struct statx stx;
+
+  if (::statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+      (stx.stx_mask & STATX_DIOALIGN)) {
+    if (stx.stx_dio_offset_align == 0) return 0;
+    return (int)std::max(stx.stx_dio_offset_align, stx.stx_dio_mem_align);
+  }
+#endif
+  return 512;
+}
+
 int PageFile::readCount = 0;
 int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
 
 PageFile::PageFile() 
 { 
   fd = -1; 
   epid = 0; 
+  writable = false;
+  map = NULL;
+  direct = false;
+  pattern = ACCESS_NORMAL;
+  lastPid = -1;
+  seqCount = 0;
+  raEnd = 0;
+  raLimit = -1;
+  ring = NULL;
 }
 
-PageFile::PageFile(const string& filename, char mode)
+PageFile::PageFile(const string& filename, char mode, int options)
 {
   fd = -1;
   epid = 0;
-  open(filename.c_str(), mode);
+  writable = false;
+  map = NULL;
+  direct = false;
+  pattern = ACCESS_NORMAL;
+  lastPid = -1;
+  seqCount = 0;
+  raEnd = 0;
+  raLimit = -1;
+  ring = NULL;
+  open(filename.c_str(), mode, options);
 }
 
-RC PageFile::open(const string& filename, char mode)
+PageFile::~PageFile()
+{
+  // do not lose the dirty pages of a file that was not closed
+  if (fd >= 0) close();
+}
+
+RC PageFile::open(const string& filename, char mode, int options)
 {
   RC   rc;
   int  oflag;
@@ -56,38 +102,84 @@ RC PageFile::open(const string& filename, char mode)
     return RC_INVALID_FILE_MODE;
   }
 
+  // a memory mapping is only used for reading, and it is served
+  // from the OS page cache that O_DIRECT bypasses
+  if ((options & OPEN_MMAP) && oflag != O_RDONLY) return RC_INVALID_FILE_MODE;
+  if ((options & OPEN_MMAP) && (options & OPEN_DIRECT)) return RC_INVALID_FILE_MODE;
+  if (options & OPEN_DIRECT) oflag |= O_DIRECT;
+
   // open the file
   fd = ::open(filename.c_str(), oflag, 0644);
   if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
 
+  // every page and every frame of the pool must be aligned
+  // as the file system requires for direct I/O
+  if (options & OPEN_DIRECT) {
+    int align = directAlignment(fd);
+    if (align <= 0 || PAGE_SIZE % align != 0 || BufferPool::FRAME_ALIGNMENT % align != 0) {
+      ::close(fd);
+      fd = -1;
+      return RC_FILE_OPEN_FAILED;
+    }
+  }
+
   // get the size of the file to set the end pid
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
   epid = statbuf.st_size / PAGE_SIZE;
+  writable = (oflag & O_ACCMODE) != O_RDONLY;
+  direct = (options & OPEN_DIRECT) != 0;
+  pattern = ACCESS_NORMAL;
+  lastPid = -1;
+  seqCount = 0;
+  raEnd = 0;
+  raLimit = -1;
+
+  // map the whole pages of the file. pages are then served straight
+  // from the mapping, and the OS page cache takes the place of the pool.
+  if ((options & OPEN_MMAP) && epid > 0) {
+    void* addr = ::mmap(NULL, (size_t)epid * PAGE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) { ::close(fd); fd = -1; epid = 0; return RC_FILE_OPEN_FAILED; }
+    map = (char*)addr;
+  }
+
+  // count the I/O on the file under its name
+  IOStats::bind(fd, filename);
 
   return 0;
 }
 
 RC PageFile::close()
 {
+  RC rc = 0;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
-
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-    }
+  // no page may be read ahead into the pool after the file is closed
+  if (map == NULL) readAhead().cancel(fd);
+  delete ring;
+  ring = NULL;
+
+  // write back the dirty pages and evict all cached pages for this file
+  if (writable) rc = pool().flushFile(fd);
+  pool().discardFile(fd);
+
+  // unmap a memory mapped file
+  if (map != NULL) {
+    ::munmap(map, (size_t)epid * PAGE_SIZE);
+    map = NULL;
   }
 
+  // close the file
+  IOStats::unbind(fd);
+  if (::close(fd) < 0) rc = RC_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
   epid = 0;
-  return 0;
+  writable = false;
+  direct = false;
+  return rc;
 }
 
 PageId PageFile::endPid() const 
@@ -95,86 +187,387 @@ PageId PageFile::endPid() const
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::write(PageId pid, const void* buffer)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  RC     rc;
+  int    f;
+  bool   isNew;
+  PageId e;
+  BufferPool& bp = pool();
+
+  if (pid < 0) return RC_INVALID_PID; 
+  if (!writable) return RC_FILE_WRITE_FAILED;
+
+  // put the new content in the buffer pool and mark it dirty.
+  // the page is written to the disk when it is evicted or flushed.
+  while ((f = bp.pinPage(fd, pid, isNew)) >= 0) {
+    // a frame turns invalid if the thread loading it failed
+    if (!isNew && !bp.latch(f, true)) {
+      bp.unlatch(f);
+      bp.unpin(f);
+      continue;
+    }
+    memcpy(bp.frameData(f), buffer, PAGE_SIZE);
+    bp.markDirty(f);
+    if (isNew) bp.finishLoad(f, true);
+    else bp.unlatch(f);
+    bp.unpin(f);
+    break;
+  }
+  // every frame is pinned; write the page through to the disk
+  if (f < 0 && (rc = writeThrough(pid, buffer)) < 0) return rc;
+
+  // if the written pid >= end pid, update the end pid
+  while ((e = epid) <= pid && !__sync_bool_compare_and_swap(&epid, e, pid + 1));
+
+  return 0;
 }
 
-RC PageFile::write(PageId pid, const void* buffer)
+RC PageFile::flush()
 {
-  RC rc;
-  if (pid < 0) return RC_INVALID_PID; 
+  if (fd < 0) return RC_FILE_WRITE_FAILED;
+  return pool().flushFile(fd);
+}
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+RC PageFile::fetch(PageId pid, bool exclusive, int& frame) const
+{
+  bool isNew;
+  long long start;
+  BufferPool& bp = pool();
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  noteAccess(pid);
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  for (;;) {
+    if ((frame = bp.pinPage(fd, pid, isNew, scanRing())) < 0) return RC_NO_FREE_FRAME;
+
+    // if the page is in the buffer pool, we are done. a frame turns
+    // invalid if the thread loading it failed; then we try ourselves.
+    if (!isNew) {
+      if (bp.latch(frame, exclusive)) {
+        IOStats::count(fd, &IOStats::hits);
+        return 0;
+      }
+      bp.unlatch(frame);
+      bp.unpin(frame);
+      continue;
+    }
+
+    // read the page into the new frame. other threads looking for the
+    // page wait on the latch of the frame until we are done.
+    IOStats::count(fd, &IOStats::misses);
+    start = IOStats::now();
+    if (::pread(fd, bp.frameData(frame), PAGE_SIZE, (off_t)pid * PAGE_SIZE) < 0) {
+      bp.finishLoad(frame, false);
+      bp.unpin(frame);
+      return RC_FILE_READ_FAILED;
     }
+    bp.finishLoad(frame, true);
+
+    // increase the page read count
+    __sync_fetch_and_add(&readCount, 1);
+    IOStats::call(fd, IOStats::READ, 1, start);
+
+    // the frame was latched exclusively while it was loaded
+    bp.latch(frame, exclusive);
+    return 0;
   }
+}
 
-  // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+RC PageFile::read(PageId pid, void* buffer) const
+{
+  RC  rc;
+  int f;
+  BufferPool& bp = pool();
 
-  // increase page write count
-  writeCount++;
+  // copy a memory mapped page straight from the mapping
+  if (map != NULL) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+    memcpy(buffer, map + (size_t)pid * PAGE_SIZE, PAGE_SIZE);
+    __sync_fetch_and_add(&readCount, 1);
+    IOStats::count(fd, &IOStats::mapped);
+    return 0;
+  }
+
+  rc = fetch(pid, false, f);
 
+  // if every frame of the pool is pinned, read straight into the buffer
+  if (rc == RC_NO_FREE_FRAME) return readThrough(pid, buffer);
+  if (rc < 0) return rc;
+
+  memcpy(buffer, bp.frameData(f), PAGE_SIZE);
+  bp.unlatch(f);
+  bp.unpin(f);
   return 0;
 }
 
-RC PageFile::read(PageId pid, void* buffer) const
+RC PageFile::readThrough(PageId pid, void* buffer) const
 {
-  RC rc;
+  void*   bounce = buffer;
+  ssize_t n;
+  long long start;
 
-  if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+  if (direct && posix_memalign(&bounce, BufferPool::FRAME_ALIGNMENT, PAGE_SIZE) != 0) {
+    return RC_OUT_OF_MEMORY;
+  }
 
-  //
-  // if the page is in cache, read it from there
-  //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
+  IOStats::count(fd, &IOStats::misses);
+  start = IOStats::now();
+  n = ::pread(fd, bounce, PAGE_SIZE, (off_t)pid * PAGE_SIZE);
+  if (bounce != buffer) {
+    if (n >= 0) memcpy(buffer, bounce, PAGE_SIZE);
+    free(bounce);
   }
+  if (n < 0) return RC_FILE_READ_FAILED;
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
+  __sync_fetch_and_add(&readCount, 1);
+  IOStats::call(fd, IOStats::READ, 1, start);
+  return 0;
+}
+
+RC PageFile::writeThrough(PageId pid, const void* buffer)
+{
+  void*   bounce = const_cast<void*>(buffer);
+  ssize_t n;
+  long long start;
+
+  if (direct) {
+    if (posix_memalign(&bounce, BufferPool::FRAME_ALIGNMENT, PAGE_SIZE) != 0) {
+      return RC_OUT_OF_MEMORY;
     }
+    memcpy(bounce, buffer, PAGE_SIZE);
+  }
+
+  start = IOStats::now();
+  n = ::pwrite(fd, bounce, PAGE_SIZE, (off_t)pid * PAGE_SIZE);
+  if (bounce != buffer) free(bounce);
+  if (n != PAGE_SIZE) return RC_FILE_WRITE_FAILED;
+
+  __sync_fetch_and_add(&writeCount, 1);
+  IOStats::call(fd, IOStats::WRITE, 1, start);
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, PageHandle& page, int mode) const
+{
+  RC  rc;
+  int f;
+
+  page.release();
+
+  // a memory mapped page is used in place without a buffer pool frame
+  if (map != NULL) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
+    if (mode & PIN_EXCLUSIVE) return RC_FILE_WRITE_FAILED;
+    page.file = this;
+    page.frame = -1;
+    page.pid = pid;
+    page.page = map + (size_t)pid * PAGE_SIZE;
+    page.dirty = false;
+    page.exclusive = false;
+    __sync_fetch_and_add(&readCount, 1);
+    IOStats::count(fd, &IOStats::mapped);
+    return 0;
+  }
+
+  if ((rc = fetch(pid, (mode & PIN_EXCLUSIVE) != 0, f)) < 0) return rc;
+  if (mode & PIN_PRIORITY) pool().prioritize(f);
+
+  page.file = this;
+  page.frame = f;
+  page.pid = pid;
+  page.page = pool().frameData(f);
+  page.dirty = false;
+  page.exclusive = (mode & PIN_EXCLUSIVE) != 0;
+
+  return 0;
+}
+
+RC PageFile::unpin(PageHandle& page) const
+{
+  RC rc = 0;
+  BufferPool& bp = pool();
+
+  // a memory mapped page is not in the buffer pool and is never modified
+  if (page.frame < 0) return page.dirty ? RC_FILE_WRITE_FAILED : 0;
+
+  // the modified page is written back together with other dirty pages
+  if (page.dirty) {
+    if (writable && page.exclusive) bp.markDirty(page.frame);
+    else rc = RC_FILE_WRITE_FAILED;
+  }
+
+  bp.unlatch(page.frame);
+  bp.unpin(page.frame);
+  return rc;
+}
+
+PageHandle::PageHandle()
+{
+  file = NULL;
+  frame = -1;
+  pid = -1;
+  page = NULL;
+  dirty = false;
+  exclusive = false;
+}
+
+PageHandle::~PageHandle()
+{
+  release();
+}
+
+RC PageHandle::release()
+{
+  RC rc;
+
+  if (page == NULL) return 0;
+
+  rc = file->unpin(*this);
+  file = NULL;
+  frame = -1;
+  pid = -1;
+  page = NULL;
+  dirty = false;
+  exclusive = false;
+
+  return rc;
+}
+
+void PageFile::noteAccess(PageId pid) const
+{
+  PageId last, end, from, to, limit;
+  int    window;
+
+  last = __atomic_exchange_n(&lastPid, pid, __ATOMIC_RELAXED);
+  if (pid == last) return;
+
+  // a jump ends the sequence; a random reader never reads ahead
+  if (pid != last + 1 || pattern == ACCESS_RANDOM) {
+    __atomic_store_n(&seqCount, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&raEnd, 0, __ATOMIC_RELAXED);
+    return;
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
+  if (__sync_add_and_fetch(&seqCount, 1) < SEQUENTIAL_TRIGGER &&
+      pattern != ACCESS_SEQUENTIAL && pattern != ACCESS_SCAN) return;
+
+  // keep up to a window of pages in flight and top it up when
+  // half of it has been consumed. a scan recycles the frames of its
+  // ring, so the window must leave room for the pages being read.
+  window = pool().getFrameCount() / 4;
+  if (window > READ_AHEAD_PAGES) window = READ_AHEAD_PAGES;
+  if (scanRing() != NULL && window > scanRing()->getSize() / 2) {
+    window = scanRing()->getSize() / 2;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  end = __atomic_load_n(&raEnd, __ATOMIC_RELAXED);
+  if (end - pid > window / 2) return;
+
+  from = (end > pid) ? end : pid + 1;
+  to = pid + 1 + window;
+  if (to > epid) to = epid;
+  limit = __atomic_load_n(&raLimit, __ATOMIC_RELAXED);
+  if (limit >= 0 && to > limit) to = limit;
+  if (from >= to) return;
 
-  // increase the page read count
-  readCount++;
+  // only one of the threads reading the file issues the request
+  if (__sync_bool_compare_and_swap(&raEnd, end, to)) {
+    readAhead().request(fd, from, to - from, scanRing());
+  }
+}
 
+RC PageFile::prefetch(PageId pid, int count) const
+{
+  size_t osPage, from, to;
+
+  if (fd < 0) return RC_FILE_READ_FAILED;
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+  if (count > epid - pid) count = epid - pid;
+  if (count <= 0) return 0;
+
+  // let the kernel read a memory mapped file; madvise() takes
+  // addresses aligned to the OS page size
+  if (map != NULL) {
+    osPage = (size_t)sysconf(_SC_PAGESIZE);
+    from = (size_t)pid * PAGE_SIZE / osPage * osPage;
+    to = (size_t)(pid + count) * PAGE_SIZE;
+    if (::madvise(map + from, to - from, MADV_WILLNEED) < 0) return RC_FILE_READ_FAILED;
+    return 0;
+  }
+
+  readAhead().request(fd, pid, count, scanRing());
   return 0;
 }
+
+void PageFile::limitReadAhead(PageId end) const
+{
+  __atomic_store_n(&raLimit, end, __ATOMIC_RELAXED);
+}
+
+RC PageFile::advise(int pattern) const
+{
+  int advice;
+
+  BufferRing* r;
+
+  if (fd < 0) return RC_FILE_READ_FAILED;
+
+  // the ring of a scan is kept until the file is closed, as other threads
+  // may be using it
+  if (pattern == ACCESS_SCAN && map == NULL && ring == NULL) {
+    r = new (std::nothrow) BufferRing(pool().getFrameCount());
+    if (r != NULL && !__sync_bool_compare_and_swap(&ring, (BufferRing*)NULL, r)) delete r;
+  }
+  this->pattern = pattern;
+  __atomic_store_n(&raLimit, -1, __ATOMIC_RELAXED);
+
+  // tell the kernel how the pages will be accessed, through madvise()
+  // for a memory mapped file and posix_fadvise() otherwise
+  if (map != NULL) {
+    switch (pattern) {
+    case ACCESS_SEQUENTIAL:
+    case ACCESS_SCAN:       advice = MADV_SEQUENTIAL; break;
+    case ACCESS_RANDOM:     advice = MADV_RANDOM; break;
+    default:                advice = MADV_NORMAL; break;
+    }
+    if (::madvise(map, (size_t)epid * PAGE_SIZE, advice) < 0) return RC_FILE_READ_FAILED;
+  } else {
+    switch (pattern) {
+    case ACCESS_SEQUENTIAL:
+    case ACCESS_SCAN:       advice = POSIX_FADV_SEQUENTIAL; break;
+    case ACCESS_RANDOM:     advice = POSIX_FADV_RANDOM; break;
+    default:                advice = POSIX_FADV_NORMAL; break;
+    }
+    if (::posix_fadvise(fd, 0, 0, advice) != 0) return RC_FILE_READ_FAILED;
+  }
+
+  return 0;
+}
+
+RC PageFile::setCacheSize(size_t bytes)
+{
+  return pool().resize((int)(bytes / PAGE_SIZE));
+}
+
+size_t PageFile::getCacheSize()
+{
+  return (size_t)pool().getFrameCount() * PAGE_SIZE;
+}
+
+BufferPool& PageFile::pool()
+{
+  // the pool is allocated with the default size on first use.
+  // the initialization of a local static is thread-safe.
+  static BufferPool bufferPool((int)(DEFAULT_CACHE_SIZE / PAGE_SIZE));
+
+  return bufferPool;
+}
+
+ReadAhead& PageFile::readAhead()
+{
+  // constructed after the pool, so its threads are stopped before
+  // the pool is destroyed
+  static ReadAhead readAhead(pool());
+
+  return readAhead;
+}
@@ -11,32 +11,136 @@
 #define PAGEFILE_H
 
 #include <string>
+#include <cstddef>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
+// the size of a page is chosen when Bruinbase is built, e.g.,
+// "make PAGE_SIZE=4096". files record the page size they were created
+// with and cannot be opened by a build with a different page size.
+#ifndef BRUINBASE_PAGE_SIZE
+#define BRUINBASE_PAGE_SIZE 1024
+#endif
+
+#if BRUINBASE_PAGE_SIZE != 1024 && BRUINBASE_PAGE_SIZE != 4096 && \
+    BRUINBASE_PAGE_SIZE != 8192 && BRUINBASE_PAGE_SIZE != 16384
+#error "BRUINBASE_PAGE_SIZE must be 1024, 4096, 8192 or 16384"
+#endif
+
+class BufferPool;
+class BufferRing;
+class ReadAhead;
+class PageFile;
+
 /**
- * read/write a file in the unit of a page
+ * A page pinned in the buffer pool by PageFile::pin().
+ * While the handle holds the page, its frame is never evicted and data()
+ * points straight into the cached frame, so the page can be used without
+ * copying it. The frame is also latched, in shared mode unless the page
+ * was pinned with PIN_EXCLUSIVE, so other threads cannot modify the page
+ * while the handle holds it. The page is unpinned by release() or when
+ * the handle is destroyed.
+ */
+class PageHandle {
+ public:
+  PageHandle();
+  ~PageHandle();
+
+  /**
+   * @return pointer to the PAGE_SIZE bytes of the pinned page,
+   *         or NULL if no page is pinned
+   */
+  char* data() const { return page; }
+
+  /**
+   * @return the id of the pinned page
+   */
+  PageId getPid() const { return pid; }
+
+  /**
+   * note that the content of the page was modified through data().
+   * the page is marked dirty in the buffer pool when it is unpinned.
+   * only a page pinned with PIN_EXCLUSIVE may be modified.
+   */
+  void markDirty() { dirty = true; }
+
+  /**
+   * unpin the page. this is a no-op if no page is pinned.
+   * @return error code. 0 if no error
+   */
+  RC release();
+
+ private:
+  friend class PageFile;
+
+  const PageFile* file;  // the file the page belongs to
+  int     frame;         // buffer pool frame holding the page
+  PageId  pid;           // id of the pinned page
+  char*   page;          // the content of the pinned page
+  bool    dirty;         // whether the page was modified
+  bool    exclusive;     // whether the page is latched for writing
+
+  // a pinned page has exactly one owner
+  PageHandle(const PageHandle&);
+  PageHandle& operator=(const PageHandle&);
+};
+
+/**
+ * read/write a file in the unit of a page.
+ * the functions of a PageFile may be called by several threads at once,
+ * except open() and close(), which no other thread may overlap with.
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int PAGE_SIZE = BRUINBASE_PAGE_SIZE;  // 1KB by default
+
+  // options of open()
+  static const int OPEN_MMAP = 0x1;     // serve pages from a memory mapping
+  static const int OPEN_DIRECT = 0x2;   // bypass the OS page cache (O_DIRECT)
+
+  // latch modes of pin()
+  static const int PIN_SHARED = 0;      // the page is only read
+  static const int PIN_EXCLUSIVE = 1;   // the page may be modified
+
+  // may be or'ed into the latch mode of pin(): keep the page in the pool
+  // in preference to other pages, e.g., for the inner nodes of an index
+  static const int PIN_PRIORITY = 2;
+
+  // access patterns for advise()
+  static const int ACCESS_NORMAL = 0;
+  static const int ACCESS_SEQUENTIAL = 1;
+  static const int ACCESS_RANDOM = 2;
+  static const int ACCESS_SCAN = 3;     // one sequential pass over the file
 
   PageFile();
-  PageFile(const std::string& filename, char mode);
+  PageFile(const std::string& filename, char mode, int options = 0);
+  ~PageFile();
 
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * with the OPEN_MMAP option, the file is mapped into memory and read()
+   * and pin() are served straight from the mapping instead of the buffer
+   * pool. the mapping is read-only, so OPEN_MMAP requires 'r' mode;
+   * files that are written keep using the buffer pool.
+   * with the OPEN_DIRECT option, the file is opened with O_DIRECT and its
+   * pages are not cached by the OS, so the buffer pool is the only cache
+   * and memory use is fixed by the size of the pool. every miss in the
+   * pool then waits for the disk; use it only with a pool that holds the
+   * working set, see setCacheSize(). the open fails if the file system
+   * does not support direct I/O or needs a coarser alignment than
+   * PAGE_SIZE. OPEN_DIRECT cannot be combined with OPEN_MMAP.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param options[IN] OPEN_* flags
    * @return error code. 0 if no error
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, int options = 0);
 
   /**
-   * close the file.
+   * close the file. the dirty pages of the file are written back first.
    * @return error code. 0 if no error
    */
   RC close();
@@ -53,12 +157,70 @@ class PageFile {
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * the page is kept dirty in the buffer pool and reaches the disk
+   * when it is evicted, or when flush() or close() is called.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * write every dirty page of the file back to the disk.
+   * runs of dirty pages with consecutive page ids are written
+   * with a single vectored write.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * pin a disk page in the buffer pool and give direct access to it.
+   * unlike read(), the page is not copied: page.data() points into the
+   * cached frame until the handle is released. any page previously held
+   * by the handle is released first.
+   * while the handle holds the page, other threads may read it, but only
+   * a page pinned with PIN_EXCLUSIVE may be modified and nobody else can
+   * access it until it is released.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] the handle holding the pinned page
+   * @param mode[IN] PIN_SHARED or PIN_EXCLUSIVE, optionally with PIN_PRIORITY
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, PageHandle& page, int mode = PIN_SHARED) const;
     
+  /**
+   * start reading pages [pid, pid + count) into the buffer pool in the
+   * background, so that a later read() or pin() of them does not wait
+   * for the disk. pages beyond the end of the file are ignored.
+   * this is only a hint and may be dropped when the pool is busy.
+   * @param pid[IN] the first page to read
+   * @param count[IN] the number of pages to read
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count = 1) const;
+
+  /**
+   * tell the OS how the pages of the file will be accessed, so that it can
+   * read ahead for sequential access or avoid it for random access.
+   * the buffer pool reads ahead on its own when it sees pages read in
+   * order; ACCESS_SEQUENTIAL makes it start right away and ACCESS_RANDOM
+   * turns it off. ACCESS_SCAN is sequential access by a single pass over
+   * the file: its pages are read into a small ring of frames that is
+   * recycled as the scan proceeds, so the scan does not evict the pages
+   * of other files from the pool.
+   * @param pattern[IN] one of the ACCESS_* patterns
+   * @return error code. 0 if no error
+   */
+  RC advise(int pattern) const;
+
+  /**
+   * keep read-ahead from reading the pages from end on, because the
+   * reader will skip them. the limit holds until it is changed or
+   * advise() is called.
+   * @param end[IN] the first page not to read ahead; -1 for no limit
+   */
+  void limitReadAhead(PageId end) const;
+
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
    * that is, the last page can be read by "read(endPid()-1, buffer)".
@@ -67,44 +229,129 @@ class PageFile {
   PageId endPid() const;
 
   /**
-   * @return the total # of disk reads
+   * @return the file descriptor of the file, -1 if it is not open.
+   *         IOStats identifies the file by it.
    */
-  static int getPageReadCount()  { return readCount; }
+  int descriptor() const { return fd; }
+
+  /**
+   * @return the total # of disk reads. for memory mapped files, where
+   *         the OS hides the actual I/O, every page access is counted.
+   */
+  static int getPageReadCount()  { return __atomic_load_n(&readCount, __ATOMIC_RELAXED); }
   
   /**
    * @return the total # of disk writes
    */
-  static int getPageWriteCount() { return writeCount; }
+  static int getPageWriteCount() { return __atomic_load_n(&writeCount, __ATOMIC_RELAXED); }
+
+  /**
+   * resize the buffer pool shared by all PageFiles.
+   * the pool is rounded down to a whole number of pages and
+   * every page currently cached is dropped.
+   * @param bytes[IN] the size of the pool in bytes
+   * @return error code. 0 if no error
+   */
+  static RC setCacheSize(size_t bytes);
+
+  /**
+   * @return the size of the buffer pool in bytes
+   */
+  static size_t getCacheSize();
 
  protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * find page pid in the buffer pool, reading it from the disk on a miss.
+   * the frame is returned pinned and latched; the caller unlatches and
+   * unpins it when done.
+   * @param pid[IN] page to fetch
+   * @param exclusive[IN] whether to latch the frame for writing
+   * @param frame[OUT] the frame holding the page
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  RC fetch(PageId pid, bool exclusive, int& frame) const;
+
+  /**
+   * note an access to page pid for read-ahead. after a few pages read in
+   * order, the following READ_AHEAD_PAGES pages are prefetched, and more
+   * are requested whenever half of them have been consumed.
+   * @param pid[IN] the page accessed
+   */
+  void noteAccess(PageId pid) const;
+
+  /**
+   * read a page from the disk into the buffer, bypassing the pool.
+   * with O_DIRECT the page goes through an aligned bounce buffer.
+   * @param pid[IN] the page to read
+   * @param buffer[OUT] pointer to memory buffer
+   * @return error code. 0 if no error
+   */
+  RC readThrough(PageId pid, void* buffer) const;
+
+  /**
+   * write the buffer to a disk page, bypassing the pool.
+   * with O_DIRECT the page goes through an aligned bounce buffer.
+   * @param pid[IN] the page to write to
+   * @param buffer[IN] the content to write
+   * @return error code. 0 if no error
+   */
+  RC writeThrough(PageId pid, const void* buffer);
+
+  /**
+   * unpin the page held by a handle, marking it dirty if it was modified.
+   * @param page[IN] the handle to release
+   * @return error code. 0 if no error
+   */
+  RC unpin(PageHandle& page) const;
 
  private:
+  friend class PageHandle;
+  friend class BufferPool;
+  friend class ReadAhead;
+
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  PageId  epid;   // (last page id + 1) of the file; only ever grows
+  bool    writable; // whether the file was opened in 'w' mode
+  char*   map;    // the memory mapping of an OPEN_MMAP file, NULL otherwise
+  bool    direct; // whether the file was opened with O_DIRECT
+
+  // read-ahead state, updated atomically by the threads reading the file
+  mutable int    pattern;  // ACCESS_* pattern given to advise()
+  mutable PageId lastPid;  // the page accessed last
+  mutable int    seqCount; // # of pages accessed in order up to lastPid
+  mutable PageId raEnd;    // (last page id + 1) requested from read-ahead
+  mutable PageId raLimit;  // read-ahead stops before this page; -1 if not
+  mutable BufferRing* ring; // frames recycled by ACCESS_SCAN, set once
+
+  // a PageFile owns its file descriptor; copying is not allowed
+  PageFile(const PageFile&);
+  PageFile& operator=(const PageFile&);
+
+  // the default size of the buffer pool in bytes
+  static const size_t DEFAULT_CACHE_SIZE = 8 * 1024 * 1024;
+
+  // # of pages read in order before read-ahead starts
+  static const int SEQUENTIAL_TRIGGER = 2;
+
+  // # of pages kept in flight ahead of a sequential reader.
+  // at most a quarter of the pool is used for read-ahead.
+  static const int READ_AHEAD_PAGES = 32;
 
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
+  // the buffer pool caching the pages of every open file.
+  // it is allocated on first use with DEFAULT_CACHE_SIZE
+  // unless setCacheSize() was called before.
+  static BufferPool& pool();
 
-  static int cacheClock; // clock tick counter for LRU policy
+  // the background threads reading ahead into the pool, started on the
+  // first prefetch
+  static ReadAhead& readAhead();
 
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  // the ring pages are read into, or NULL unless the file is scanned
+  BufferRing* scanRing() const {
+    return pattern == ACCESS_SCAN ? __atomic_load_n(&ring, __ATOMIC_ACQUIRE) : NULL;
+  }
 
+  // updated atomically, as pages are read and written by many threads
   static int readCount;  // total # of page reads 
   static int writeCount; // total # of page writes 
 };
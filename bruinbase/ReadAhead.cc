@@ -0,0 +1,161 @@
+#include "ReadAhead.h"
+#include "BufferPool.h"
+#include "IOStats.h"
+#include <algorithm>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// the longest run of pages read by one preadv() call
+static const int MAX_RUN = 64;
+
+ReadAhead::ReadAhead(BufferPool& bp) : pool(bp)
+{
+  started = 0;
+  stopping = false;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&wake, NULL);
+  pthread_cond_init(&done, NULL);
+}
+
+ReadAhead::~ReadAhead()
+{
+  pthread_mutex_lock(&mutex);
+  stopping = true;
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&mutex);
+
+  for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+  pthread_cond_destroy(&done);
+  pthread_cond_destroy(&wake);
+  pthread_mutex_destroy(&mutex);
+}
+
+void ReadAhead::request(int fd, PageId pid, int count, BufferRing* ring)
+{
+  Request r;
+
+  if (count <= 0) return;
+
+  pthread_mutex_lock(&mutex);
+
+  // start the threads on first use. if no thread can be started,
+  // requests are simply dropped.
+  while (started < THREAD_COUNT && !stopping) {
+    if (pthread_create(&threads[started], NULL, run, this) != 0) break;
+    started++;
+  }
+
+  if (started > 0 && !stopping && (int)queue.size() < MAX_QUEUE) {
+    r.fd = fd;
+    r.pid = pid;
+    r.count = count;
+    r.ring = ring;
+    queue.push_back(r);
+    pthread_cond_signal(&wake);
+  }
+
+  pthread_mutex_unlock(&mutex);
+}
+
+void ReadAhead::cancel(int fd)
+{
+  std::deque<Request>::iterator it;
+
+  pthread_mutex_lock(&mutex);
+  for (it = queue.begin(); it != queue.end(); ) {
+    if (it->fd == fd) it = queue.erase(it);
+    else ++it;
+  }
+  while (std::find(active.begin(), active.end(), fd) != active.end()) {
+    pthread_cond_wait(&done, &mutex);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void* ReadAhead::run(void* self)
+{
+  ((ReadAhead*)self)->serve();
+  return NULL;
+}
+
+void ReadAhead::serve()
+{
+  Request r;
+
+  pthread_mutex_lock(&mutex);
+  for (;;) {
+    while (queue.empty() && !stopping) pthread_cond_wait(&wake, &mutex);
+    if (stopping) break;
+
+    r = queue.front();
+    queue.pop_front();
+    active.push_back(r.fd);
+    pthread_mutex_unlock(&mutex);
+
+    load(r);
+
+    pthread_mutex_lock(&mutex);
+    active.erase(std::find(active.begin(), active.end(), r.fd));
+    pthread_cond_broadcast(&done);
+  }
+  pthread_mutex_unlock(&mutex);
+}
+
+void ReadAhead::load(const Request& r)
+{
+  int    run[MAX_RUN];
+  int    n, f;
+  bool   isNew;
+  PageId pid, first = r.pid;
+
+  // pin a new frame for every page that is not cached and read each run
+  // of consecutive new frames at once. the frames stay latched until
+  // they are filled, so nobody reads a page that is still being loaded.
+  for (pid = r.pid, n = 0; pid < r.pid + r.count; pid++) {
+    // stop when every frame of the pool is pinned
+    if ((f = pool.pinPage(r.fd, pid, isNew, r.ring)) < 0) break;
+
+    // a cached page ends the current run
+    if (!isNew) {
+      pool.unpin(f);
+      if (n > 0) loadRun(r.fd, first, run, n);
+      n = 0;
+      continue;
+    }
+
+    if (n == 0) first = pid;
+    run[n++] = f;
+    if (n == MAX_RUN) {
+      loadRun(r.fd, first, run, n);
+      n = 0;
+    }
+  }
+  if (n > 0) loadRun(r.fd, first, run, n);
+}
+
+void ReadAhead::loadRun(int fd, PageId pid, int* run, int n)
+{
+  struct iovec iov[MAX_RUN];
+  ssize_t size = (ssize_t)n * PageFile::PAGE_SIZE;
+  long long start;
+  bool ok;
+
+  for (int i = 0; i < n; i++) {
+    iov[i].iov_base = pool.frameData(run[i]);
+    iov[i].iov_len = PageFile::PAGE_SIZE;
+  }
+
+  // a short read leaves the frames unfilled; drop them
+  start = IOStats::now();
+  ok = (::preadv(fd, iov, n, (off_t)pid * PageFile::PAGE_SIZE) == size);
+  for (int i = 0; i < n; i++) {
+    pool.finishLoad(run[i], ok);
+    pool.unpin(run[i]);
+  }
+
+  if (ok) {
+    __sync_fetch_and_add(&PageFile::readCount, n);
+    IOStats::call(fd, IOStats::PREFETCH, n, start);
+  }
+}
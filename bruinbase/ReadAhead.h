@@ -0,0 +1,80 @@
+#ifndef READAHEAD_H
+#define READAHEAD_H
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+class BufferPool;
+class BufferRing;
+
+/**
+ * Background threads that read pages into the buffer pool before they
+ * are asked for. A request names a run of consecutive pages of a file;
+ * the pages not cached yet are read with one preadv() call per run.
+ * While a page is being loaded its frame is latched, so a thread that
+ * asks for it waits for the load to finish instead of reading it again.
+ *
+ * Read-ahead is only a hint: requests are dropped when the queue is full
+ * or the pool has no free frame, and errors are ignored.
+ */
+class ReadAhead {
+ public:
+
+  static const int THREAD_COUNT = 2;     // # of background I/O threads
+  static const int MAX_QUEUE = 64;       // # of requests that may wait
+
+  ReadAhead(BufferPool& pool);
+  ~ReadAhead();
+
+  /**
+   * queue pages [pid, pid + count) of file fd to be read into the pool.
+   * the threads are started on the first request.
+   * @param fd[IN] file descriptor of the file
+   * @param pid[IN] the first page to read
+   * @param count[IN] the number of pages to read
+   * @param ring[IN] the ring of frames of a scanned file, or NULL.
+   *        it must live until cancel(fd) returns.
+   */
+  void request(int fd, PageId pid, int count, BufferRing* ring = NULL);
+
+  /**
+   * drop the queued requests for file fd and wait until the requests for
+   * it that are being served are done. called before fd is closed.
+   * @param fd[IN] file descriptor of the file
+   */
+  void cancel(int fd);
+
+ private:
+  struct Request {
+    int    fd;     // file to read from
+    PageId pid;    // first page of the run
+    int    count;  // # of pages in the run
+    BufferRing* ring; // frames to read the pages into, or NULL
+  };
+
+  BufferPool& pool;
+
+  std::deque<Request> queue;  // requests not served yet
+  std::vector<int> active;    // files of the requests being served
+
+  pthread_mutex_t mutex;      // guards everything below
+  pthread_cond_t  wake;       // signaled when a request is queued
+  pthread_cond_t  done;       // signaled when a request is served
+  pthread_t threads[THREAD_COUNT];
+  int       started;          // # of threads running
+  bool      stopping;         // set when the threads should exit
+
+  static void* run(void* self);
+  void serve();
+  void load(const Request& r);
+  void loadRun(int fd, PageId pid, int* run, int n);
+
+  // the threads refer to the object; copying is not allowed
+  ReadAhead(const ReadAhead&);
+  ReadAhead& operator=(const ReadAhead&);
+};
+
+#endif // READAHEAD_H
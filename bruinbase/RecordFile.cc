@@ -9,10 +9,72 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include "IOStats.h"
+#include <climits>
 #include <cstring>
 
 using std::string;
 
+//
+// page 0 of a table file is a header page holding a magic number, the
+// page size and the page format. tables written before the header
+// existed start right away with a data page and always use 1KB pages.
+//
+// the header of a slotted or PAX file also holds the id of the last data
+// page and the codec of its data pages. the dictionary of a DICT file
+// follows: its length in bytes, or -1 before it is trained, and its bytes.
+//
+static const int HEADER_MAGIC = 0x4242544c;
+static const int HEADER_INTS = 6;
+static const int LEGACY_PAGE_SIZE = 1024;
+
+//
+// a page of a slotted file starts with an 8-byte page header:
+//   byte 0      page type, PAGE_DATA or PAGE_OVERFLOW
+//   bytes 2-3   data page: # slots. overflow page: # value bytes in the page
+//   bytes 4-5   data page: offset of the record area
+//   bytes 4-7   overflow page: the next overflow page, or -1
+// the slot directory follows the header of a data page, one (offset,
+// length) pair of 16-bit integers per record, and the records fill the
+// page from its end towards the directory. a record is its key followed
+// by the bytes of its value. a value that would take more than
+// MAX_INLINE bytes goes to a chain of overflow pages; its record holds
+// the key, the length of the value and the first overflow page, and its
+// slot length has OVERFLOW_BIT set.
+//
+// a data page of a PAX file has the same header, followed by two
+// minipages: the keys of all records as an array of integers, and the
+// values one after another. an array of (# slots + 1) 16-bit offsets
+// between the two tells where each value starts and ends; the end
+// offset of a value kept in overflow pages has OVERFLOW_BIT set, and
+// the value bytes are then its length and its first overflow page.
+// the minipages are shifted as records are added, so that the keys
+// stay contiguous.
+//
+// the data pages of a compressed file are DECODED_PAGE_SIZE bytes, and
+// every one is stored in a disk page of type PAGE_COMPRESSED, whose bytes
+// 2-3 still hold # slots, bytes 4-5 the length of the compressed page and
+// whose compressed bytes follow the header. the free space in the middle
+// of a data page is left out before it is compressed. a page is filled
+// up to a number of bytes guessed from how well the pages before it
+// compressed, and is compressed once, when it is written. if it then
+// does not fit in a disk page, its last records move to the next page.
+// overflow pages are not compressed.
+//
+static const char PAGE_DATA = 1;
+static const char PAGE_OVERFLOW = 2;
+static const char PAGE_COMPRESSED = 3;
+static const int  PAGE_HEADER_SIZE = 8;
+static const int  SLOT_SIZE = 2 * sizeof(unsigned short);
+static const int  MAX_INLINE = PageFile::PAGE_SIZE / 4;
+static const int  OVERFLOW_BIT = 0x8000;
+static const int  OVERFLOW_ENTRY_SIZE = 2 * sizeof(int);
+static const int  OVERFLOW_CAPACITY = PageFile::PAGE_SIZE - PAGE_HEADER_SIZE;
+static const int  COMPRESSED_CAPACITY = PageFile::PAGE_SIZE - PAGE_HEADER_SIZE;
+static const int  DICT_SAMPLE = 64 * 1024;
+// slot offsets are 15-bit, which bounds the size of a decoded page
+static const int  DECODED_PAGE_SIZE = (4 * PageFile::PAGE_SIZE < 32768) ? 4 * PageFile::PAGE_SIZE : 32768;
+
 //
 // helper functions for page manipultation
 //
@@ -32,6 +94,42 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+// helper functions for slotted pages
+
+// initialize an empty page of the given type and size
+static void initPage(char* page, char type, int size = PageFile::PAGE_SIZE);
+
+// get the type of a slotted page
+static char getPageType(const char* page);
+
+// check whether a page is a data page, compressed or not
+static bool isDataPage(const char* page);
+
+// get # slots of a data page
+static int getSlotCount(const char* page);
+
+// check whether a data page of size bytes has room for one more record
+// whose value takes length bytes
+static bool hasRoom(int format, const char* page, int length, int size);
+
+// get # bytes the header and the records of a data page take
+static int usedBytes(int format, const char* page, int size);
+
+// copy a data page without its free space. returns # bytes copied.
+static int packPage(int format, const char* page, int size, char* packed);
+
+// restore a data page copied by packPage(). returns false if the bytes
+// are not a packed page.
+static bool unpackPage(int format, const char* packed, int n, char* page, int size);
+
+// add a record to a data page. overflow tells whether the value bytes
+// are the length and first overflow page of the actual value.
+static void addEntry(int format, char* page, int key, const char* value, int length, bool overflow);
+
+// get the record in the n'th slot of a data page. the value is not copied.
+static void getEntry(int format, const char* page, int n, int& key,
+                     const char*& value, int& length, bool& overflow);
+
 
 //
 // helper functions for RecordId manipulation
@@ -107,39 +205,119 @@ RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  firstPid = 0;
+  format = FORMAT_SLOTTED;
+  fillTarget = 2 * COMPRESSED_CAPACITY;
+  zoned = false;
+  resetCache();
 }
 
-RecordFile::RecordFile(const string& filename, char mode)
+RecordFile::RecordFile(const string& filename, char mode, int options, int newFormat, int newCodec)
 {
-  open(filename, mode);
+  open(filename, mode, options, newFormat, newCodec);
 }
 
-RC RecordFile::open(const string& filename, char mode)
+RC RecordFile::open(const string& filename, char mode, int options, int newFormat, int newCodec)
 {
   RC   rc;
   char page[PageFile::PAGE_SIZE];
+  int  header[HEADER_INTS];
 
   // open the page file
-  if ((rc = pf.open(filename, mode)) < 0) return rc;
+  if ((rc = pf.open(filename, mode, options)) < 0) return rc;
   
+  erid.pid = erid.sid = 0;
+  firstPid = 0;
+  format = FORMAT_SLOTTED;
+  codec = PageCodec(PageCodec::NONE);
+  fillTarget = 2 * COMPRESSED_CAPACITY;
+  resetCache();
+
+  // a new file starts with the header page
+  if (pf.endPid() == 0) {
+    if (mode == 'w' || mode == 'W') {
+      if ((newFormat != FORMAT_SLOTTED && newFormat != FORMAT_PAX) ||
+          newCodec < PageCodec::NONE || newCodec > PageCodec::DICT) {
+        pf.close();
+        return RC_INVALID_FILE_FORMAT;
+      }
+      format = newFormat;
+      codec = PageCodec(newCodec);
+      firstPid = 1;
+      if ((rc = writeHeader()) < 0) { pf.close(); return rc; }
+      IOStats::setCodec(pf.descriptor(), newCodec);
+    }
+    openZones(filename, mode, true);
+    return 0;
+  }
+
+  // check the header page. a file without it is a legacy file whose
+  // data starts at page 0.
+  if ((rc = pf.read(0, page)) < 0) { pf.close(); return rc; }
+  memcpy(header, page, sizeof(header));
+  if (header[0] == HEADER_MAGIC) {
+    // files written before compression have 0 (PageCodec::NONE) as codec
+    if (header[1] != PageFile::PAGE_SIZE ||
+        (header[2] != FORMAT_FIXED && header[2] != FORMAT_SLOTTED && header[2] != FORMAT_PAX) ||
+        (header[4] != PageCodec::NONE &&
+         (header[2] == FORMAT_FIXED || header[4] < PageCodec::NONE || header[4] > PageCodec::DICT))) {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    firstPid = 1;
+    format = header[2];
+    codec = PageCodec(header[4]);
+    if (header[4] == PageCodec::DICT && header[5] >= 0 &&
+        !codec.load(page + sizeof(header), header[5])) {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+  } else if (PageFile::PAGE_SIZE != LEGACY_PAGE_SIZE) {
+    pf.close();
+    return RC_INVALID_FILE_FORMAT;
+  } else {
+    format = FORMAT_FIXED;
+  }
+  IOStats::setCodec(pf.descriptor(), codec.getCodec());
+
   //
   // in the rest of this function, we set the end record id
   //
 
+  // the last data page of a slotted or PAX file is recorded in the
+  // header, as overflow pages may follow it
+  if (format != FORMAT_FIXED) {
+    if (pf.endPid() == firstPid) {
+      openZones(filename, mode, false);
+      return 0;
+    }
+    erid.pid = header[3];
+    if (erid.pid < 0 || firstPid + erid.pid >= pf.endPid() ||
+        (rc = pf.read(firstPid + erid.pid, page)) < 0 || !isDataPage(page)) {
+      erid.pid = erid.sid = 0;
+      pf.close();
+      return rc < 0 ? rc : RC_INVALID_FILE_FORMAT;
+    }
+    erid.sid = getSlotCount(page);
+    openZones(filename, mode, false);
+    return 0;
+  }
+
   // get the end pid of the file
-  erid.pid = pf.endPid();
+  erid.pid = pf.endPid() - firstPid;
 
-  // if the end pid is zero, the file is empty.
+  // if there is no data page, the table is empty.
   // set the end record id to (0, 0).
   if (erid.pid == 0) {
     erid.sid = 0;
+    openZones(filename, mode, false);
     return 0;
   }
 
   // obtain # records in the last page to set sid of the end record id.
   // read the last page of the file and get # records in the page.
   // remeber that the id of the last page is endPid()-1 not endPid().
-  if ((rc = pf.read(--erid.pid, page)) < 0) {
+  if ((rc = pf.read(firstPid + --erid.pid, page)) < 0) {
     // an error occurred during page read
     erid.pid = erid.sid = 0;
     pf.close();
@@ -154,6 +332,60 @@ RC RecordFile::open(const string& filename, char mode)
     erid.sid = 0;
   }
   
+  openZones(filename, mode, false);
+  return 0;
+}
+
+void RecordFile::openZones(const string& filename, char mode, bool created)
+{
+  bool writable = (mode == 'w' || mode == 'W');
+
+  // the zone map of a table is kept in <table>.zm next to <table>.tbl.
+  // in 'r' mode it is used only if it describes the table. in 'w' mode
+  // it is rebuilt from the table if it does not, e.g. for tables loaded
+  // before zone maps.
+  string name = filename;
+  if (name.size() > 4 && name.compare(name.size() - 4, 4, ".tbl") == 0) {
+    name.erase(name.size() - 4);
+  }
+  zoned = false;
+  if (zones.open(name + ".zm", mode) < 0) return;
+  if (!created && zones.savedFor(erid.pid, erid.sid)) {
+    zoned = true;
+  } else if (writable && buildZones() < 0) {
+    zones.clear();
+  }
+}
+
+RC RecordFile::buildZones()
+{
+  RC          rc;
+  PageHandle  page;
+  const char* data;
+  const char* value;
+  int         key, count, length;
+  bool        overflow;
+
+  zones.clear();
+  for (PageId pid = 0; pid <= erid.pid && firstPid + pid < pf.endPid(); pid++) {
+    if ((rc = fetchData(pid, page, data)) < 0) return rc;
+    if (format == FORMAT_FIXED) {
+      count = getRecordCount(data);
+      for (int sid = 0; sid < count && sid < RECORDS_PER_PAGE; sid++) {
+        memcpy(&key, slotPtr(const_cast<char*>(data), sid), sizeof(int));
+        zones.add(pid, key);
+      }
+    } else if (getPageType(data) == PAGE_DATA) {
+      count = getSlotCount(data);
+      for (int sid = 0; sid < count; sid++) {
+        getEntry(format, data, sid, key, value, length, overflow);
+        zones.add(pid, key);
+      }
+    }
+  }
+
+  if ((rc = zones.save(erid.pid, erid.sid)) < 0) return rc;
+  zoned = true;
   return 0;
 }
 
@@ -161,30 +393,118 @@ RC RecordFile::close()
 {
   erid.pid = 0;
   erid.sid = 0;
+  resetCache();
+  zones.close();
+  zoned = false;
 
   return pf.close();
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC         rc;
+  PageHandle page;
+  const char* data;
+  const char* ptr;
+  int        length, vlength;
+  bool       overflow;
+  PageId     first;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0) return RC_INVALID_RID;
+  if (format == FORMAT_FIXED && rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record, or get it decompressed
+  if ((rc = fetchData(rid.pid, page, data)) < 0) return rc;
 
   // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  if (format == FORMAT_FIXED) {
+    readSlot(data, rid.sid, key, value);
+    return 0;
+  }
 
+  if (getPageType(data) != PAGE_DATA || rid.sid >= getSlotCount(data)) {
+    return RC_INVALID_RID;
+  }
+  getEntry(format, data, rid.sid, key, ptr, length, overflow);
+  if (!overflow) {
+    value.assign(ptr, length);
+    return 0;
+  }
+
+  // the value is stored in overflow pages
+  memcpy(&vlength, ptr, sizeof(int));
+  memcpy(&first, ptr + sizeof(int), sizeof(int));
+  page.release();
+  return readOverflow(first, vlength, value);
+}
+
+RC RecordFile::next(RecordId& rid) const
+{
+  RC         rc;
+  PageHandle page;
+  PageId     pid;
+
+  if (format == FORMAT_FIXED) {
+    ++rid;
+    return 0;
+  }
+  if (rid >= erid) {
+    rid = erid;
+    return 0;
+  }
+
+  // the next slot of the same page
+  if ((rc = pf.pin(firstPid + rid.pid, page)) < 0) return rc;
+  if (isDataPage(page.data()) && rid.sid + 1 < getSlotCount(page.data())) {
+    rid.sid++;
+    return 0;
+  }
+
+  // or the first slot of the next data page, skipping overflow pages
+  for (pid = rid.pid + 1; pid <= erid.pid; pid++) {
+    if ((rc = pf.pin(firstPid + pid, page)) < 0) return rc;
+    if (isDataPage(page.data()) && getSlotCount(page.data()) > 0) {
+      rid.pid = pid;
+      rid.sid = 0;
+      return 0;
+    }
+  }
+
+  rid = erid;
   return 0;
 }
 
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
+{
+  return appendBatch(1, &key, &value, &rid);
+}
+
+RC RecordFile::appendBatch(int n, const int* keys, const std::string* values, RecordId* rids)
+{
+  RC rc;
+
+  if (n <= 0) return 0;
+  if (format == FORMAT_FIXED) rc = appendFixed(n, keys, values, rids);
+  else rc = appendSlotted(n, keys, values, rids);
+  if (rc < 0) {
+    // the records appended are unknown. the map is rebuilt when the
+    // file is opened next.
+    zoned = false;
+    return rc;
+  }
+
+  // the zone map follows the table
+  if (zoned) {
+    for (int i = 0; i < n; i++) zones.add(rids[i].pid, keys[i]);
+    if ((rc = zones.save(erid.pid, erid.sid)) < 0) return rc;
+  }
+  return 0;
+}
+
+RC RecordFile::appendFixed(int n, const int* keys, const std::string* values, RecordId* rids)
 {
   RC   rc;
   char page[PageFile::PAGE_SIZE];
@@ -192,37 +512,511 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
   // unless we are writing to the the first slot of an empty page,
   // we have to read the page first
   if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+    if ((rc = pf.read(firstPid + erid.pid, page)) < 0) return rc;
   } else {
     // if this is the first slot of an empty page
     // we can simply initialize the page with zeros
     memset(page, 0, PageFile::PAGE_SIZE);
   }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
+  for (int i = 0; i < n; i++) {
+    // write the record to the first empty slot 
+    writeSlot(page, erid.sid, keys[i], values[i]);
 
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
-    
-  // we need to output the rid of the record slot
-  rid = erid;
+    // the first four bytes in the page stores # records in the page.
+    // update this number.
+    setRecordCount(page, erid.sid + 1);
+
+    // write the page once it is full, or after the last record
+    if (erid.sid + 1 >= RECORDS_PER_PAGE || i == n - 1) {
+      if ((rc = pf.write(firstPid + erid.pid, page)) < 0) return rc;
+      memset(page, 0, PageFile::PAGE_SIZE);
+    }
+
+    // we need to output the rid of the record slot
+    rids[i] = erid;
+
+    // advance the end record id by one to the next empty slot
+    ++erid;
+  }
+
+  return 0;
+}
+
+RC RecordFile::appendSlotted(int n, const int* keys, const std::string* values, RecordId* rids)
+{
+  RC     rc;
+  char   page[DECODED_PAGE_SIZE];
+  int    size, length, entry[2], first;
+  bool   overflow, newTail;
+  const char* value;
+  PageId tail, end, start, last;
+
+  // records are added to the last data page, which is started in
+  // memory if the file has none yet. end is the first page after the
+  // file, where new data and overflow pages go.
+  size = (codec.getCodec() == PageCodec::NONE) ? PageFile::PAGE_SIZE : DECODED_PAGE_SIZE;
+  tail = erid.pid;
+  newTail = (pf.endPid() == firstPid);
+  if (newTail) {
+    tail = 0;
+    initPage(page, PAGE_DATA, size);
+  } else if ((rc = readData(tail, page)) < 0) {
+    return rc;
+  }
+  // the records before first were appended before, and stay in the page
+  first = getSlotCount(page);
+  start = tail;
+  end = pf.endPid();
+  if (end < firstPid + tail + 1) end = firstPid + tail + 1;
+
+  // the dictionary of a new DICT file is built from the first values
+  // appended, and saved in the header with the new tail
+  if (codec.needsTraining()) {
+    std::string sample;
+    for (int i = 0; i < n && (int)sample.size() < DICT_SAMPLE; i++) sample += values[i];
+    if ((int)sample.size() > DICT_SAMPLE) sample.resize(DICT_SAMPLE);
+    codec.train(sample.data(), sample.size());
+  }
+
+  for (int i = 0; i < n; i++) {
+    // a long value is moved to overflow pages
+    overflow = (int)(sizeof(int) + values[i].size()) > MAX_INLINE;
+    length = overflow ? OVERFLOW_ENTRY_SIZE : values[i].size();
+    value = values[i].data();
+    if (overflow) {
+      entry[0] = values[i].size();
+      if ((rc = writeOverflow(values[i], end, entry[1])) < 0) return rc;
+      value = (const char*)entry;
+    }
+
+    // write a full page and start a new one, unless records of the
+    // page moved to a new one as it did not fit once compressed
+    while (!addRecord(page, keys[i], value, length, overflow)) {
+      last = tail;
+      if ((rc = writeTail(tail, end, page, first, rids + i)) < 0) return rc;
+      if (tail == last) {
+        tail = end++ - firstPid;
+        initPage(page, PAGE_DATA, size);
+        first = 0;
+      }
+    }
+
+    // output the rid of the record and advance the end record id
+    rids[i].pid = tail;
+    rids[i].sid = getSlotCount(page) - 1;
+    erid.pid = tail;
+    erid.sid = rids[i].sid + 1;
+  }
+
+  // write the last page, and the page its last records move to if any
+  do {
+    last = tail;
+    if ((rc = writeTail(tail, end, page, first, rids + n)) < 0) return rc;
+  } while (tail != last);
+
+  // the header points at the new last data page
+  if (newTail || tail != start) return writeHeader();
+  return 0;
+}
+
+RC RecordFile::writeTail(PageId& tail, PageId& end, char* page, int& first, RecordId* next)
+{
+  RC          rc;
+  char        saved[DECODED_PAGE_SIZE];
+  int         count, keep, key, length;
+  bool        overflow;
+  const char* value;
+
+  if ((rc = writeData(tail, page)) != RC_NODE_FULL) return rc;
 
-  // advance the end record id by one to the next empty slot
-  ++erid;
+  // the page is too large once compressed. its last records are left
+  // out until it fits. the records before first fit before, and their
+  // ids are known already, so they stay.
+  memcpy(saved, page, DECODED_PAGE_SIZE);
+  count = getSlotCount(saved);
+  keep = count;
+  do {
+    keep -= (count - first + 7) / 8;
+    if (keep < first) keep = first;
+    if (keep == 0) return RC_INVALID_FILE_FORMAT;
+    initPage(page, PAGE_DATA, DECODED_PAGE_SIZE);
+    for (int s = 0; s < keep; s++) {
+      getEntry(format, saved, s, key, value, length, overflow);
+      addEntry(format, page, key, value, length, overflow);
+    }
+  } while ((rc = writeData(tail, page)) == RC_NODE_FULL && keep > first);
+  if (rc < 0) return rc;
+
+  // the records left out start a new page. they are the last appended,
+  // whose ids end right before next.
+  tail = end++ - firstPid;
+  initPage(page, PAGE_DATA, DECODED_PAGE_SIZE);
+  for (int s = keep; s < count; s++) {
+    getEntry(format, saved, s, key, value, length, overflow);
+    addEntry(format, page, key, value, length, overflow);
+    next[s - count].pid = tail;
+    next[s - count].sid = s - keep;
+  }
+  first = 0;
+  erid.pid = tail;
+  erid.sid = count - keep;
+  return 0;
+}
+
+RC RecordFile::writeOverflow(const std::string& value, PageId& end, PageId& first)
+{
+  RC     rc;
+  char   page[PageFile::PAGE_SIZE];
+  int    n, next;
+  size_t offset;
+  unsigned short used;
+
+  // the chain is written to consecutive pages from page end on
+  first = end;
+  for (offset = 0; offset < value.size(); offset += n) {
+    n = value.size() - offset;
+    if (n > OVERFLOW_CAPACITY) n = OVERFLOW_CAPACITY;
+    next = (offset + n < value.size()) ? end + 1 : -1;
+    used = n;
+
+    initPage(page, PAGE_OVERFLOW);
+    memcpy(page + 2, &used, sizeof(used));
+    memcpy(page + 4, &next, sizeof(int));
+    memcpy(page + PAGE_HEADER_SIZE, value.data() + offset, n);
+    if ((rc = pf.write(end++, page)) < 0) return rc;
+  }
 
   return 0;
 }
 
+RC RecordFile::readOverflow(PageId pid, int length, std::string& value) const
+{
+  RC         rc;
+  PageHandle page;
+  unsigned short used;
+
+  value.erase();
+  value.reserve(length);
+  while (pid >= 0 && (int)value.size() < length) {
+    if ((rc = pf.pin(pid, page)) < 0) return rc;
+    if (getPageType(page.data()) != PAGE_OVERFLOW) return RC_INVALID_FILE_FORMAT;
+    memcpy(&used, page.data() + 2, sizeof(used));
+    if (used > OVERFLOW_CAPACITY) return RC_INVALID_FILE_FORMAT;
+    value.append(page.data() + PAGE_HEADER_SIZE, used);
+    memcpy(&pid, page.data() + 4, sizeof(int));
+  }
+
+  return ((int)value.size() == length) ? 0 : RC_INVALID_FILE_FORMAT;
+}
+
+RC RecordFile::writeHeader()
+{
+  char page[PageFile::PAGE_SIZE];
+  int  header[HEADER_INTS];
+
+  header[0] = HEADER_MAGIC;
+  header[1] = PageFile::PAGE_SIZE;
+  header[2] = format;
+  header[3] = erid.pid;
+  header[4] = codec.getCodec();
+  header[5] = -1;
+  memset(page, 0, PageFile::PAGE_SIZE);
+  if (codec.getCodec() == PageCodec::DICT && !codec.needsTraining()) {
+    header[5] = codec.save(page + sizeof(header));
+  }
+  memcpy(page, header, sizeof(header));
+  return pf.write(0, page);
+}
+
+bool RecordFile::addRecord(char* page, int key, const char* value, int length, bool overflow) const
+{
+  if (codec.getCodec() == PageCodec::NONE) {
+    if (!hasRoom(format, page, length, PageFile::PAGE_SIZE)) return false;
+    addEntry(format, page, key, value, length, overflow);
+    return true;
+  }
+
+  // a compressed page is filled up to fillTarget bytes. a single record
+  // always fits in a disk page once compressed.
+  if (!hasRoom(format, page, length, DECODED_PAGE_SIZE)) return false;
+  if (getSlotCount(page) > 0 &&
+      usedBytes(format, page, DECODED_PAGE_SIZE) + SLOT_SIZE + (int)sizeof(int) + length > fillTarget) {
+    return false;
+  }
+  addEntry(format, page, key, value, length, overflow);
+  return true;
+}
+
+RC RecordFile::writeData(PageId pid, const char* page)
+{
+  char packed[DECODED_PAGE_SIZE];
+  char out[PageFile::PAGE_SIZE];
+  int  n, length;
+  unsigned short count;
+
+  if (codec.getCodec() == PageCodec::NONE) return pf.write(firstPid + pid, page);
+
+  n = packPage(format, page, DECODED_PAGE_SIZE, packed);
+  length = codec.compress(packed, n, out + PAGE_HEADER_SIZE, COMPRESSED_CAPACITY);
+  if (length < 0) return RC_NODE_FULL;
+
+  // the next pages are filled to the bytes this one would have taken to
+  // fill a disk page, less a margin. no codec more than doubles its
+  // input, so a page of less than half a disk page always fits, and
+  // tells little.
+  if (2 * n >= COMPRESSED_CAPACITY) {
+    fillTarget = (int)((long long)n * (COMPRESSED_CAPACITY - COMPRESSED_CAPACITY / 32) / (length > 0 ? length : 1));
+    if (fillTarget < COMPRESSED_CAPACITY / 2) fillTarget = COMPRESSED_CAPACITY / 2;
+    if (fillTarget > DECODED_PAGE_SIZE) fillTarget = DECODED_PAGE_SIZE;
+  }
+
+  // the compressed page keeps # slots of the data page, so that its
+  // records can be counted without decompressing it
+  memset(out, 0, PAGE_HEADER_SIZE);
+  out[0] = PAGE_COMPRESSED;
+  memcpy(out + 2, page + 2, sizeof(count));
+  count = length;
+  memcpy(out + 4, &count, sizeof(count));
+  memset(out + PAGE_HEADER_SIZE + length, 0, COMPRESSED_CAPACITY - length);
+
+  // a copy of the old page must not be used anymore
+  for (int i = 0; i < DECODE_CACHE_PAGES; i++) {
+    if (decodedPid[i] == pid) decodedPid[i] = -1;
+  }
+
+  IOStats::count(pf.descriptor(), &IOStats::rawBytes, n);
+  IOStats::count(pf.descriptor(), &IOStats::storedBytes, PAGE_HEADER_SIZE + length);
+  return pf.write(firstPid + pid, out);
+}
+
+RC RecordFile::readData(PageId pid, char* page) const
+{
+  RC   rc;
+  char packed[PageFile::PAGE_SIZE];
+
+  if (codec.getCodec() == PageCodec::NONE) return pf.read(firstPid + pid, page);
+
+  if ((rc = pf.read(firstPid + pid, packed)) < 0) return rc;
+  if (getPageType(packed) != PAGE_COMPRESSED) return RC_INVALID_FILE_FORMAT;
+  return decode(packed, page);
+}
+
+RC RecordFile::fetchData(PageId pid, PageHandle& page, const char*& data) const
+{
+  RC  rc;
+  int i;
+
+  // a page decompressed before
+  for (i = 0; codec.getCodec() != PageCodec::NONE && i < DECODE_CACHE_PAGES; i++) {
+    if (decodedPid[i] == pid) {
+      IOStats::count(pf.descriptor(), &IOStats::decodeHits);
+      data = &decodedPages[i * DECODED_PAGE_SIZE];
+      return 0;
+    }
+  }
+
+  if ((rc = pf.pin(firstPid + pid, page)) < 0) return rc;
+  data = page.data();
+  if (getPageType(data) != PAGE_COMPRESSED) return 0;
+
+  // decompress the page in place of the entry decompressed the longest ago
+  if (decodedPages.empty()) decodedPages.resize(DECODE_CACHE_PAGES * DECODED_PAGE_SIZE);
+  i = decodedNext;
+  decodedNext = (decodedNext + 1) % DECODE_CACHE_PAGES;
+  decodedPid[i] = -1;
+  if ((rc = decode(page.data(), &decodedPages[i * DECODED_PAGE_SIZE])) < 0) return rc;
+  decodedPid[i] = pid;
+  data = &decodedPages[i * DECODED_PAGE_SIZE];
+  page.release();
+  return 0;
+}
+
+RC RecordFile::decode(const char* compressed, char* page) const
+{
+  char packed[DECODED_PAGE_SIZE];
+  unsigned short length;
+  int n;
+
+  memcpy(&length, compressed + 4, sizeof(length));
+  if (length > COMPRESSED_CAPACITY) return RC_INVALID_FILE_FORMAT;
+  n = codec.decompress(compressed + PAGE_HEADER_SIZE, length, packed, DECODED_PAGE_SIZE);
+  if (n < 0 || !unpackPage(format, packed, n, page, DECODED_PAGE_SIZE)) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+  IOStats::count(pf.descriptor(), &IOStats::decoded);
+  return 0;
+}
+
+void RecordFile::resetCache() const
+{
+  for (int i = 0; i < DECODE_CACHE_PAGES; i++) decodedPid[i] = -1;
+  decodedNext = 0;
+}
+
+RC RecordFile::advise(int pattern) const
+{
+  return pf.advise(pattern);
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
 }
 
+RecordFile::Scanner::Scanner(const RecordFile& rf)
+{
+  file = &rf;
+  rid.pid = rid.sid = 0;
+  count = -1;
+  data = NULL;
+  lo = INT_MIN;
+  hi = INT_MAX;
+  runEnd = 0;
+}
+
+RecordFile::Scanner::~Scanner()
+{
+  if (runEnd > 0) file->pf.limitReadAhead(-1);
+}
+
+void RecordFile::Scanner::setKeyRange(int lo, int hi)
+{
+  this->lo = lo;
+  this->hi = hi;
+}
+
+int RecordFile::Scanner::next(RecordRef* recs, int max)
+{
+  RC          rc;
+  int         n, length, vlength;
+  bool        overflow;
+  PageId      first;
+  const char* ptr;
+
+  for (n = 0; n == 0 && rid < file->erid; ) {
+    if (count < 0 && (rc = pinNext()) < 0) return rc;
+
+    for (; rid.sid < count && n < max; rid.sid++, n++) {
+      recs[n].rid = rid;
+      if (file->format == FORMAT_FIXED) {
+        ptr = slotPtr(const_cast<char*>(data), rid.sid);
+        memcpy(&recs[n].key, ptr, sizeof(int));
+        recs[n].value = ptr + sizeof(int);
+        recs[n].length = strnlen(ptr + sizeof(int), MAX_VALUE_LENGTH);
+        continue;
+      }
+
+      getEntry(file->format, data, rid.sid, recs[n].key, ptr, length, overflow);
+      if (!overflow) {
+        recs[n].value = ptr;
+        recs[n].length = length;
+        continue;
+      }
+
+      // a long value is collected from its overflow pages
+      if ((int)spill.size() < max) spill.resize(max);
+      memcpy(&vlength, ptr, sizeof(int));
+      memcpy(&first, ptr + sizeof(int), sizeof(int));
+      if ((rc = file->readOverflow(first, vlength, spill[n])) < 0) return rc;
+      recs[n].value = spill[n].data();
+      recs[n].length = vlength;
+    }
+
+    // move on to the next page once this one is done
+    if (rid.sid >= count) {
+      rid.pid++;
+      rid.sid = 0;
+      count = -1;
+    }
+  }
+
+  return n;
+}
+
+int RecordFile::Scanner::nextKeys(const int*& keys)
+{
+  RC          rc;
+  int         n, length;
+  bool        overflow;
+  const char* value;
+
+  while (rid < file->erid) {
+    if (count < 0 && (rc = pinNext()) < 0) return rc;
+
+    n = count - rid.sid;
+    if (n > 0 && file->format == FORMAT_PAX) {
+      // the keys are contiguous in the page already
+      keys = (const int*)(data + PAGE_HEADER_SIZE) + rid.sid;
+    } else if (n > 0) {
+      // gather the keys; values in overflow pages are not read
+      if ((int)keyBuf.size() < n) keyBuf.resize(n);
+      for (int i = 0; i < n; i++) {
+        if (file->format == FORMAT_FIXED) {
+          memcpy(&keyBuf[i], slotPtr(const_cast<char*>(data), rid.sid + i), sizeof(int));
+        } else {
+          getEntry(file->format, data, rid.sid + i, keyBuf[i], value, length, overflow);
+        }
+      }
+      keys = &keyBuf[0];
+    }
+
+    // the page is done. it stays pinned until the next call.
+    rid.pid++;
+    rid.sid = 0;
+    count = -1;
+    if (n > 0) return n;
+  }
+
+  return 0;
+}
+
+RC RecordFile::Scanner::pinNext()
+{
+  RC rc;
+
+  // skip the pages whose keys are all out of the key range
+  if (file->zoned && (lo > INT_MIN || hi < INT_MAX)) {
+    while (rid.pid <= file->erid.pid && !file->zones.mayContain(rid.pid, lo, hi)) rid.pid++;
+    if (rid.pid > file->erid.pid) {
+      count = 0;
+      return 0;
+    }
+
+    // and do not read ahead the pages after the run of pages kept
+    if (rid.pid >= runEnd) {
+      for (runEnd = rid.pid + 1; runEnd <= file->erid.pid &&
+           file->zones.mayContain(runEnd, lo, hi); runEnd++);
+      file->pf.limitReadAhead(file->firstPid + runEnd);
+    }
+  }
+
+  // pin the next page. this releases the previous one, whose records
+  // the caller is done with.
+  if ((rc = file->pf.pin(file->firstPid + rid.pid, page)) < 0) return rc;
+  data = page.data();
+  if (file->format == FORMAT_FIXED) count = getRecordCount(data);
+  else if (isDataPage(data)) count = getSlotCount(data);
+  else count = 0;  // an overflow page
+
+  // a compressed page is decompressed once, when it is pinned
+  if (getPageType(data) == PAGE_COMPRESSED && count > 0) {
+    if (decoded.empty()) decoded.resize(DECODED_PAGE_SIZE);
+    if ((rc = file->decode(page.data(), &decoded[0])) < 0) return rc;
+    data = &decoded[0];
+  }
+
+  return 0;
+}
+
+RC RecordFile::Scanner::next(RecordRef& rec)
+{
+  int n = next(&rec, 1);
+
+  if (n < 0) return n;
+  return (n == 0) ? RC_END_OF_FILE : 0;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -276,3 +1070,181 @@ static void writeSlot(char* page, int n, int key, const std::string& value)
     strcpy(ptr + sizeof(int), value.c_str());
   }
 }
+
+static void initPage(char* page, char type, int size)
+{
+  unsigned short end = size;
+
+  // a data page has no slots and its record area starts at the page end
+  memset(page, 0, size);
+  page[0] = type;
+  if (type == PAGE_DATA) memcpy(page + 4, &end, sizeof(end));
+}
+
+static char getPageType(const char* page)
+{
+  return page[0];
+}
+
+static bool isDataPage(const char* page)
+{
+  return page[0] == PAGE_DATA || page[0] == PAGE_COMPRESSED;
+}
+
+static int getSlotCount(const char* page)
+{
+  unsigned short count;
+
+  memcpy(&count, page + 2, sizeof(count));
+  return count;
+}
+
+// the offset of the slot directory entry, in a slotted page
+static char* slotEntry(const char* page, int n)
+{
+  return const_cast<char*>(page) + PAGE_HEADER_SIZE + SLOT_SIZE * n;
+}
+
+// the offset of the value offsets, in a PAX page with count records
+static int paxOffsets(int count)
+{
+  return PAGE_HEADER_SIZE + sizeof(int) * count;
+}
+
+// the offset of the value minipage, in a PAX page with count records
+static int paxValues(int count)
+{
+  return paxOffsets(count) + sizeof(unsigned short) * (count + 1);
+}
+
+// get the i'th value offset of a PAX page with count records
+static int paxOffset(const char* page, int count, int i)
+{
+  unsigned short off;
+
+  memcpy(&off, page + paxOffsets(count) + sizeof(off) * i, sizeof(off));
+  return off;
+}
+
+static int usedBytes(int format, const char* page, int size)
+{
+  int count = getSlotCount(page);
+  unsigned short end;
+
+  if (format == RecordFile::FORMAT_PAX) {
+    return paxValues(count) + (paxOffset(page, count, count) & ~OVERFLOW_BIT);
+  }
+  memcpy(&end, page + 4, sizeof(end));
+  return PAGE_HEADER_SIZE + SLOT_SIZE * count + (size - end);
+}
+
+static bool hasRoom(int format, const char* page, int length, int size)
+{
+  int count = getSlotCount(page);
+  unsigned short end;
+
+  // a PAX record takes a key, an offset and its value
+  if (format == RecordFile::FORMAT_PAX) {
+    return size - usedBytes(format, page, size) >= (int)(sizeof(int) + sizeof(end)) + length;
+  }
+
+  // a slotted record takes a slot, a key and its value, and goes into
+  // the space between the slot directory and the record area
+  memcpy(&end, page + 4, sizeof(end));
+  return end - (PAGE_HEADER_SIZE + SLOT_SIZE * count) >= SLOT_SIZE + (int)sizeof(int) + length;
+}
+
+static int packPage(int format, const char* page, int size, char* packed)
+{
+  int count = getSlotCount(page);
+  int head, used = usedBytes(format, page, size);
+
+  // the records of a PAX page are at its start already. those of a
+  // slotted page are moved next to the slot directory.
+  head = (format == RecordFile::FORMAT_PAX) ? used : PAGE_HEADER_SIZE + SLOT_SIZE * count;
+  memcpy(packed, page, head);
+  memcpy(packed + head, page + size - (used - head), used - head);
+  return used;
+}
+
+static bool unpackPage(int format, const char* packed, int n, char* page, int size)
+{
+  int head, tail;
+  unsigned short count, end;
+
+  if (n < PAGE_HEADER_SIZE || n > size) return false;
+  memcpy(&count, packed + 2, sizeof(count));
+  memcpy(&end, packed + 4, sizeof(end));
+  if (format == RecordFile::FORMAT_PAX) {
+    head = n;
+    tail = 0;
+    if (paxValues(count) > n) return false;
+  } else {
+    head = PAGE_HEADER_SIZE + SLOT_SIZE * count;
+    tail = size - end;
+    if (end > size || head > end || head + tail != n) return false;
+  }
+
+  memcpy(page, packed, head);
+  memset(page + head, 0, size - head - tail);
+  memcpy(page + size - tail, packed + head, tail);
+  return usedBytes(format, page, size) == n;
+}
+
+static void addEntry(int format, char* page, int key, const char* value, int length, bool overflow)
+{
+  unsigned short count, end, slot[2], off;
+  int used;
+
+  memcpy(&count, page + 2, sizeof(count));
+
+  if (format == RecordFile::FORMAT_PAX) {
+    // make room for the key by shifting the offsets and the values
+    used = paxOffset(page, count, count) & ~OVERFLOW_BIT;
+    memmove(page + paxValues(count + 1), page + paxValues(count), used);
+    memmove(page + paxOffsets(count + 1), page + paxOffsets(count), sizeof(off) * (count + 1));
+    memcpy(page + paxOffsets(count), &key, sizeof(int));
+
+    off = (used + length) | (overflow ? OVERFLOW_BIT : 0);
+    memcpy(page + paxOffsets(count + 1) + sizeof(off) * (count + 1), &off, sizeof(off));
+    memcpy(page + paxValues(count + 1) + used, value, length);
+  } else {
+    // the record goes right before the record area and its slot
+    // right after the directory
+    memcpy(&end, page + 4, sizeof(end));
+    end -= sizeof(int) + length;
+    slot[0] = end;
+    slot[1] = (sizeof(int) + length) | (overflow ? OVERFLOW_BIT : 0);
+    memcpy(slotEntry(page, count), slot, sizeof(slot));
+    memcpy(page + end, &key, sizeof(int));
+    memcpy(page + end + sizeof(int), value, length);
+    memcpy(page + 4, &end, sizeof(end));
+  }
+
+  count++;
+  memcpy(page + 2, &count, sizeof(count));
+}
+
+static void getEntry(int format, const char* page, int n, int& key,
+                     const char*& value, int& length, bool& overflow)
+{
+  unsigned short slot[2];
+  int count, start, end;
+
+  if (format == RecordFile::FORMAT_PAX) {
+    count = getSlotCount(page);
+    memcpy(&key, page + PAGE_HEADER_SIZE + sizeof(int) * n, sizeof(int));
+    start = paxOffset(page, count, n) & ~OVERFLOW_BIT;
+    end = paxOffset(page, count, n + 1);
+    overflow = (end & OVERFLOW_BIT) != 0;
+    value = page + paxValues(count) + start;
+    length = (end & ~OVERFLOW_BIT) - start;
+    return;
+  }
+
+  memcpy(slot, slotEntry(page, n), sizeof(slot));
+  memcpy(&key, page + slot[0], sizeof(int));
+  overflow = (slot[1] & OVERFLOW_BIT) != 0;
+  value = page + slot[0] + sizeof(int);
+  length = (slot[1] & ~OVERFLOW_BIT) - sizeof(int);
+}
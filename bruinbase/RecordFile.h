@@ -11,7 +11,10 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <vector>
 #include "PageFile.h"
+#include "PageCodec.h"
+#include "ZoneMap.h"
 
 /**
  * The data structure for pointing to a particular record in a RecordFile.
@@ -22,6 +25,18 @@ typedef struct {
   int     sid;  // slot number. the first slot is 0
 } RecordId;
 
+/**
+ * A record returned by RecordFile::Scanner. The value is not copied:
+ * it points into the scanned page, is not NUL-terminated, and stays
+ * valid until the scanner is advanced or destroyed.
+ */
+typedef struct {
+  RecordId    rid;     // the id of the record
+  int         key;     // the record key
+  const char* value;   // the bytes of the record value
+  int         length;  // the length of the value
+} RecordRef;
+
 //
 // helper functions for RecordId
 // 
@@ -39,30 +54,68 @@ bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
 /**
- * read/write a record to a file
+ * read/write a record to a file.
+ * new files use the slotted page format, where a page holds as many
+ * records as their values allow and long values are kept in overflow
+ * pages. files created before it use fixed-size record slots and can
+ * still be read and appended to. the record ids of a slotted file are
+ * not dense, so records are iterated over with next() instead of ++.
+ * a file may also be created in the PAX format, a slotted format that
+ * keeps the keys of a page together, so scans that only need keys
+ * read a single array per page.
+ * the data pages of a slotted or PAX file may be compressed with a
+ * PageCodec chosen when the file is created. a compressed page holds
+ * a data page several times the size of a disk page, and is
+ * decompressed once whenever it is fetched.
+ * a zone map with the smallest and the largest key of every page is
+ * kept in the file <table>.zm for a file <table>.tbl, or filename.zm
+ * otherwise, so that a scan for a range of keys can skip pages.
  */
 class RecordFile {
  public:
+  class Scanner;
+
+  // page formats of a RecordFile
+  static const int FORMAT_FIXED = 1;    // fixed-size slots of MAX_VALUE_LENGTH
+  static const int FORMAT_SLOTTED = 2;  // slot directory and variable-length records
+  static const int FORMAT_PAX = 3;      // keys and values in separate minipages
 
-  // maximum length of the value field
+  // maximum length of the value field in the fixed format.
+  // longer values are truncated.
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
+  // number of record slots per page in the fixed format
   static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
 
   RecordFile();
-  RecordFile(const std::string& filename, char mode);
+  RecordFile(const std::string& filename, char mode, int options = 0,
+             int newFormat = FORMAT_SLOTTED, int newCodec = PageCodec::NONE);
   
   /**
    * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with the given page format and codec. an existing file keeps its
+   * format and codec.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param options[IN] PageFile::OPEN_* flags for the underlying PageFile
+   * @param newFormat[IN] FORMAT_SLOTTED or FORMAT_PAX for a new file
+   * @param newCodec[IN] the PageCodec of the data pages of a new file
    * @return error code. 0 if no error
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, int options = 0,
+          int newFormat = FORMAT_SLOTTED, int newCodec = PageCodec::NONE);
+
+  /**
+   * tell the OS how the records will be accessed. use
+   * PageFile::ACCESS_SCAN before a table scan and
+   * PageFile::ACCESS_RANDOM when records are fetched through an index.
+   * @param pattern[IN] one of the PageFile::ACCESS_* patterns
+   * @return error code. 0 if no error
+   */
+  RC advise(int pattern) const;
 
   /**
    * close the file.
@@ -90,6 +143,108 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * append n records at the end of the file.
+   * the records are laid out in memory and every page is written once,
+   * instead of once per record as with append().
+   * @param n[IN] the number of records
+   * @param keys[IN] the keys of the records
+   * @param values[IN] the values of the records
+   * @param rids[OUT] the locations of the stored records
+   * @return error code. 0 if no error
+   */
+  RC appendBatch(int n, const int* keys, const std::string* values, RecordId* rids);
+
+  /**
+   * advance a record id to the next record in the file.
+   * after the last record, rid becomes endRid(). the first record
+   * is (0, 0) unless the file is empty.
+   * @param rid[IN/OUT] the record id to advance
+   * @return error code. 0 if no error
+   */
+  RC next(RecordId& rid) const;
+
+  /**
+   * @return the page format of the file, one of the FORMAT_* formats
+   */
+  int getFormat() const { return format; }
+
+  /**
+   * @return the PageCodec the data pages of the file are compressed with
+   */
+  int getCodec() const { return codec.getCodec(); }
+
+  /**
+   * Reads the records of a RecordFile in order, a page at a time.
+   * Every page is pinned once and its records are returned without
+   * copying their values, so a scan costs one page fetch per page
+   * instead of one per record.
+   */
+  class Scanner {
+   public:
+    /**
+     * start a scan at the first record of the file.
+     * @param rf[IN] the open file to scan
+     */
+    Scanner(const RecordFile& rf);
+    ~Scanner();
+
+    /**
+     * return up to max of the next records, all from the same page.
+     * the records are valid until the next call to next().
+     * @param recs[OUT] the records
+     * @param max[IN] the most records to return
+     * @return the number of records returned, 0 at the end of the
+     *         file, or an error code
+     */
+    int next(RecordRef* recs, int max);
+
+    /**
+     * return the next record.
+     * @param rec[OUT] the record, valid until the next call to next()
+     * @return error code. RC_END_OF_FILE after the last record
+     */
+    RC next(RecordRef& rec);
+
+    /**
+     * return the keys of the remaining records of the next page, without
+     * their values. in a PAX file the keys are not copied. mixing calls
+     * to next() and nextKeys() is allowed.
+     * @param keys[OUT] the keys, valid until the next call to the scanner
+     * @return the number of keys, 0 at the end of the file, or an
+     *         error code
+     */
+    int nextKeys(const int*& keys);
+
+    /**
+     * limit the scan to the pages that may hold a key in [lo, hi],
+     * according to the zone map of the file. the records of those pages
+     * are returned whatever their key, so the caller still checks them.
+     * @param lo[IN] the smallest key looked for
+     * @param hi[IN] the largest key looked for
+     */
+    void setKeyRange(int lo, int hi);
+
+   private:
+    const RecordFile* file;
+    PageHandle page;     // the page being scanned
+    RecordId   rid;      // the next record to return
+    int        count;    // # of slots in the page, -1 if none is pinned
+    std::vector<std::string> spill; // values read from overflow pages
+    std::vector<int> keyBuf;  // keys gathered from a non-PAX page
+    std::vector<char> decoded;  // the page decompressed, in a compressed file
+    const char* data;    // the records of the page: page.data() or decoded
+    int        lo, hi;   // the key range given to setKeyRange()
+    PageId     runEnd;   // the end of the run of pages kept by the zone
+                         // map, beyond which read-ahead is not to go
+
+    RC pinNext();
+
+    // the scanner holds a pinned page; copying is not allowed
+    Scanner(const Scanner&);
+    Scanner& operator=(const Scanner&);
+  };
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
@@ -99,6 +254,39 @@ class RecordFile {
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  PageId   firstPid; // the page holding the records with rid.pid == 0.
+                     // 1 after the header page, 0 for legacy files
+  int      format;   // one of the FORMAT_* formats
+  PageCodec codec;  // the codec of the data pages
+  int      fillTarget; // the bytes a compressed data page is filled to
+                       // before it is written
+
+  // the last pages decompressed by read(), which are replaced in turn.
+  // a RecordFile is used by one thread at a time, so they are not locked.
+  static const int DECODE_CACHE_PAGES = 4;
+  mutable std::vector<char> decodedPages;
+  mutable PageId decodedPid[DECODE_CACHE_PAGES];  // -1 for an empty entry
+  mutable int    decodedNext;  // the entry to replace next
+
+  ZoneMap  zones;    // the key range of every page
+  bool     zoned;    // whether zones describes the file
+
+  friend class Scanner;
+
+  void openZones(const std::string& filename, char mode, bool created);
+  RC buildZones();
+  void resetCache() const;
+  RC fetchData(PageId pid, PageHandle& page, const char*& data) const;
+  RC readData(PageId pid, char* page) const;
+  RC writeData(PageId pid, const char* page);
+  RC decode(const char* packed, char* page) const;
+  bool addRecord(char* page, int key, const char* value, int length, bool overflow) const;
+  RC appendFixed(int n, const int* keys, const std::string* values, RecordId* rids);
+  RC appendSlotted(int n, const int* keys, const std::string* values, RecordId* rids);
+  RC writeTail(PageId& tail, PageId& end, char* page, int& first, RecordId* next);
+  RC writeOverflow(const std::string& value, PageId& end, PageId& first);
+  RC readOverflow(PageId pid, int length, std::string& value) const;
+  RC writeHeader();
 };
 
 #endif // RECORDFILE_H
@@ -10,13 +10,20 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <limits>
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 
 #include <string>
 #include "BTreeIndex.h"
+#include "ExternalSort.h"
+#include "IOStats.h"
 
 #define DEBUG false
 
@@ -26,6 +33,330 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+int SqlEngine::readOptions = 0;
+int SqlEngine::writeOptions = 0;
+
+// # of rows appended to the table at once by load()
+static const int LOAD_BATCH = 256;
+
+// # of records taken from the table at once by a scan
+static const int SCAN_BATCH = 64;
+
+// the (key, rid) pairs of the rows loaded, handed to BTreeIndex::bulkLoad()
+// in key order. the sort is stable, so that of the rows with the same key
+// the index keeps the first loaded, as insert() would.
+template <class Key>
+class LoadEntries : public BasicEntrySource<Key> {
+ public:
+  RC add(Key key, const RecordId& rid) { return sorter.add(key, &rid, sizeof(rid)); }
+  RC sort() { return sorter.sort(); }
+
+  RC next(Key& key, RecordId& rid)
+  {
+    RC          rc;
+    const char* data;
+    int         length;
+    long long   k;
+
+    if ((rc = sorter.next(k, data, length)) < 0) return rc;
+    if (length != sizeof(rid)) return RC_INVALID_FILE_FORMAT;
+    key = (Key) k;
+    memcpy(&rid, data, sizeof(rid));
+    return 0;
+  }
+
+ private:
+  ExternalSort sorter;
+};
+
+// the (value, rid) pairs of the rows loaded, for the value index. a
+// record is the bytes of the value and the rid. the sorter orders the
+// records by the first 8 bytes of their values, as a number, and only
+// compares the rest of the bytes of values that share those.
+template <>
+class LoadEntries<StringKey> : public BasicEntrySource<StringKey> {
+ public:
+  RC add(const StringKey& key, const RecordId& rid)
+  {
+    char data[StringKey::MAX_LENGTH + sizeof(RecordId)];
+
+    memcpy(data, key.bytes, key.length);
+    memcpy(data + key.length, &rid, sizeof(rid));
+    return sorter.add(prefixKey(key), data, key.length + sizeof(rid), key.length);
+  }
+
+  RC sort() { return sorter.sort(); }
+
+  RC next(StringKey& key, RecordId& rid)
+  {
+    RC          rc;
+    const char* data;
+    int         length;
+    long long   k;
+
+    if ((rc = sorter.next(k, data, length)) < 0) return rc;
+    length -= sizeof(rid);
+    if (length < 0 || length > StringKey::MAX_LENGTH) return RC_INVALID_FILE_FORMAT;
+    key = StringKey(data, length);
+    memcpy(&rid, data + length, sizeof(rid));
+    return 0;
+  }
+
+ private:
+  ExternalSort sorter;
+
+  // the first 8 bytes of a key, padded with 0 bytes, as a big-endian
+  // number whose sign bit is flipped, so that the numbers sort like the
+  // keys
+  static long long prefixKey(const StringKey& key)
+  {
+    unsigned long long k = 0;
+
+    for (int i = 0; i < 8; i++) {
+      k = (k << 8) | (i < key.length ? (unsigned char)key.bytes[i] : 0);
+    }
+    return (long long)(k ^ 0x8000000000000000ULL);
+  }
+};
+
+// the indexes opened by select(), by file name, kept open for the queries
+// that follow so that their non-leaf nodes stay in memory: the key
+// indexes and the value indexes. load() closes the indexes of the table
+// it loads.
+static map<string, BTreeIndex*> keyIndexes;
+static map<string, BTreeIndexStr*> valueIndexes;
+
+// return an open index of indexes, opening its file if needed.
+// NULL if there is no such index.
+template <class Index>
+static Index* openIndex(map<string, Index*>& indexes, const string& filename, int options)
+{
+  typename map<string, Index*>::iterator it = indexes.find(filename);
+  Index* index;
+
+  if (it != indexes.end()) return it->second;
+
+  index = new Index();
+  if (index->open(filename, 'r', options) != 0) {
+    delete index;
+    return NULL;
+  }
+  indexes[filename] = index;
+  return index;
+}
+
+// close an index opened by openIndex(), if it is open
+template <class Index>
+static void closeIndex(map<string, Index*>& indexes, const string& filename)
+{
+  typename map<string, Index*>::iterator it = indexes.find(filename);
+
+  if (it == indexes.end()) return;
+  it->second->close();
+  delete it->second;
+  indexes.erase(it);
+}
+
+// count the keys in [lo, hi]. the loop has no branches, so that the
+// compiler can turn it into vector instructions.
+static int countInRange(const int* keys, int n, int lo, int hi)
+{
+  int count = 0;
+
+  for (int i = 0; i < n; i++) count += (keys[i] >= lo) & (keys[i] <= hi);
+  return count;
+}
+
+// turn the conditions on the key into the range [lo, hi] of keys that
+// may satisfy them. the keys of NE conditions are added to ne, if given.
+static void keyRange(const vector<SelCond>& cond, int& lo, int& hi, vector<int>* ne)
+{
+  int v;
+
+  lo = INT_MIN;
+  hi = INT_MAX;
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 1) continue;
+    v = atoi(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (v > lo) lo = v;
+      if (v < hi) hi = v;
+      break;
+    case SelCond::NE:
+      if (ne != NULL) ne->push_back(v);
+      break;
+    case SelCond::GT:
+      if (v == INT_MAX) hi = INT_MIN, lo = INT_MAX;
+      else if (v + 1 > lo) lo = v + 1;
+      break;
+    case SelCond::LT:
+      if (v == INT_MIN) hi = INT_MIN, lo = INT_MAX;
+      else if (v - 1 < hi) hi = v - 1;
+      break;
+    case SelCond::GE:
+      if (v > lo) lo = v;
+      break;
+    case SelCond::LE:
+      if (v < hi) hi = v;
+      break;
+    }
+  }
+}
+
+// run a scan that needs only the keys of the table: SELECT key or
+// SELECT COUNT(*) with conditions on the key only. the conditions are
+// turned into a range of keys and a list of excluded keys.
+static RC scanKeys(const RecordFile& rf, int attr, const vector<SelCond>& cond)
+{
+  RecordFile::Scanner scan(rf);
+  const int*  keys;
+  vector<int> ne;
+  int lo, hi;
+  int n, count = 0;
+
+  keyRange(cond, lo, hi, &ne);
+  scan.setKeyRange(lo, hi);
+
+  while ((n = scan.nextKeys(keys)) > 0) {
+    if (attr == 4 && ne.empty()) {
+      count += countInRange(keys, n, lo, hi);
+      continue;
+    }
+    for (int i = 0; i < n; i++) {
+      if (keys[i] < lo || keys[i] > hi) continue;
+      if (std::find(ne.begin(), ne.end(), keys[i]) != ne.end()) continue;
+      count++;
+      if (attr == 1) fprintf(stdout, "%d\n", keys[i]);
+    }
+  }
+  if (n < 0) return n;
+
+  if (attr == 4) fprintf(stdout, "%d\n", count);
+  return 0;
+}
+
+// compare a value of length bytes with the string s, like strcmp()
+static int compareValue(const char* value, int length, const char* s)
+{
+  int len = strlen(s);
+  int diff = memcmp(value, s, (length < len) ? length : len);
+
+  if (diff != 0) return diff;
+  return length - len;
+}
+
+// turn the conditions on the value into the range [lo, hi] of value keys
+// that may satisfy them. a key is the value cut to StringKey::MAX_LENGTH
+// bytes, which longer values share, so a strict condition cannot rule
+// out the key of its own value.
+// @return whether the range is bounded on both sides, by an EQ condition
+//         or by conditions from below and from above. an open range may
+//         match a large part of the table, which a scan reads faster than
+//         a tuple at a time through the index.
+static bool valueRange(const vector<SelCond>& cond, StringKey& lo, StringKey& hi)
+{
+  bool      below = false, above = false;
+  StringKey v;
+
+  lo = numeric_limits<StringKey>::min();
+  hi = numeric_limits<StringKey>::max();
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr != 2 || cond[i].comp == SelCond::NE) continue;
+    v = StringKey(cond[i].value, strlen(cond[i].value));
+    if (cond[i].comp != SelCond::LT && cond[i].comp != SelCond::LE) {
+      if (v > lo) lo = v;
+      below = true;
+    }
+    if (cond[i].comp != SelCond::GT && cond[i].comp != SelCond::GE) {
+      if (v < hi) hi = v;
+      above = true;
+    }
+  }
+  return below && above;
+}
+
+// whether a tuple satisfies all of the conditions. the key is compared
+// rather than subtracted, which could overflow.
+static bool matches(int key, const char* value, int length, const vector<SelCond>& cond)
+{
+  int diff = 0;
+  int v;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    switch (cond[i].attr) {
+    case 1:
+      v = atoi(cond[i].value);
+      diff = (key > v) - (key < v);
+      break;
+    case 2:
+      diff = compareValue(value, length, cond[i].value);
+      break;
+    }
+
+    switch (cond[i].comp) {
+    case SelCond::EQ: if (diff != 0) return false; break;
+    case SelCond::NE: if (diff == 0) return false; break;
+    case SelCond::GT: if (diff <= 0) return false; break;
+    case SelCond::LT: if (diff >= 0) return false; break;
+    case SelCond::GE: if (diff < 0) return false; break;
+    case SelCond::LE: if (diff > 0) return false; break;
+    }
+  }
+  return true;
+}
+
+// run a query through the value index of a table: the entries with value
+// keys in the range of the conditions are read in key order, and their
+// tuples are fetched and checked against every condition, which may be
+// on the key, or on a value longer than its key.
+static RC scanValues(BTreeIndexStr& index, const RecordFile& rf, int attr,
+                     const vector<SelCond>& cond)
+{
+  BTreeIndexStr::Scanner scan(index);
+  StringKey keys[SCAN_BATCH];
+  RecordId  rids[SCAN_BATCH];
+  StringKey lo, hi;
+  int       n = 0, key;
+  int       count = 0;
+  string    value;
+  RC        rc;
+
+  valueRange(cond, lo, hi);
+  if (lo > hi) goto done;
+
+  // the index keeps duplicate keys, so the scan starts at the first
+  // entry of the run of keys equal to lo
+  rc = scan.locate(lo);
+
+  while (rc == 0 && (n = scan.next(keys, rids, SCAN_BATCH)) > 0) {
+    for (int j = 0; j < n; j++) {
+      if (keys[j] > hi) goto done;
+      if ((rc = rf.read(rids[j], key, value)) < 0) return rc;
+      if (!matches(key, value.data(), value.size(), cond)) continue;
+
+      count++;
+      switch (attr) {
+      case 1:  // SELECT key
+        fprintf(stdout, "%d\n", key);
+        break;
+      case 2:  // SELECT value
+        fprintf(stdout, "%s\n", value.c_str());
+        break;
+      case 3:  // SELECT *
+        fprintf(stdout, "%d '%s'\n", key, value.c_str());
+        break;
+      }
+    }
+  }
+  if (rc < 0) return rc;
+  if (n < 0) return n;
+
+  done:
+  if (attr == 4) fprintf(stdout, "%d\n", count);
+  return 0;
+}
+
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -48,26 +379,19 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   int    key;     
   string value;
   int    count;
-  int    diff;
 
   // Index Variables
-  BTreeIndex index;
+  BTreeIndex* index;
   bool indexUse = false;
-  IndexCursor cursor;
   bool needsValue = false;
-  bool searchLower = false;
-  bool searchUpper = false;
-  bool searchLocate = false;
   int searchLowerBound;
   int searchUpperBound;
-  int searchVal; // This is for holding locate search values
-  int temp;
   bool readValues = false; // This is true if requires reading in values from table
 
 
 
   // attempt to open the index file, and checks if it's used
-  if (index.open(table + ".idx", 'r') == 0) {
+  if ((index = openIndex(keyIndexes, table + ".idx", readOptions)) != NULL) {
       if (DEBUG) fprintf(stdout, "Success opening index file\n");
 
       
@@ -91,10 +415,6 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
           if (DEBUG) fprintf(stdout, "Appropriate Conditions for using index");
           indexUse = true;
       }
-
-      if (indexUse == false) {
-          index.close();
-      }
   }
 
 
@@ -103,6 +423,10 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   // RecordId.pid pageid
   // RecordId.sid slot in the page
   if (indexUse) {
+      BTreeIndex::Scanner scan(*index);
+      int keys[SCAN_BATCH];
+      RecordId rids[SCAN_BATCH];
+      int n = 0;
 
       //Count(*) initialization
       count = 0;
@@ -111,168 +435,48 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
           readValues = true;
       }
 
-      // Range Calculation
-      // Also finds if locate query is there
-      // Also checks if readValues is needed
+      // the conditions on the key bound the range of entries read.
+      // the ones on the value need the tuples
+      keyRange(cond, searchLowerBound, searchUpperBound, NULL);
       for (unsigned i = 0; i < cond.size(); i++) {
-          temp = atoi(cond[i].value);
           if (cond[i].attr == 2) {
               readValues = true;
-              continue;
-          }
-          switch(cond[i].comp) {
-              case SelCond::EQ:
-                  searchLocate = true;
-                  searchVal = temp;
-                break;
-              case SelCond::GT:
-                if (searchLower && temp >= searchLowerBound) {
-                    searchLowerBound = temp + 1;
-                } else if (!searchLower) {
-                    searchLower = true;
-                    searchLowerBound = temp + 1;
-                }
-                break;
-              case SelCond::GE:
-                if (searchLower && temp > searchLowerBound) {
-                    searchLowerBound = temp;
-                } else if (!searchLower)  {
-                    searchLower = true;
-                    searchLowerBound = temp;
-                }
-                break;
-              case SelCond::LT:
-                if (searchUpper && temp <= searchUpperBound) {
-                    searchUpperBound = temp - 1;
-                } else if (!searchUpper) {
-                    searchUpper = true;
-                    searchUpperBound = temp - 1;
-                }
-                break;
-              case SelCond::LE:
-                if (searchUpper && temp < searchUpperBound) {
-                    searchUpperBound = temp;
-                } else if (!searchUpper) {
-                    searchUpper = true;
-                    searchUpperBound = temp;
-                }
-                break;
-
           }
       }
   // open the table file
-  if (readValues && ((rc = rf.open(table + ".tbl", 'r')) < 0)) {
+  if (readValues && ((rc = rf.open(table + ".tbl", 'r', readOptions)) < 0)) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
+  // tuples are fetched in index order, not in file order
+  if (readValues) rf.advise(PageFile::ACCESS_RANDOM);
 
       
-      if (searchLocate) {
-          // Most limiting search.
-          if (index.locate(searchVal, cursor) != 0) {
-              goto exit_select;
-          }
-
-          count++;
-          index.readForward(cursor, key, rid);
-          if (readValues) {
-            rf.read(rid, key, value);
-          }
-
-          for (unsigned i = 0; i < cond.size(); i++) {
-              switch (cond[i].attr) {
-                  case 1:
-                      diff = key - atoi(cond[i].value);
-                      break;
-                  case 2:
-                      diff = strcmp(value.c_str(), cond[i].value);
-                      break;
-              }
-
-              // skip the tuple if any condition is not met
-              switch (cond[i].comp) {
-                  case SelCond::EQ:
-                      if (diff != 0) goto exit_select;
-                      break;
-                  case SelCond::NE:
-                      if (diff == 0) goto exit_select;
-                      break;
-                  case SelCond::GT:
-                      if (diff <= 0) goto exit_select;
-                      break;
-                  case SelCond::LT:
-                      if (diff >= 0) goto exit_select
-                          ;
-                      break;
-                  case SelCond::GE:
-                      if (diff < 0) goto exit_select;
-                      break;
-                  case SelCond::LE:
-                      if (diff > 0) goto exit_select;
-                      break;
-              }
-          }
-          switch (attr) {
-              case 1:  // SELECT key
-                  fprintf(stdout, "%d\n", key);
-                  break;
-              case 2:  // SELECT value
-                  fprintf(stdout, "%s\n", value.c_str());
-                  break;
-              case 3:  // SELECT *
-                  fprintf(stdout, "%d '%s'\n", key, value.c_str());
-                  break;
-          }
-      } else if (searchLower || searchUpper) {
-          RC ret;
-          if (searchLower) {
-              index.locate(searchLowerBound, cursor);
-          } else {
-              index.getFirstElement(cursor);
-          }
-          while((ret = index.readForward(cursor, key, rid)) == 0) {
-              if (searchUpper && (key > searchUpperBound)) {
-                  break;
+      // the entries in the range are read in key order, a leaf at a
+      // time. conditions no key meets leave the range empty
+      if (searchLowerBound > searchUpperBound) {
+          goto index_done;
+      }
+      rc = (searchLowerBound == INT_MIN) ? scan.first() : scan.locate(searchLowerBound);
+
+      while (rc == 0 && (n = scan.next(keys, rids, SCAN_BATCH)) > 0) {
+          for (int j = 0; j < n; j++) {
+              key = keys[j];
+              rid = rids[j];
+              if (key > searchUpperBound) {
+                  goto index_done;
               }
-              count++;
-              if (readValues) {
-                  rf.read(rid, key, value);
+              if (readValues && (rc = rf.read(rid, key, value)) < 0) {
+                  fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+                  goto exit_select;
               }
-              //Condition checking hooray
-              for (unsigned i = 0; i < cond.size(); i++) {
-                  switch (cond[i].attr) {
-                      case 1:
-                          diff = key - atoi(cond[i].value);
-                          break;
-                      case 2:
-                          diff = strcmp(value.c_str(), cond[i].value);
-                          break;
-                  }
 
-                  // skip the tuple if any condition is not met
-                  switch (cond[i].comp) {
-                      case SelCond::EQ:
-                          if (diff != 0) goto exit_select;
-                          break;
-                      case SelCond::NE:
-                          if (diff == 0) goto exit_select;
-                          break;
-                      case SelCond::GT:
-                          if (diff <= 0) goto exit_select;
-                          break;
-                      case SelCond::LT:
-                          if (diff >= 0) goto exit_select
-                              ;
-                          break;
-                      case SelCond::GE:
-                          if (diff < 0) goto exit_select;
-                          break;
-                      case SelCond::LE:
-                          if (diff > 0) goto exit_select;
-                          break;
-                  }
+              // skip the tuple if any condition is not met
+              if (!matches(key, value.data(), value.size(), cond)) {
+                  goto next_entry;
               }
 
+              count++;
               switch (attr) {
                   case 1:  // SELECT key
                       fprintf(stdout, "%d\n", key);
@@ -284,95 +488,110 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
                       fprintf(stdout, "%d '%s'\n", key, value.c_str());
                       break;
               }
-          }
 
-      }
-      
-      if ((attr == 4) && (cond.size() == 0)) {
-          index.getFirstElement(cursor);
-          while(index.readForward(cursor, key, rid) == 0) {
-              count++;
+              next_entry: ;
           }
-          fprintf(stdout, "%d\n", count);
+      }
+      if (rc < 0 || n < 0) {
+          fprintf(stderr, "Error: while reading index of table %s\n", table.c_str());
+          rc = (rc < 0) ? rc : n;
+          goto exit_select;
       }
 
-
+      index_done:
+      if (attr == 4) {
+          fprintf(stdout, "%d\n", count);
+      }
 
     goto exit_select;
   }
 
+  // conditions that bound the value on both sides are run through the
+  // value index of the table, if LOAD built one
+  {
+    StringKey lo, hi;
+    BTreeIndexStr* values;
+    if (valueRange(cond, lo, hi) &&
+        (values = openIndex(valueIndexes, table + ".vidx", readOptions)) != NULL) {
+      if ((rc = rf.open(table + ".tbl", 'r', readOptions)) < 0) {
+        fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+        return rc;
+      }
+      rf.advise(PageFile::ACCESS_RANDOM);
+      if ((rc = scanValues(*values, rf, attr, cond)) < 0) {
+        fprintf(stderr, "Error: while reading value index of table %s\n", table.c_str());
+      }
+      goto exit_select;
+    }
+  }
+
   // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+  if ((rc = rf.open(table + ".tbl", 'r', readOptions)) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
-
-  // NAIVE SCAN LETS DO IT 
-  // scan the table file from the beginning
-  rid.pid = rid.sid = 0;
-  count = 0;
-  while (rid < rf.endRid()) {
-    // read the tuple
-    if ((rc = rf.read(rid, key, value)) < 0) {
-      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+  rf.advise(PageFile::ACCESS_SCAN);
+
+  // a query that needs no values only reads the keys of every page
+  if (attr == 1 || attr == 4) {
+    unsigned i;
+    for (i = 0; i < cond.size() && cond[i].attr == 1; i++);
+    if (i == cond.size()) {
+      if ((rc = scanKeys(rf, attr, cond)) < 0) {
+        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      }
       goto exit_select;
     }
+  }
 
-    // check the conditions on the tuple
-    for (unsigned i = 0; i < cond.size(); i++) {
-      // compute the difference between the tuple value and the condition value
-      switch (cond[i].attr) {
-      case 1:
-	diff = key - atoi(cond[i].value);
-	break;
-      case 2:
-	diff = strcmp(value.c_str(), cond[i].value);
-	break;
-      }
-
-      // skip the tuple if any condition is not met
-      switch (cond[i].comp) {
-      case SelCond::EQ:
-	if (diff != 0) goto next_tuple;
-	break;
-      case SelCond::NE:
-	if (diff == 0) goto next_tuple;
-	break;
-      case SelCond::GT:
-	if (diff <= 0) goto next_tuple;
-	break;
-      case SelCond::LT:
-	if (diff >= 0) goto next_tuple;
-	break;
-      case SelCond::GE:
-	if (diff < 0) goto next_tuple;
-	break;
-      case SelCond::LE:
-	if (diff > 0) goto next_tuple;
-	break;
+  // NAIVE SCAN LETS DO IT 
+  // scan the table file from the beginning, a page at a time
+  count = 0;
+  {
+    RecordFile::Scanner scan(rf);
+    RecordRef recs[SCAN_BATCH];
+    int n, lo, hi;
+
+    // the zone map of the table rules out pages by the key conditions
+    keyRange(cond, lo, hi, NULL);
+    scan.setKeyRange(lo, hi);
+
+    while ((n = scan.next(recs, SCAN_BATCH)) > 0) {
+      for (int r = 0; r < n; r++) {
+        key = recs[r].key;
+
+        // check the conditions on the tuple
+        if (!matches(key, recs[r].value, recs[r].length, cond)) {
+          goto next_tuple;
+        }
+
+        // the condition is met for the tuple. 
+        // increase matching tuple counter
+        count++;
+
+        // print the tuple 
+        switch (attr) {
+        case 1:  // SELECT key
+          fprintf(stdout, "%d\n", key);
+          break;
+        case 2:  // SELECT value
+          fprintf(stdout, "%.*s\n", recs[r].length, recs[r].value);
+          break;
+        case 3:  // SELECT *
+          fprintf(stdout, "%d '%.*s'\n", key, recs[r].length, recs[r].value);
+          break;
+        }
+
+        // move to the next tuple
+        next_tuple: ;
       }
     }
 
-    // the condition is met for the tuple. 
-    // increase matching tuple counter
-    count++;
-
-    // print the tuple 
-    switch (attr) {
-    case 1:  // SELECT key
-      fprintf(stdout, "%d\n", key);
-      break;
-    case 2:  // SELECT value
-      fprintf(stdout, "%s\n", value.c_str());
-      break;
-    case 3:  // SELECT *
-      fprintf(stdout, "%d '%s'\n", key, value.c_str());
-      break;
+    if (n < 0) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      rc = n;
+      goto exit_select;
     }
-
-    // move to the next tuple
-    next_tuple:
-    ++rid;
   }
 
   // print matching tuple count if "select count(*)"
@@ -387,7 +606,7 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+RC SqlEngine::load(const string& table, const string& loadfile, bool index, int format, int codec)
 {
   /* your code here */
 
@@ -397,45 +616,115 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
   input.open(loadfile.c_str(), std::ifstream::in);
 
   //output data file
-  RecordFile * out = new RecordFile(table + ".tbl", 'w');
+  RC rc;
+  RecordFile * out = new RecordFile();
+  if ((rc = out->open(table + ".tbl", 'w', writeOptions, format, codec)) < 0) {
+      fprintf(stderr, "Error: cannot open table %s\n", table.c_str());
+      delete out;
+      return rc;
+  }
 
   //Index data structures
   BTreeIndex btree;
+  LoadEntries<int> entries;
+  BTreeIndexStr vtree;
+  LoadEntries<StringKey> valueEntries;
+  bool valueIndex = index;  // whether the value index is built
 
 
-  //Create index if needed
+  //Create index if needed. select() may hold the index open, and would
+  //not see what is loaded
   if (index) {
+      closeIndex(keyIndexes, table + ".idx");
+      closeIndex(valueIndexes, table + ".vidx");
       //Check if the file exists, aborting? or overwrite?
       //TODO
         
-      if (btree.open(table + ".idx", 'w') != 0) {
+      if (btree.open(table + ".idx", 'w', writeOptions) != 0) {
           //Error checking, abort
           //TODO
       }
+
+      //The value index keeps duplicate keys and takes the new rows like
+      //the key index does. A new one also gets the rows the table has
+      //already, so that it covers all of them
+      bool created = access((table + ".vidx").c_str(), F_OK) != 0;
+      if (vtree.open(table + ".vidx", 'w', writeOptions) != 0) {
+          fprintf(stdout, "ERROR CREATING INDEX\n");
+          valueIndex = false;
+      } else if (created) {
+          RecordFile::Scanner scan(*out);
+          RecordRef recs[SCAN_BATCH];
+          int m;
+          while ((m = scan.next(recs, SCAN_BATCH)) > 0) {
+              for (int i = 0; i < m; i++) {
+                  valueEntries.add(StringKey(recs[i].value, recs[i].length), recs[i].rid);
+              }
+          }
+      }
   }
 
-  while(std::getline(input, input_line)) {
-          RecordId rid;
-          int key;
-          std::string value;
-          SqlEngine::parseLoadLine(input_line, key, value);
-          out->append(key, value, rid);
+  // the rows are appended in batches, so that every page of the table
+  // is written once
+  int keys[LOAD_BATCH];
+  std::string values[LOAD_BATCH];
+  RecordId rids[LOAD_BATCH];
+  int n = 0;
+  bool more = true;
+
+  while (more) {
+          more = (bool)std::getline(input, input_line);
+          if (more) {
+              SqlEngine::parseLoadLine(input_line, keys[n], values[n]);
+              if (++n < LOAD_BATCH) continue;
+          }
+          if (n == 0) break;
+
+          // the ids of a batch that failed are unknown, so it is not
+          // indexed. the rows loaded before it still are.
+          if ((rc = out->appendBatch(n, keys, values, rids)) < 0) {
+              fprintf(stderr, "Error: while writing a tuple to table %s\n", table.c_str());
+              break;
+          }
           if (index) {
-              if (btree.insert(key, rid) != 0) {
-                  fprintf(stdout, "ERROR CREATING INDEX");
+              for (int i = 0; i < n; i++) {
+                  if (entries.add(keys[i], rids[i]) != 0 ||
+                      (valueIndex &&
+                       valueEntries.add(StringKey(values[i].data(), values[i].size()), rids[i]) != 0)) {
+                      fprintf(stdout, "ERROR CREATING INDEX");
+                  }
               }
           }
+          n = 0;
   }
 
 
+  // the index is built bottom-up from the sorted entries, instead of
+  // inserting the rows one at a time
   if (index) {
-      //Error checking needed? Probably nah
+      if (entries.sort() != 0 || btree.bulkLoad(entries) != 0) {
+          fprintf(stdout, "ERROR CREATING INDEX");
+      }
       btree.close();
   }
+  if (valueIndex) {
+      if (valueEntries.sort() != 0 ||
+          vtree.bulkLoad(valueEntries, BTreeIndexStr::DEFAULT_FILL, true) != 0) {
+          fprintf(stdout, "ERROR CREATING INDEX");
+      }
+      vtree.close();
+  }
 
   input.close();
   out->close();
+  delete out;
 
+  return rc;
+}
+
+RC SqlEngine::showStats(bool json)
+{
+  IOStats::print(stdout, json);
   return 0;
 }
 
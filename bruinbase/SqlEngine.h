@@ -54,10 +54,24 @@ class SqlEngine {
    * load a table from a load file.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
-   * @param index[IN] true if "WITH INDEX" option was specified
+   * @param index[IN] true if "WITH INDEX" option was specified, which
+   *        builds an index on the key and one on the value of the table
+   * @param format[IN] the RecordFile::FORMAT_* page format of a new table,
+   *        given by "LAYOUT ROW" or "LAYOUT PAX"
+   * @param codec[IN] the PageCodec of the data pages of a new table,
+   *        given by "COMPRESS NONE", "COMPRESS LZ" or "COMPRESS DICT"
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC load(const std::string& table, const std::string& loadfile, bool index,
+                 int format = RecordFile::FORMAT_SLOTTED, int codec = PageCodec::NONE);
+
+  /**
+   * print the I/O and buffer pool statistics of every file and of the
+   * last query, as a table or as a JSON object (SHOW STATS [JSON]).
+   * @param json[IN] true if "JSON" was specified
+   * @return error code. 0 if no error
+   */
+  static RC showStats(bool json);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -67,6 +81,26 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+  /**
+   * set the PageFile::open() options used when SELECT opens table and
+   * index files, e.g., PageFile::OPEN_MMAP to read them through a
+   * memory mapping instead of the buffer pool.
+   * @param options[IN] PageFile::OPEN_* flags
+   */
+  static void setReadOptions(int options) { readOptions = options; }
+
+  /**
+   * set the PageFile::open() options used when LOAD creates table and
+   * index files, e.g., PageFile::OPEN_DIRECT to write them without
+   * going through the OS page cache.
+   * @param options[IN] PageFile::OPEN_* flags
+   */
+  static void setWriteOptions(int options) { writeOptions = options; }
+
+ private:
+  static int readOptions;  // PageFile::OPEN_* flags used by select()
+  static int writeOptions; // PageFile::OPEN_* flags used by load()
 };
 
 #endif /* SQLENGINE_H */
@@ -8,6 +8,7 @@
 #include "Bruinbase.h"
 #include "SqlEngine.h" 
 #include "PageFile.h"
+#include "IOStats.h"
 
 int  sqllex(void);  
 void sqlerror(const char *str) { fprintf(stderr, "Error: %s\n", str); }
@@ -21,13 +22,22 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
+  IOStats::beginQuery();
   SqlEngine::select(attr, table, conds);
+  IOStats::endQuery();
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
 
   fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
 }
 
+static void runLoad(const char* table, const char* loadfile, bool index, int format, int codec)
+{
+  IOStats::beginQuery();
+  SqlEngine::load(table, loadfile, index, format, codec);
+  IOStats::endQuery();
+}
+
 %}
 
 %union {
@@ -38,11 +48,12 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 }
 
 %token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
+%token SHOW STATS JSON LAYOUT COMPRESS
 %token COMMA STAR LF
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
 
-%type <integer> attributes attribute comparator
+%type <integer> attributes attribute comparator layout compression
 %type <string> table value
 %type <cond> condition
 %type <conds> conditions
@@ -56,6 +67,7 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| show_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -66,18 +78,46 @@ quit_command:
 	;
 
 load_command:
-	LOAD table FROM STRING LF { 
-	  SqlEngine::load(std::string($2), std::string($4), false); 
+	LOAD table FROM STRING layout compression LF { 
+	  runLoad($2, $4, false, $5, $6); 
 	  free($2);
 	  free($4);
 	}
-	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
+	| LOAD table FROM STRING WITH INDEX layout compression LF { 
+	  runLoad($2, $4, true, $7, $8); 
 	  free($2);
 	  free($4);
 	}
 	;
 
+layout:
+	/* empty */ { $$ = RecordFile::FORMAT_SLOTTED; }
+	| LAYOUT ID {
+		if (strcasecmp($2, "row") == 0) $$ = RecordFile::FORMAT_SLOTTED;
+		else if (strcasecmp($2, "pax") == 0) $$ = RecordFile::FORMAT_PAX;
+		else { sqlerror("wrong layout. neither row or pax"); free($2); YYERROR; }
+		free($2);
+	}
+	;
+
+compression:
+	/* empty */ { $$ = PageCodec::NONE; }
+	| COMPRESS ID {
+		$$ = PageCodec::parse($2);
+		if ($$ < 0) { sqlerror("wrong codec. neither none, lz or dict"); free($2); YYERROR; }
+		free($2);
+	}
+	;
+
+show_command:
+	SHOW STATS LF {
+	  SqlEngine::showStats(false);
+	}
+	| SHOW STATS JSON LF {
+	  SqlEngine::showStats(true);
+	}
+	;
+
 select_command:
 	SELECT attributes FROM table LF {
    	        std::vector<SelCond> conds;
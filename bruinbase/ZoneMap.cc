@@ -0,0 +1,137 @@
+#include "ZoneMap.h"
+#include <climits>
+#include <cstring>
+
+using std::string;
+
+//
+// page 0 of a zone map file holds a magic number, the page size, the end
+// record id of the table and the number of entries. the entries follow
+// from page 1 on, ENTRIES_PER_PAGE (min, max) pairs per page, for the
+// pages of the table in order.
+//
+static const int ZONE_MAGIC = 0x5a4f4e45;
+static const int HEADER_INTS = 5;
+
+ZoneMap::ZoneMap()
+{
+  opened = false;
+  clear();
+}
+
+RC ZoneMap::open(const string& filename, char mode)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  int  header[HEADER_INTS], n;
+
+  close();
+  if ((rc = pf.open(filename, mode)) < 0) return rc;
+  opened = true;
+
+  // a new map is empty and describes no table yet
+  if (pf.endPid() == 0) return 0;
+
+  // a map that cannot be read is treated as a new one
+  if ((rc = pf.read(0, page)) < 0) return rc;
+  memcpy(header, page, sizeof(header));
+  n = header[4];
+  if (header[0] != ZONE_MAGIC || header[1] != PageFile::PAGE_SIZE || n < 0 ||
+      1 + (n + ENTRIES_PER_PAGE - 1) / ENTRIES_PER_PAGE > pf.endPid()) {
+    return 0;
+  }
+
+  minKey.resize(n);
+  maxKey.resize(n);
+  dirty.assign((n + ENTRIES_PER_PAGE - 1) / ENTRIES_PER_PAGE, false);
+  for (int i = 0; i < n; i++) {
+    if (i % ENTRIES_PER_PAGE == 0 && (rc = pf.read(1 + i / ENTRIES_PER_PAGE, page)) < 0) {
+      clear();
+      return rc;
+    }
+    memcpy(&minKey[i], page + (i % ENTRIES_PER_PAGE) * 2 * sizeof(int), sizeof(int));
+    memcpy(&maxKey[i], page + (i % ENTRIES_PER_PAGE) * 2 * sizeof(int) + sizeof(int), sizeof(int));
+  }
+  endPid = header[2];
+  endSid = header[3];
+
+  return 0;
+}
+
+RC ZoneMap::close()
+{
+  clear();
+  if (!opened) return 0;
+  opened = false;
+  return pf.close();
+}
+
+void ZoneMap::clear()
+{
+  minKey.clear();
+  maxKey.clear();
+  dirty.clear();
+  endPid = -1;
+  endSid = -1;
+}
+
+void ZoneMap::add(PageId pid, int key)
+{
+  // the pages before pid the map does not know yet have no keys
+  if (pid >= (PageId)minKey.size()) {
+    minKey.resize(pid + 1, INT_MAX);
+    maxKey.resize(pid + 1, INT_MIN);
+    dirty.resize(pid / ENTRIES_PER_PAGE + 1, true);
+  }
+
+  if (key < minKey[pid]) minKey[pid] = key;
+  if (key > maxKey[pid]) maxKey[pid] = key;
+  dirty[pid / ENTRIES_PER_PAGE] = true;
+}
+
+bool ZoneMap::mayContain(PageId pid, int lo, int hi) const
+{
+  if (pid < 0 || pid >= (PageId)minKey.size()) return true;
+  return minKey[pid] <= hi && maxKey[pid] >= lo;
+}
+
+RC ZoneMap::save(PageId endPid, int endSid)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  int  header[HEADER_INTS];
+  int  n = minKey.size();
+
+  if (!opened) return 0;
+
+  // the changed pages of entries
+  for (int p = 0; p < (int)dirty.size(); p++) {
+    if (!dirty[p]) continue;
+    memset(page, 0, PageFile::PAGE_SIZE);
+    for (int i = p * ENTRIES_PER_PAGE; i < n && i < (p + 1) * ENTRIES_PER_PAGE; i++) {
+      memcpy(page + (i % ENTRIES_PER_PAGE) * 2 * sizeof(int), &minKey[i], sizeof(int));
+      memcpy(page + (i % ENTRIES_PER_PAGE) * 2 * sizeof(int) + sizeof(int), &maxKey[i], sizeof(int));
+    }
+    if ((rc = pf.write(1 + p, page)) < 0) return rc;
+    dirty[p] = false;
+  }
+
+  // and the header, which tells the table they describe
+  header[0] = ZONE_MAGIC;
+  header[1] = PageFile::PAGE_SIZE;
+  header[2] = endPid;
+  header[3] = endSid;
+  header[4] = n;
+  memset(page, 0, PageFile::PAGE_SIZE);
+  memcpy(page, header, sizeof(header));
+  if ((rc = pf.write(0, page)) < 0) return rc;
+
+  this->endPid = endPid;
+  this->endSid = endSid;
+  return 0;
+}
+
+bool ZoneMap::savedFor(PageId endPid, int endSid) const
+{
+  return opened && this->endPid == endPid && this->endSid == endSid;
+}
@@ -0,0 +1,96 @@
+#ifndef ZONEMAP_H
+#define ZONEMAP_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * The smallest and the largest key of every page of a table file, kept
+ * in a side file next to it. A scan looking for a range of keys skips
+ * the pages whose keys are all outside the range, without reading them.
+ *
+ * The map is read into memory when it is opened and the pages that
+ * changed are written back by save(). It also records the end record id
+ * of the table it was saved for, so that a map that does not match its
+ * table is noticed and not used.
+ */
+class ZoneMap {
+ public:
+  ZoneMap();
+
+  /**
+   * open the zone map file and read the map into memory.
+   * a file that does not exist is created in 'w' mode, and leaves the
+   * map closed in 'r' mode.
+   * @param filename[IN] the name of the zone map file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode);
+
+  /**
+   * close the file. changes not saved are lost.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * @return whether the map is open
+   */
+  bool isOpen() const { return opened; }
+
+  /**
+   * forget the keys of every page.
+   */
+  void clear();
+
+  /**
+   * note that a key is stored in a page of the table.
+   * @param pid[IN] the page of the table
+   * @param key[IN] the key
+   */
+  void add(PageId pid, int key);
+
+  /**
+   * check whether a page of the table may hold a key in [lo, hi].
+   * a page the map knows nothing about may.
+   * @param pid[IN] the page of the table
+   * @param lo[IN] the smallest key of the range
+   * @param hi[IN] the largest key of the range
+   * @return false if no key of the page is in the range
+   */
+  bool mayContain(PageId pid, int lo, int hi) const;
+
+  /**
+   * write the changed pages of the map to the file.
+   * @param endPid[IN] the pid of the end record id of the table
+   * @param endSid[IN] the sid of the end record id of the table
+   * @return error code. 0 if no error
+   */
+  RC save(PageId endPid, int endSid);
+
+  /**
+   * check whether the map was saved for a table with the given end
+   * record id, that is, whether it describes the table.
+   * @param endPid[IN] the pid of the end record id of the table
+   * @param endSid[IN] the sid of the end record id of the table
+   * @return true if it was
+   */
+  bool savedFor(PageId endPid, int endSid) const;
+
+ private:
+  // # of (min, max) entries in a page of the file. page 0 is the header.
+  static const int ENTRIES_PER_PAGE = PageFile::PAGE_SIZE / (2 * sizeof(int));
+
+  PageFile pf;
+  bool     opened;
+  PageId   endPid;            // the end record id of the table,
+  int      endSid;            // as saved
+  std::vector<int> minKey;    // the smallest key of every page of the
+  std::vector<int> maxKey;    // table, INT_MAX (INT_MIN) if it has none
+  std::vector<bool> dirty;    // the pages of the file changed since saved
+};
+
+#endif // ZONEMAP_H
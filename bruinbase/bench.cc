@@ -0,0 +1,305 @@
+#include "BTreeIndex.h"
+#include "PageFile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <vector>
+
+/**
+ * A multi-threaded stress test and benchmark of BTreeIndex.
+ *
+ * usage: bench [keys [seconds [threads]]]
+ *
+ * The even keys 0, 2, 4, ... are bulk loaded into an index. For 1, 2,
+ * 4, ... reader threads, up to threads (the # of cores by default), it
+ * measures how many lookups a second the readers make, first alone and
+ * then while a loader thread inserts odd keys all over the index. A last
+ * run has as many loaders as readers, at least 2, inserting at once. The
+ * index is built again before every run.
+ *
+ * The readers check what they find. Every even key must be found with
+ * its RecordId, and every 64th lookup is a short scan, forward or
+ * backward, that must return its keys in order without skipping an even
+ * key. After a run with loaders, every key they inserted must be found,
+ * and the index must hold no other keys. The exit status is 1 if a check
+ * failed.
+ *
+ * The size of the buffer pool is taken from BRUINBASE_CACHE_MB.
+ */
+
+static const char* INDEX_FILE = "bench.idx";
+static const int SCAN_EVERY = 64;
+static const int SCAN_LENGTH = 32;
+
+// the RecordId stored with a key
+static RecordId ridOf(int key)
+{
+  RecordId rid;
+  rid.pid = key / 100;
+  rid.sid = key % 100;
+  return rid;
+}
+
+// the even keys, in order
+class EvenKeys : public EntrySource {
+ public:
+  EvenKeys(int count) : next_(0), count(count) {}
+  RC next(int& key, RecordId& rid)
+  {
+    if (next_ >= count) return RC_END_OF_FILE;
+    key = 2 * next_++;
+    rid = ridOf(key);
+    return 0;
+  }
+ private:
+  int next_, count;
+};
+
+struct Run {
+  BTreeIndex* index;
+  int  keys;                 // # of even keys
+  volatile bool stop;
+  volatile long long errors;
+};
+
+struct Worker {
+  Run*      run;
+  pthread_t thread;
+  unsigned  seed;
+  long long ops;
+  long long first, step;  // the odd keys of a loader, and where it stopped
+  long long last;
+};
+
+// the i-th odd key inserted, in an order that spreads them over the index
+static int oddKey(long long i, int keys)
+{
+  return 2 * (int)((i * 2654435761LL) % keys) + 1;
+}
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// scan SCAN_LENGTH entries from key on, forward or backward. the even
+// keys are all there, so two keys in a row are never more than 2 apart.
+static bool scan(BTreeIndex::Scanner& scanner, int key, bool backward)
+{
+  int      keys[SCAN_LENGTH];
+  RecordId rids[SCAN_LENGTH];
+  int      last = key, n = 0, got;
+
+  if ((backward ? scanner.locateLast(key) : scanner.locate(key)) != 0) return false;
+  while (n < SCAN_LENGTH) {
+    got = backward ? scanner.prev(keys, rids, SCAN_LENGTH - n)
+                   : scanner.next(keys, rids, SCAN_LENGTH - n);
+    if (got < 0) return false;
+    if (got == 0) break;
+    for (int i = 0; i < got; i++) {
+      int step = backward ? last - keys[i] : keys[i] - last;
+      if (step < (n == 0 ? 0 : 1) || step > 2) return false;
+      last = keys[i];
+      n++;
+    }
+  }
+  return true;
+}
+
+static void* reader(void* arg)
+{
+  Worker*  w = (Worker*)arg;
+  Run*     run = w->run;
+  int      key, found;
+  RecordId rid, expect;
+
+  // a Scanner, unlike an IndexCursor, stays right while the loader
+  // inserts into the leaf it is at
+  BTreeIndex::Scanner scanner(*run->index);
+
+  while (!run->stop) {
+    key = 2 * (int)(rand_r(&w->seed) % run->keys);
+    if (w->ops % SCAN_EVERY == SCAN_EVERY - 1) {
+      if (!scan(scanner, key, w->ops % (2 * SCAN_EVERY) < SCAN_EVERY)) {
+        __sync_fetch_and_add(&run->errors, 1);
+      }
+    } else {
+      expect = ridOf(key);
+      if (scanner.locate(key) != 0 || scanner.next(found, rid) != 0 ||
+          found != key || rid.pid != expect.pid || rid.sid != expect.sid) {
+        __sync_fetch_and_add(&run->errors, 1);
+      }
+    }
+    w->ops++;
+  }
+  return NULL;
+}
+
+static void* loader(void* arg)
+{
+  Worker*   w = (Worker*)arg;
+  Run*      run = w->run;
+  long long i;
+  int       key;
+
+  // the loaders take turns through the odd keys, none of which is in the
+  // index yet, so every insert must succeed
+  for (i = w->first; i < run->keys && !run->stop; i += w->step) {
+    key = oddKey(i, run->keys);
+    if (run->index->insert(key, ridOf(key)) == 0) w->ops++;
+    else __sync_fetch_and_add(&run->errors, 1);
+  }
+  w->last = i;
+  return NULL;
+}
+
+// check that the index holds the even keys and the odd keys the loaders
+// inserted, and nothing else
+static long long verify(BTreeIndex& index, int keys, const std::vector<Worker>& loaders)
+{
+  BTreeIndex::Scanner scanner(index);
+  long long errors = 0, count = 0, inserted = 0;
+  int       key, found, last = -1;
+  RecordId  rid, expect;
+
+  for (unsigned l = 0; l < loaders.size(); l++) {
+    inserted += loaders[l].ops;
+    for (long long i = loaders[l].first; i < loaders[l].last; i += loaders[l].step) {
+      key = oddKey(i, keys);
+      expect = ridOf(key);
+      if (scanner.locate(key) != 0 || scanner.next(found, rid) != 0 ||
+          found != key || rid.pid != expect.pid || rid.sid != expect.sid) {
+        errors++;
+      }
+    }
+  }
+
+  // a full scan sees every even key, in order, and only the odd keys
+  // inserted
+  if (scanner.first() != 0) return errors + 1;
+  while (scanner.next(key, rid) == 0) {
+    if (key <= last || (key % 2 == 0 && key != last + 1 && key != last + 2)) errors++;
+    last = key;
+    count++;
+  }
+  if (count != keys + inserted) errors++;
+  return errors;
+}
+
+// build the index and run the readers, and the given # of loaders, for
+// the given # of seconds. the rates per second are returned.
+static RC measure(int keys, int seconds, int readers, int loaders,
+                  double& lookups, double& inserts, long long& errors)
+{
+  BTreeIndex index;
+  Run        run;
+  std::vector<Worker> workers(readers);
+  std::vector<Worker> loading(loaders);
+  double     start, elapsed;
+  RC         rc;
+  EvenKeys   source(keys);
+
+  unlink(INDEX_FILE);
+  if ((rc = index.open(INDEX_FILE, 'w')) < 0) return rc;
+  if ((rc = index.bulkLoad(source)) < 0) return rc;
+
+  run.index = &index;
+  run.keys = keys;
+  run.stop = false;
+  run.errors = 0;
+
+  // the first lookup reads the non-leaf nodes into memory
+  IndexCursor cursor;
+  index.locate(0, cursor);
+
+  start = now();
+  for (int i = 0; i < readers; i++) {
+    workers[i].run = &run;
+    workers[i].seed = 12345 + i;
+    workers[i].ops = 0;
+    pthread_create(&workers[i].thread, NULL, reader, &workers[i]);
+  }
+  for (int i = 0; i < loaders; i++) {
+    loading[i].run = &run;
+    loading[i].ops = 0;
+    loading[i].first = i;
+    loading[i].step = loaders;
+    pthread_create(&loading[i].thread, NULL, loader, &loading[i]);
+  }
+  sleep(seconds);
+  run.stop = true;
+  for (int i = 0; i < readers; i++) pthread_join(workers[i].thread, NULL);
+  for (int i = 0; i < loaders; i++) pthread_join(loading[i].thread, NULL);
+  elapsed = now() - start;
+
+  lookups = inserts = 0;
+  for (int i = 0; i < readers; i++) lookups += workers[i].ops;
+  for (int i = 0; i < loaders; i++) inserts += loading[i].ops;
+  lookups /= elapsed;
+  inserts /= elapsed;
+  errors = run.errors;
+  if (loaders > 0) errors += verify(index, keys, loading);
+
+  index.close();
+  unlink(INDEX_FILE);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  int keys = argc > 1 ? atoi(argv[1]) : 1000000;
+  int seconds = argc > 2 ? atoi(argv[2]) : 3;
+  int threads = argc > 3 ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  double lookups, loaded, inserts;
+  long long errors, total = 0;
+  RC rc;
+
+  if (keys < 1 || seconds < 1 || threads < 1) {
+    fprintf(stderr, "usage: %s [keys [seconds [threads]]]\n", argv[0]);
+    return 2;
+  }
+
+  const char* cacheMB = getenv("BRUINBASE_CACHE_MB");
+  if (cacheMB != NULL && atoi(cacheMB) > 0) {
+    PageFile::setCacheSize((size_t)atoi(cacheMB) * 1024 * 1024);
+  }
+
+  printf("%d keys, %d s per run, %ld cores\n", keys, seconds, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%8s %12s %12s %14s %12s %10s\n",
+         "readers", "lookups/s", "per reader", "with loader", "per reader", "inserts/s");
+
+  for (int n = 1; ; n = (2 * n < threads) ? 2 * n : threads) {
+    if ((rc = measure(keys, seconds, n, 0, lookups, inserts, errors)) < 0) break;
+    total += errors;
+    if ((rc = measure(keys, seconds, n, 1, loaded, inserts, errors)) < 0) break;
+    total += errors;
+    printf("%8d %12.0f %12.0f %14.0f %12.0f %10.0f\n",
+           n, lookups, lookups / n, loaded, loaded / n, inserts);
+    fflush(stdout);
+    if (n == threads) break;
+  }
+
+  // several loaders insert at once
+  int loaders = (threads < 2) ? 2 : threads;
+  if (rc == 0 && (rc = measure(keys, seconds, threads, loaders, loaded, inserts, errors)) == 0) {
+    total += errors;
+    printf("%d readers and %d loaders: %.0f lookups/s, %.0f inserts/s\n",
+           threads, loaders, loaded, inserts);
+  }
+  if (rc < 0) {
+    fprintf(stderr, "Error %d while running the benchmark\n", rc);
+    return 1;
+  }
+
+  if (total > 0) {
+    printf("%lld checks failed\n", total);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
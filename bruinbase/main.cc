@@ -9,10 +9,36 @@
  
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "PageFile.h"
 #include <cstdio>
+#include <cstdlib>
 
 int main()
 {
+  // size the buffer pool from the environment, e.g. BRUINBASE_CACHE_MB=64
+  const char* cacheMB = getenv("BRUINBASE_CACHE_MB");
+  if (cacheMB != NULL && atoi(cacheMB) > 0) {
+    PageFile::setCacheSize((size_t)atoi(cacheMB) * 1024 * 1024);
+  }
+
+  // read tables and indexes through memory mappings, e.g. BRUINBASE_MMAP=1
+  const char* mmapOpt = getenv("BRUINBASE_MMAP");
+  if (mmapOpt != NULL && atoi(mmapOpt) != 0) {
+    SqlEngine::setReadOptions(PageFile::OPEN_MMAP);
+  }
+
+  // bypass the OS page cache with O_DIRECT, e.g. BRUINBASE_DIRECT=1.
+  // the buffer pool is then the only cache, so size it to the working
+  // set with BRUINBASE_CACHE_MB. tables and indexes read through a
+  // memory mapping keep using the OS page cache.
+  const char* directOpt = getenv("BRUINBASE_DIRECT");
+  if (directOpt != NULL && atoi(directOpt) != 0) {
+    if (mmapOpt == NULL || atoi(mmapOpt) == 0) {
+      SqlEngine::setReadOptions(PageFile::OPEN_DIRECT);
+    }
+    SqlEngine::setWriteOptions(PageFile::OPEN_DIRECT);
+  }
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 
@@ -32,7 +32,7 @@ void testInsertSplitNonLeaf() {
     BTNonLeafNode testNonLeaf;
     testNonLeaf.initializeRoot(p1,3,p2);
     
-    for (int i = 0; i < 70; i++) {
+    for (int i = 0; i < BTNonLeafNode::MAX_KEY_COUNT; i++) {
     	if (testNonLeaf.insert((13 + 7*i), (14+i)) < 0) 
     		printf("NonLeafNode at max size\n");
     }
@@ -119,7 +119,7 @@ void testInsertSplitLeaf() {
     BTLeafNode splitTestLeaf;
     BTLeafNode afterSplitTestLeaf;
 
-    for (int i = 1; i <= 70; i++) {
+    for (int i = 1; i <= BTLeafNode::MAX_KEY_COUNT; i++) {
     	splitTestLeaf.insert(5*i, rid);
     }
 
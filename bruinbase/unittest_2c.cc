@@ -1,10 +1,211 @@
 #include <cstdlib>
 #include <cstdio>
 #include <cassert>
+#include <climits>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
 
 #include "BTreeIndex.h"
+#include "BTreeNode.h"
+#include "ExternalSort.h"
 
 #define DEBUGPRINTOUT true
+
+//Runs of 100 entries with the same key: INT_MIN, then 1, 2, ... The
+//RecordIds have the given pid
+class RepeatedKeys : public EntrySource {
+  public:
+    RepeatedKeys(int count, PageId pid) : i(0), count(count), pid(pid) {}
+    RC next(int& key, RecordId& rid) {
+        if (i == count) return RC_END_OF_FILE;
+        key = (i < 100) ? INT_MIN : i / 100;
+        rid.pid = pid;
+        rid.sid = i++;
+        return 0;
+    }
+  private:
+    int i, count;
+    PageId pid;
+};
+
+//Orders (key, # of the record) pairs by key only, for std::stable_sort
+static bool byKey(const std::pair<long long, int>& a, const std::pair<long long, int>& b) {
+    return a.first < b.first;
+}
+
+//Sorts n records with few distinct keys, which do not fit in an int,
+//through ExternalSort and checks that they come out as std::stable_sort
+//orders them, bytes and all
+static void testExternalSort(int n, size_t memory, int threads, bool spills) {
+    ExternalSort sorter(memory, threads);
+    std::vector<std::pair<long long, int> > expected;
+    char data[16];
+    const char* got;
+    long long key;
+    int length, i;
+
+    srand(n + threads);
+    for (i = 0; i < n; i++) {
+        key = (rand() % 1000 - 500) * 4294967311LL;
+        //The record holds its own number, with a length that varies
+        memset(data, i % 251, sizeof(data));
+        memcpy(data, &i, sizeof(int));
+        assert(sorter.add(key, data, sizeof(int) + i % 12) == 0);
+        expected.push_back(std::make_pair(key, i));
+    }
+    std::stable_sort(expected.begin(), expected.end(), byKey);
+
+    assert(sorter.sort() == 0);
+    assert((sorter.getRunCount() > 1) == spills);
+    for (i = 0; i < n; i++) {
+        assert(sorter.next(key, got, length) == 0);
+        assert(key == expected[i].first);
+        assert(length == (int)sizeof(int) + expected[i].second % 12);
+        assert(memcmp(got, &expected[i].second, sizeof(int)) == 0);
+        for (int j = sizeof(int); j < length; j++) {
+            assert((unsigned char)got[j] == expected[i].second % 251);
+        }
+    }
+    assert(sorter.next(key, got, length) == RC_END_OF_FILE);
+}
+
+//A record sorted by a key and then by a string, and its number
+struct Titled {
+    long long key;
+    std::string title;
+    int i;
+};
+
+static bool byKeyAndTitle(const Titled& a, const Titled& b) {
+    return a.key < b.key || (a.key == b.key && a.title < b.title);
+}
+
+//Sorts n records with few distinct keys and short strings of 'a' and 'b'
+//in front of their bytes, which order the records with the same key,
+//and checks that they come out as std::stable_sort orders them
+static void testExternalSortPrefix(int n, size_t memory, int threads, bool spills) {
+    ExternalSort sorter(memory, threads);
+    std::vector<Titled> expected;
+    char data[16];
+    const char* got;
+    long long key;
+    int length, i;
+
+    srand(n + threads);
+    for (i = 0; i < n; i++) {
+        Titled t;
+        t.key = rand() % 4;
+        t.title = std::string(rand() % 8, 'a');
+        for (unsigned j = 0; j < t.title.size(); j++) {
+            if (rand() % 2) t.title[j] = 'b';
+        }
+        t.i = i;
+        memcpy(data, t.title.data(), t.title.size());
+        memcpy(data + t.title.size(), &i, sizeof(int));
+        assert(sorter.add(t.key, data, t.title.size() + sizeof(int), t.title.size()) == 0);
+        expected.push_back(t);
+    }
+    std::stable_sort(expected.begin(), expected.end(), byKeyAndTitle);
+
+    assert(sorter.sort() == 0);
+    assert((sorter.getRunCount() > 1) == spills);
+    for (i = 0; i < n; i++) {
+        int size = expected[i].title.size();
+        assert(sorter.next(key, got, length) == 0);
+        assert(key == expected[i].key && length == size + (int)sizeof(int));
+        assert(memcmp(got, expected[i].title.data(), size) == 0);
+        assert(memcmp(got + size, &expected[i].i, sizeof(int)) == 0);
+    }
+    assert(sorter.next(key, got, length) == RC_END_OF_FILE);
+}
+
+//Runs of 100 entries with the same title, "Harry Potter 01" and on, whose
+//RecordIds have the number of the entry
+class RepeatedTitles : public EntrySourceStr {
+  public:
+    RepeatedTitles(int count) : i(0), count(count) {}
+    RC next(StringKey& key, RecordId& rid) {
+        char title[32];
+        if (i == count) return RC_END_OF_FILE;
+        key = StringKey(title, sprintf(title, "Harry Potter %02d", 1 + i / 100));
+        rid.pid = 0;
+        rid.sid = i++;
+        return 0;
+    }
+  private:
+    int i, count;
+};
+
+//The title of number k: one of a few long titles that many share,
+//followed by k
+static std::string title(int k) {
+    static const char* names[] = { "The Lord of the Rings ", "Star Trek ", "Star Wars ", "" };
+    char buf[64];
+    sprintf(buf, "%s%d", names[k % 4], k);
+    return buf;
+}
+
+static bool byTitle(int a, int b) {
+    return title(a) < title(b);
+}
+
+//The even keys 0, 2, ..., 2 * (count - 1)
+class EvenKeys : public EntrySource {
+  public:
+    EvenKeys(int count) : i(0), count(count) {}
+    RC next(int& key, RecordId& rid) {
+        if (i == count) return RC_END_OF_FILE;
+        key = 2 * i;
+        rid.pid = i / 100;
+        rid.sid = i++ % 100;
+        return 0;
+    }
+  private:
+    int i, count;
+};
+
+//Looks up unsorted, repeated and missing keys with locateBatch() in an
+//index of count even keys and checks every result against locate()
+static void testLocateBatch(int count, int height) {
+    BTreeIndex index;
+    EvenKeys source(count);
+    const int n = 2000;
+    int keys[n], key, found = 0;
+    IndexCursor cursors[n], cursor;
+    RecordId rids[n], rid;
+    RC rc;
+
+    remove("test.batch");
+    assert(index.open("test.batch", 'w') == 0);
+    assert(index.bulkLoad(source) == 0);
+    assert(index.getTreeHeight() == height);
+
+    srand(count);
+    for (int i = 0; i < n; i++) {
+        //Some probes repeat one made before, and about half are odd or
+        //out of range, i.e., missing
+        keys[i] = (i > 0 && i % 5 == 0) ? keys[rand() % i] : rand() % (2 * count + 20) - 10;
+    }
+    int got = index.locateBatch(keys, n, cursors, rids);
+
+    for (int i = 0; i < n; i++) {
+        rc = index.locate(keys[i], cursor);
+        assert(cursors[i].pid == cursor.pid && cursors[i].eid == cursor.eid);
+        if (rc == 0) {
+            assert(index.readForward(cursor, key, rid) == 0 && key == keys[i]);
+            assert(rids[i].pid == rid.pid && rids[i].sid == rid.sid);
+            found++;
+        } else {
+            assert(rids[i].pid == -1);
+        }
+    }
+    assert(got == found && found > 0 && found < n);
+    assert(index.close() == 0);
+    remove("test.batch");
+}
+
 int main (int argc, char **argv) {
     //Random variables
     IndexCursor cursor;
@@ -37,7 +238,9 @@ int main (int argc, char **argv) {
 
     printf("Testing basic insert functionality:");
 
-    for (i = 0; i < 70; i++) {
+    //Filling the root leaf exactly
+    const int leafMax = BTLeafNode::MAX_KEY_COUNT;
+    for (i = 0; i < leafMax; i++) {
         rid.pid = 0;
         rid.sid = i;
         assert(index.insert(i, rid) == 0);
@@ -51,21 +254,21 @@ int main (int argc, char **argv) {
     assert(index.locate(1, cursor) == 0);
     assert(cursor.pid == 1);
     assert(cursor.eid == 1);
-    assert(index.locate(69, cursor) == 0);
+    assert(index.locate(leafMax - 1, cursor) == 0);
     assert(cursor.pid == 1);
-    assert(cursor.eid == 69);
-    assert(index.locate(70, cursor) == RC_NO_SUCH_RECORD);
+    assert(cursor.eid == leafMax - 1);
+    assert(index.locate(leafMax, cursor) == RC_NO_SUCH_RECORD);
     printf(" Good!\n");
 
     printf("Testing advanced insert functionality (new root creation):");
     rid.pid = 0;
-    rid.sid = 70;
-    assert(index.insert(70, rid) == 0);
+    rid.sid = leafMax;
+    assert(index.insert(leafMax, rid) == 0);
     assert(index.getRootPid() == 3);
     assert(index.getTreeHeight() == 2);
-    assert(index.locate(70, cursor) == 0);
+    assert(index.locate(leafMax, cursor) == 0);
     assert(cursor.pid == 2);
-    assert(cursor.eid == 34);
+    assert(cursor.eid == (leafMax + 1) / 2 - 1);
     assert(index.close() == 0);
     assert(index.open(fileName, 'w') == 0);
     assert(index.getRootPid() == 3); 
@@ -73,7 +276,7 @@ int main (int argc, char **argv) {
     printf(" Good!\n");
 
     printf("Testing advanced insert functionality (inserting into a nonleaf):");
-    for (i = 71; i < 107; i++) {
+    for (i = leafMax + 1; i < leafMax + 37; i++) {
         rid.pid = 0;
         rid.sid = i;
         assert(index.insert(i, rid) == 0);
@@ -85,12 +288,17 @@ int main (int argc, char **argv) {
     printf(" Good!\n");
     printf("Final test:");
 
-    for (i = 107; i < 3500; i++) {
+    for (i = leafMax + 37; i < 3500; i++) {
         rid.pid = 0;
         rid.sid = i;
         assert(index.insert(i, rid) == 0);
     }
 
+    //A key the index holds is refused, and skipped by a later bulk load
+    EvenKeys held(100);
+    assert(index.insert(1000, rid) == RC_DUPLICATE_KEY);
+    assert(index.bulkLoad(held) == 0);
+
     assert(index.close() == 0);
     assert(index.open(fileName, 'r') == 0);
 
@@ -103,6 +311,152 @@ int main (int argc, char **argv) {
     if (DEBUGPRINTOUT) index.debugPrintout();
     printf(" Good!\n");
 
+    printf("Testing backward scan:");
+    int key;
+    assert(index.locateLast(5000, cursor) == RC_NO_SUCH_RECORD);
+    for (i = 3499; i >= 0; i--) {
+        assert(index.readBackward(cursor, key, rid) == 0);
+        assert(key == i && rid.sid == i);
+    }
+    assert(index.readBackward(cursor, key, rid) == RC_END_OF_TREE);
+    printf(" Good!\n");
+
+
+    printf("Testing batch lookups:");
+    testLocateBatch(leafMax / 2, 1);
+    testLocateBatch(leafMax * 20, 2);
+    testLocateBatch(leafMax * (BTNonLeafNode::MAX_KEY_COUNT + 1) * 2, 3);
+    printf(" Good!\n");
+
+
+    printf("Testing bulk loading of duplicate keys:");
+    BTreeIndex dups;
+    RepeatedKeys source(3500, 0);
+    RepeatedKeys more(3500, 1);
+    remove("test.dups");
+    assert(dups.open("test.dups", 'w') == 0);
+    assert(dups.bulkLoad(source, 100, true) == 0);
+    assert(dups.getTreeHeight() > 1);
+    {
+        BTreeIndex::Scanner scan(dups);
+        assert(scan.first() == 0);
+        for (i = 0; i < 100; i++) {
+            assert(scan.next(key, rid) == 0 && key == INT_MIN && rid.sid == i);
+        }
+        for (int k = 1; k < 35; k++) {
+            assert(scan.locateLast(k - 1) == 0);
+            for (i = 0; i < 100; i++) {
+                assert(scan.next(key, rid) == 0 && key == k && rid.sid == k * 100 + i);
+            }
+        }
+    }
+    //A second load goes behind the entries with the same keys
+    assert(dups.close() == 0);
+    assert(dups.open("test.dups", 'w') == 0);
+    assert(dups.bulkLoad(more, 100, true) == 0);
+    assert(dups.close() == 0);
+    assert(dups.open("test.dups", 'r') == 0);
+    {
+        BTreeIndex::Scanner scan(dups);
+        for (int k = 1; k < 35; k++) {
+            assert(scan.locateLast(k - 1) == 0);
+            for (i = 0; i < 200; i++) {
+                assert(scan.next(key, rid) == 0 && key == k);
+                assert(rid.pid == i / 100 && rid.sid == k * 100 + i % 100);
+            }
+            assert(scan.next(key, rid) != 0 || key != k);
+        }
+    }
+    assert(dups.close() == 0);
+    remove("test.dups");
+    printf(" Good!\n");
+
+
+    printf("Testing string keys:");
+    BTreeIndexStr titles;
+    BTreeIndex narrow;
+    StringKey name;
+    std::vector<int> order;
+    remove("test.wide");
+    assert(titles.open("test.wide", 'w') == 0);
+    //The keys are inserted out of order, and many share a long prefix
+    for (i = 0; i < 3000; i++) {
+        int k = (int)((i * 2654435761LL) % 3000);
+        std::string t = title(k);
+        rid.pid = 0;
+        rid.sid = k;
+        assert(titles.insert(StringKey(t.data(), t.size()), rid) == 0);
+        order.push_back(k);
+    }
+    std::sort(order.begin(), order.end(), byTitle);
+    assert(titles.insert(StringKey("Star Trek 1", 11), rid) == RC_DUPLICATE_KEY);
+    assert(titles.getTreeHeight() > 1);
+    assert(titles.close() == 0);
+    assert(titles.open("test.wide", 'r') == 0);
+    {
+        BTreeIndexStr::Scanner scan(titles);
+        assert(scan.first() == 0);
+        for (i = 0; i < 3000; i++) {
+            std::string t = title(order[i]);
+            assert(scan.next(name, rid) == 0);
+            assert(name == StringKey(t.data(), t.size()) && rid.sid == order[i]);
+        }
+        assert(scan.next(name, rid) == RC_END_OF_TREE);
+        assert(scan.locate(StringKey("Star Trek 5", 11)) == 0);
+        assert(scan.next(name, rid) == 0 && rid.sid == 5);
+    }
+    assert(titles.locate(StringKey("Star Trek 1001", 14), cursor) == 0);
+    assert(titles.locate(StringKey("Star Trek 1002", 14), cursor) == RC_NO_SUCH_RECORD);
+    assert(titles.close() == 0);
+    //An index only opens with the key type it was built with
+    assert(narrow.open("test.wide", 'r') == RC_INVALID_FILE_FORMAT);
+    remove("test.wide");
+
+    //A non-leaf node keeps the shortest key between two leaves
+    assert(separatorKey(StringKey("Star Trek", 9), StringKey("Star Wars", 9)) == StringKey("Star W", 6));
+    assert(separatorKey(StringKey("Star", 4), StringKey("Star Wars", 9)) == StringKey("Star ", 5));
+    assert(separatorKey(StringKey("Star", 4), StringKey("Star", 4)) == StringKey("Star", 4));
+    //A value longer than a key is cut
+    {
+        char longValue[150];
+        memset(longValue, 'x', sizeof(longValue));
+        assert(StringKey(longValue, 150) == StringKey(longValue, StringKey::MAX_LENGTH));
+        assert(StringKey(longValue, 99) < StringKey(longValue, 150));
+    }
+
+    //A scan started at a title sees its whole run, which spans leaves
+    RepeatedTitles runs(2000);
+    assert(titles.open("test.wide", 'w') == 0);
+    assert(titles.bulkLoad(runs, 100, true) == 0);
+    assert(titles.getTreeHeight() > 1);
+    {
+        BTreeIndexStr::Scanner scan(titles);
+        for (int k = 1; k <= 20; k++) {
+            char t[32];
+            StringKey key(t, sprintf(t, "Harry Potter %02d", k));
+            assert(scan.locate(key) == 0);
+            for (i = 0; i < 100; i++) {
+                assert(scan.next(name, rid) == 0 && name == key && rid.sid == (k - 1) * 100 + i);
+            }
+            assert(scan.next(name, rid) != 0 || name != key);
+        }
+    }
+    assert(titles.close() == 0);
+    remove("test.wide");
+    printf(" Good!\n");
+
+
+    printf("Testing external sort:");
+    testExternalSort(0, ExternalSort::DEFAULT_MEMORY, 1, false);
+    testExternalSort(5000, ExternalSort::DEFAULT_MEMORY, 4, false);
+    //The smallest budget spills a run every 64KB or so
+    testExternalSort(100000, 0, 1, true);
+    testExternalSort(100000, 256 * 1024, 4, true);
+    testExternalSort(300000, 1024 * 1024, 8, true);
+    testExternalSortPrefix(5000, ExternalSort::DEFAULT_MEMORY, 1, false);
+    testExternalSortPrefix(100000, 256 * 1024, 4, true);
+    printf(" Good!\n");
+
 
     printf("----------------Ending Test--------------------\n");
 }